@@ -0,0 +1,471 @@
+/* The scanner as it was before the character tables and keyword hash, frozen for cynch-scan-bench to compare with
+ *
+ *  Only its entry points are renamed, and the three bugs it had are fixed so both scanners produce the same tokens:
+ *  identifiers weren't dispatched to, "true" was spelled "trUE", and '!', '=', '<' and '>' never matched a '='.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "common.h"
+#include "scanner.h"
+
+/* Initializes a scanner struct
+ *
+ *  Params:
+ *      scanner:     the scanner to initialize
+ *      source:      the source of the tokens to be scanned
+ */
+void baselineInitScanner(Scanner* scanner, const char* source) {
+	scanner->start = source;
+	scanner->current = source;
+	scanner->line = 1;
+}
+
+/* Checks if the given character is a digit
+ *
+ *  Returns:
+ *      True if the character is a digit, false otherwise.
+ */
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/* Checks if the given character is a letter or underscore
+ *
+ *  Returns:
+ *      True if the character is a letter or underscore, false otherwise.
+ */
+static bool isAlpha(char c) {
+	return (c >= 'a' && c <= 'z') ||
+			(c >= 'A' && c <= 'Z') ||
+			c == '_';
+}
+
+/* Runs of characters
+ *
+ *  Whitespace, comment bodies, identifiers and numbers are runs of characters of one class, so the scanner finds
+ *  where they end a whole vector of characters at a time: it classifies LANE_WIDTH characters at once into a bit mask
+ *  and takes the first character outside the class from the mask's trailing zeros. Newlines are counted from the
+ *  same masks, so the line stays exact without looking at each character.
+ *
+ *  The vectors are loaded from addresses aligned to LANE_WIDTH, starting with the one holding the first character.
+ *  An aligned load never crosses a page, so the characters it reads past the end of the source (after the
+ *  terminator, which ends every run) are on a page the source is on, and reading them can't fault. Characters
+ *  before the run's start are masked off.
+ */
+typedef enum {
+	CLASS_SPACE,            // ' ', '\t', '\r' and '\n'
+	CLASS_COMMENT,          // Anything but '\n' and the terminator
+	CLASS_IDENTIFIER,       // Letters, digits and '_'
+	CLASS_DIGIT,
+} CharClass;
+
+/* Checks if a character belongs to a class, one character at a time
+ *
+ */
+static bool inClass(char c, CharClass charClass) {
+	switch (charClass) {
+		case CLASS_SPACE:      return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+		case CLASS_COMMENT:    return c != '\n' && c != '\0';
+		case CLASS_IDENTIFIER: return isAlpha(c) || isDigit(c);
+		case CLASS_DIGIT:      return isDigit(c);
+	}
+
+	return false;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#ifdef __AVX2__
+#define LANE_WIDTH 32
+#define LANE_ALL 0xffffffffu
+typedef __m256i Lanes;
+#define loadLanes(pointer)       _mm256_load_si256((const __m256i*)(pointer))
+#define splatLanes(c)            _mm256_set1_epi8(c)
+#define equalLanes(a, b)         _mm256_cmpeq_epi8(a, b)
+#define greaterLanes(a, b)       _mm256_cmpgt_epi8(a, b)
+#define orLanes(a, b)            _mm256_or_si256(a, b)
+#define andLanes(a, b)           _mm256_and_si256(a, b)
+#define maskLanes(a)             ((uint32_t)_mm256_movemask_epi8(a))
+#else
+#define LANE_WIDTH 16
+#define LANE_ALL 0xffffu
+typedef __m128i Lanes;
+#define loadLanes(pointer)       _mm_load_si128((const __m128i*)(pointer))
+#define splatLanes(c)            _mm_set1_epi8(c)
+#define equalLanes(a, b)         _mm_cmpeq_epi8(a, b)
+#define greaterLanes(a, b)       _mm_cmpgt_epi8(a, b)
+#define orLanes(a, b)            _mm_or_si128(a, b)
+#define andLanes(a, b)           _mm_and_si128(a, b)
+#define maskLanes(a)             ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#define SCALAR_RUN 4             // Characters checked one at a time before switching to vectors
+
+// Lanes holding characters from low to high, compared signed: characters above 0x7f are negative and in no range
+#define rangeLanes(lanes, low, high) \
+	andLanes(greaterLanes(lanes, splatLanes((low) - 1)), greaterLanes(splatLanes((high) + 1), lanes))
+
+/* Classifies a vector of characters
+ *
+ *  Returns:
+ *      A mask with a bit set for each character in the class, the first character in the lowest bit.
+ */
+static inline uint32_t classifyLanes(Lanes lanes, CharClass charClass) {
+	switch (charClass) {
+		case CLASS_SPACE:
+			return maskLanes(orLanes(orLanes(equalLanes(lanes, splatLanes(' ')), equalLanes(lanes, splatLanes('\t'))),
+			                         orLanes(equalLanes(lanes, splatLanes('\r')), equalLanes(lanes, splatLanes('\n')))));
+		case CLASS_COMMENT:
+			return ~maskLanes(orLanes(equalLanes(lanes, splatLanes('\n')), equalLanes(lanes, splatLanes('\0')))) & LANE_ALL;
+		case CLASS_IDENTIFIER: {
+			// Setting 0x20 folds upper case letters onto lower case ones without moving anything else into a-z
+			Lanes folded = orLanes(lanes, splatLanes(0x20));
+			return maskLanes(orLanes(orLanes(rangeLanes(folded, 'a', 'z'), rangeLanes(lanes, '0', '9')),
+			                         equalLanes(lanes, splatLanes('_'))));
+		}
+		case CLASS_DIGIT:
+			return maskLanes(rangeLanes(lanes, '0', '9'));
+	}
+
+	return 0;
+}
+
+/* Finds the end of a run of characters of a class
+ *
+ *  The loads read whole aligned vectors around the run, which AddressSanitizer would report past the end of the
+ *  source even though they can't fault (see above).
+ *
+ *  Params:
+ *      start:      the first character of the run
+ *      charClass:  the class of the run's characters
+ *      line:       the line to add the run's newlines to
+ *
+ *  Returns:
+ *      The first character after the run.
+ */
+#ifdef __SANITIZE_ADDRESS__
+__attribute__((no_sanitize_address))
+#endif
+static inline const char* runEnd(const char* start, CharClass charClass, int* line) {
+	// Most runs in real code are a few characters long, shorter than it takes to set up a vector
+	for (int scalar = 0; scalar < SCALAR_RUN; scalar++) {
+		if (!inClass(*start, charClass)) return start;
+		if (*start == '\n') (*line)++;
+		start++;
+	}
+
+	size_t offset = (uintptr_t)start % LANE_WIDTH;
+	const char* block = start - offset;
+	uint32_t inRun = (LANE_ALL << offset) & LANE_ALL;
+
+	for (;;) {
+		Lanes lanes = loadLanes(block);
+		uint32_t ends = ~classifyLanes(lanes, charClass) & inRun;
+
+		uint32_t newlines = 0;
+		if (charClass == CLASS_SPACE) newlines = maskLanes(equalLanes(lanes, splatLanes('\n'))) & inRun;
+
+		if (ends != 0) {
+			int end = __builtin_ctz(ends);
+			*line += __builtin_popcount(newlines & ((1u << end) - 1));
+			return block + end;
+		}
+
+		*line += __builtin_popcount(newlines);
+		block += LANE_WIDTH;
+		inRun = LANE_ALL;
+	}
+}
+
+#else
+
+/* Finds the end of a run of characters of a class, one character at a time
+ *
+ *  Params:
+ *      start:      the first character of the run
+ *      charClass:  the class of the run's characters
+ *      line:       the line to add the run's newlines to
+ *
+ *  Returns:
+ *      The first character after the run.
+ */
+static inline const char* runEnd(const char* start, CharClass charClass, int* line) {
+	const char* end = start;
+	while (inClass(*end, charClass)) {
+		if (*end == '\n') (*line)++;
+		end++;
+	}
+
+	return end;
+}
+
+#endif
+
+/* Checks if the scanner is at the end of the file (last token is NULL)
+ *
+ *  Returns:
+ *      True if at the end of the file, false otherwise.
+ */
+static bool isAtEnd(Scanner* scanner) {
+	return *scanner->current == '\0';
+}
+
+/* Advances to the next character in the source
+ *
+ *  Returns:
+ *      The next character in the source.
+ */
+static char advance(Scanner* scanner) {
+	scanner->current++;
+	return scanner->current[-1];
+}
+
+/* Returns the current character without consuming it
+ *
+ *  Returns:
+ *      Returns the current character in the source
+ */
+static char peek(Scanner* scanner) {
+	return *scanner->current;
+}
+
+/* Checks the next character without consuming it
+ *
+ *  Returns:
+ *      Returns the next character in the source
+ */
+static char peekNext(Scanner* scanner) {
+	if (isAtEnd(scanner)) return '\0';
+	return scanner->current[1];
+}
+
+/* Checks if the next character in the source code matches what is expected
+ *
+ *  Params:
+ *      expected:     the expected character
+ *
+ *  Returns:
+ *      True of the next character is expected, false otherwise.
+ */
+static bool match(Scanner* scanner, char expected) {
+	if (isAtEnd(scanner)) return false;
+	if (*scanner->current != expected) return false;
+	scanner->current++;
+	return true;
+}
+
+/* Creates a token of the given type
+ *
+ *  Params:
+ *      type:       the type of token to create
+ *
+ *  Returns:
+ *      A token of the given type containing data from the scanner->
+ */
+static Token makeToken(Scanner* scanner, TokenType type) {
+	Token token;
+	token.type = type;
+	token.start = scanner->start;
+	token.length = (int)(scanner->current - scanner->start);
+	token.line = scanner->line;
+	return token;
+}
+
+/* Creates an error token
+ *
+ *  Params:
+ *      message:       the error message
+ *
+ *  Returns:
+ *      An error token with information about the error.
+ */
+static Token errorToken(Scanner* scanner, const char* message) {
+	Token token;
+	token.type = TOKEN_ERROR;
+	token.start = message;
+	token.length = (int)strlen(message);
+	token.line =scanner->line;
+	return token;
+}
+
+/* Skips next whitespace characters in the source code
+ *
+ */
+static void skipWhitespace(Scanner* scanner) {
+	for (;;) {
+		char c = peek(scanner);
+
+		switch(c) {
+			case ' ':
+			case '\r':
+			case '\t':
+			case '\n':
+				scanner->current = runEnd(scanner->current, CLASS_SPACE, &scanner->line);
+				break;
+			case '/':
+				if (peekNext(scanner) == '/') {
+					// Comments go for the entire line
+					scanner->current = runEnd(scanner->current, CLASS_COMMENT, &scanner->line);
+				} else {
+					return;
+				}
+				break;
+			default:
+				return;
+		}
+	}
+}
+
+/* Checks a given number of characters to see if they match a reserved identifier
+ *
+ *  Params:
+ *      start:          the first character of the token
+ *      length:         how many more characters are in the reserved keyword
+ *      rest:           the rest of the letters in the reserved keyword
+ *      type:           the TokenType corresponding to the given information
+ *
+ *  Returns:
+ *      Returns the TokenType matching the given keyword information, or a TOKEN_IDENTIFIER.
+ */
+static TokenType checkKeyword(Scanner* scanner, int start, int length, const char* rest, TokenType type) {
+	if (scanner->current - scanner->start == start + length &&
+	    memcmp(scanner->start + start, rest, length) == 0) {
+		return type;
+	}
+
+	return TOKEN_IDENTIFIER;
+}
+
+/* Determines the TokenType that matches the identifier
+ *
+ *  Returns:
+ *      Returns the TokenType matching the identifier
+ */
+static TokenType identifierType(Scanner* scanner) {
+	switch (scanner->start[0]) {
+		case 'a': return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
+		case 'c': return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
+		case 'e': return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
+		case 'f':
+			if (scanner->current - scanner->start > 1) {
+				switch (scanner->start[1]) {
+					case 'a': return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+					case 'o': return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
+					case 'u': return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
+				}
+			}
+			break;
+		case 'i': return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
+		case 'n': return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
+		case 'o': return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
+		case 'p': return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+		case 'r': return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+		case 's': return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
+		case 't':
+			if (scanner->current - scanner->start > 1) {
+				switch (scanner->start[1]) {
+					case 'h': return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
+					case 'r': return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
+				}
+			}
+			break;
+		case 'v': return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
+		case 'w': return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+	}
+
+	return TOKEN_IDENTIFIER;
+}
+
+/* Detects an identifier and creates a token of that type
+ *
+ *  Returns:
+ *      A token matching the type of the scanned identifier
+ */
+static Token identifier(Scanner* scanner) {
+	scanner->current = runEnd(scanner->current, CLASS_IDENTIFIER, &scanner->line);
+
+	return makeToken(scanner, identifierType(scanner));
+}
+
+/* Creates a number token
+ *
+ *  Returns:
+ *      Returns a TOKEN_NUMBER
+ */
+static Token number(Scanner* scanner) {
+	scanner->current = runEnd(scanner->current, CLASS_DIGIT, &scanner->line);
+
+	// Checks for fractional numbers
+	if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
+		// Consumes the '.'
+		advance(scanner);
+
+		scanner->current = runEnd(scanner->current, CLASS_DIGIT, &scanner->line);
+	}
+
+	return makeToken(scanner, TOKEN_NUMBER);
+}
+
+/* Creates a string token
+ *
+ *  Returns:
+ *      Returns a TOKEN_STRING
+ */
+static Token string(Scanner* scanner) {
+	while (peek(scanner) != '"' && !isAtEnd(scanner)) {
+		if (peek(scanner) == '\n') scanner->line++;
+		advance(scanner);
+	}
+
+	if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
+
+	// This consumes the closing quote
+	advance(scanner);
+	return makeToken(scanner, TOKEN_STRING);
+}
+
+/* Scans the next token from the location of the scanner
+ *
+ *  Returns:
+ *      The next token or an error token if something is wrong.
+ */
+Token baselineScanToken(Scanner* scanner) {
+	skipWhitespace(scanner);
+	scanner->start = scanner->current;
+
+	if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
+
+	char c = advance(scanner);
+	if (isDigit(c)) return number(scanner);
+	if (isAlpha(c)) return identifier(scanner);
+
+	switch (c) {
+		case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+		case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+		case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+		case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+		case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+		case ',': return makeToken(scanner, TOKEN_COMMA);
+		case '.': return makeToken(scanner, TOKEN_DOT);
+		case '-': return makeToken(scanner, TOKEN_MINUS);
+		case '+': return makeToken(scanner, TOKEN_PLUS);
+		case '/': return makeToken(scanner, TOKEN_SLASH);
+		case '*': return makeToken(scanner, TOKEN_STAR);
+		case '!':
+			return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+		case '=':
+			return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+		case '<':
+			return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+		case '>':
+			return makeToken(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+		case '"': return string(scanner);
+	}
+
+	return errorToken(scanner, "Unexpected character.");
+}
\ No newline at end of file
@@ -0,0 +1,692 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "jit.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "scanner.h"
+#include "vm.h"
+
+/* Measures the scanner, the compiler, the VM and the position table on generated workloads, and prints the results
+ *  as JSON, so a change can be judged against the numbers of the build before it
+ *
+ *  The workloads are generated from a fixed seed, so every run of every build measures exactly the same programs:
+ *      - deep:         expressions nested DEEP_NESTING parentheses deep, added together
+ *      - literals:     a LITERALS_SIZE file of short sums of number literals, one a line, with comments
+ *      - tiny:         TINY_SCRIPTS scripts of a few operators each
+ *
+ *  Benchmarks, and what one op of each is:
+ *      - scan/...          scanToken() over the workload, a token
+ *      - compile/...       compile() of the workload into a chunk, a token
+ *      - run/...           interpretChunk() of the workload's compiled chunk, a run
+ *      - interpret/tiny    interpret() of a tiny script, compiling and running it, a script
+ *      - dispatch/...      interpretChunk() of DISPATCH_INSTRUCTIONS arithmetic instructions the compiler would have
+ *                          folded, as emitted and with superinstructions, an instruction as emitted; dispatch/generic
+ *                          runs the same instructions as dispatch/plain but never quickens them
+ *      - jit/...           the same chunks compiled to machine code once, and run with interpretJitChunk(), where the
+ *                          JIT is supported
+ *      - position/...      getPosition() at random offsets and seekPosition() in order, over a chunk with a position
+ *                          table entry for every token of the literals workload, a lookup
+ *
+ *  Every benchmark is timed BENCH_REPEATS times for at least BENCH_MIN_TIME each, and the fastest is reported.
+ *  Allocations are counted by a MemoryTracker that every chunk and VM allocates through: allocationsPerOp and
+ *  bytesPerOp are the allocations and allocated bytes of one iteration divided by its ops.
+ *
+ *  Before the dispatch benchmarks run, dispatch/plain and dispatch/generic are checked to return the same number, so
+ *  that quickening can be seen to change nothing but the time. Before the jit benchmarks run, every workload's chunk,
+ *  both dispatch chunks and a set of chunks that fail at runtime are run both interpreted and as machine code, and the
+ *  benchmark exits if the two ever disagree. --check-jit runs only that comparison, for CTest: it exits with 1 if any
+ *  chunk disagreed, and with 77 (skipped) where there is no JIT.
+ *
+ *  Usage: cynch-bench [--filter text] [--min-time ms] | --check-jit
+ *  Only benchmarks whose name contains the filter text are run.
+ */
+
+#define BENCH_SEED 0x5eed2024u
+#define BENCH_REPEATS 5
+#define BENCH_MIN_TIME 100000000u       // Nanoseconds each timed repeat runs for at least
+
+#define DEEP_NESTING 48
+#define DEEP_EXPRESSIONS 2000
+#define LITERALS_SIZE (4 * 1024 * 1024)
+#define TINY_SCRIPTS 1000
+#define DISPATCH_INSTRUCTIONS 4096
+#define POSITION_LOOKUPS 65536
+
+// A growable string the workloads are generated into
+typedef struct {
+	char* data;
+	size_t length;
+	size_t capacity;
+} Text;
+
+// A generated workload: its sources, and their chunks compiled ahead of the benchmarks that only run them
+typedef struct {
+	const char* name;
+	int scriptCount;
+	Text* scripts;
+	Chunk* chunks;
+	long tokens;            // Tokens in all of the scripts, EOFs excluded
+	size_t bytes;           // Characters in all of the scripts
+} Workload;
+
+typedef long (*BenchFn)(void* state);
+
+static uint64_t randomState = BENCH_SEED;
+static MemoryTracker tracker;       // Counts the allocations of everything the benchmarks allocate
+static VM vm;
+static bool firstResult = true;
+
+/* Reads the monotonic clock
+ *
+ */
+static uint64_t nanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Gets the next number of the workload generator, xorshift64*
+ *
+ */
+static uint32_t nextRandom() {
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	return (uint32_t)((randomState * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+/* Appends formatted text to a Text
+ *
+ */
+static void appendText(Text* text, const char* format, ...) {
+	for (;;) {
+		va_list args;
+		va_start(args, format);
+		size_t room = text->capacity - text->length;
+		int length = vsnprintf(text->data + text->length, room, format, args);
+		va_end(args);
+
+		if (length >= 0 && (size_t)length < room) {
+			text->length += (size_t)length;
+			return;
+		}
+
+		text->capacity = text->capacity < 64 ? 64 : text->capacity * 2;
+		text->data = realloc(text->data, text->capacity);
+		if (text->data == NULL) exit(1);
+	}
+}
+
+/* Appends a random number literal, an integer or a decimal
+ *
+ */
+static void appendNumber(Text* text) {
+	if (nextRandom() % 4 == 0) {
+		appendText(text, "%u.%02u", nextRandom() % 1000, nextRandom() % 100);
+	} else {
+		appendText(text, "%u", 1 + nextRandom() % 9999);
+	}
+}
+
+/* Appends a random binary operator with the spaces around it
+ *
+ */
+static void appendOperator(Text* text) {
+	static const char* operators[] = {" + ", " - ", " * ", " / "};
+	appendText(text, "%s", operators[nextRandom() % 4]);
+}
+
+/* Appends an expression nested a number of parentheses deep, on either side of its operators
+ *
+ */
+static void appendNested(Text* text, int depth) {
+	if (depth == 0) {
+		appendNumber(text);
+		return;
+	}
+
+	appendText(text, "(");
+	if (nextRandom() % 2 == 0) {
+		appendNested(text, depth - 1);
+		appendOperator(text);
+		appendNumber(text);
+	} else {
+		appendNumber(text);
+		appendOperator(text);
+		appendNested(text, depth - 1);
+	}
+	appendText(text, ")");
+}
+
+/* Allocates a workload of scriptCount empty scripts, for the functions below to generate
+ *
+ */
+static Workload* newWorkload(const char* name, int scriptCount) {
+	Workload* workload = malloc(sizeof(Workload));
+	if (workload == NULL) exit(1);
+
+	workload->name = name;
+	workload->scriptCount = scriptCount;
+	workload->scripts = calloc((size_t)scriptCount, sizeof(Text));
+	workload->chunks = calloc((size_t)scriptCount, sizeof(Chunk));
+	if (workload->scripts == NULL || workload->chunks == NULL) exit(1);
+	return workload;
+}
+
+static Workload* deepWorkload() {
+	Workload* workload = newWorkload("deep", 1);
+	for (int expression = 0; expression < DEEP_EXPRESSIONS; expression++) {
+		if (expression > 0) appendText(&workload->scripts[0], " +\n");
+		appendNested(&workload->scripts[0], DEEP_NESTING);
+	}
+	return workload;
+}
+
+static Workload* literalsWorkload() {
+	Workload* workload = newWorkload("literals", 1);
+	Text* text = &workload->scripts[0];
+	for (int line = 0; text->length < LITERALS_SIZE; line++) {
+		if (line % 16 == 0) appendText(text, "// block %d\n", line / 16);
+
+		appendNumber(text);
+		for (int terms = 1 + nextRandom() % 4; terms > 0; terms--) {
+			appendOperator(text);
+			appendNumber(text);
+		}
+		appendText(text, " +\n");
+	}
+	appendText(text, "0\n");
+	return workload;
+}
+
+static Workload* tinyWorkload() {
+	Workload* workload = newWorkload("tiny", TINY_SCRIPTS);
+	for (int script = 0; script < TINY_SCRIPTS; script++) {
+		Text* text = &workload->scripts[script];
+		appendNumber(text);
+		for (int terms = 1 + nextRandom() % 5; terms > 0; terms--) {
+			appendOperator(text);
+			appendNumber(text);
+		}
+	}
+	return workload;
+}
+
+/* Counts the tokens of a workload and compiles its scripts for the run benchmarks
+ *
+ */
+static void prepareWorkload(Workload* workload) {
+	workload->tokens = 0;
+	workload->bytes = 0;
+	for (int script = 0; script < workload->scriptCount; script++) {
+		Text* text = &workload->scripts[script];
+		workload->bytes += text->length;
+
+		Scanner scanner;
+		initScanner(&scanner, text->data, text->length);
+		while (scanToken(&scanner).type != TOKEN_EOF) workload->tokens++;
+
+		initScanner(&scanner, text->data, text->length);
+		initChunk(&workload->chunks[script]);
+		if (!buildChunk(&scanner, &workload->chunks[script], BACKEND_STACK, true, false)) {
+			fprintf(stderr, "The %s workload doesn't compile.\n", workload->name);
+			exit(70);
+		}
+	}
+}
+
+static long benchScan(void* state) {
+	Workload* workload = (Workload*)state;
+	long tokens = 0;
+	for (int script = 0; script < workload->scriptCount; script++) {
+		Scanner scanner;
+		initScanner(&scanner, workload->scripts[script].data, workload->scripts[script].length);
+		while (scanToken(&scanner).type != TOKEN_EOF) tokens++;
+	}
+	return tokens;
+}
+
+static long benchCompile(void* state) {
+	Workload* workload = (Workload*)state;
+	for (int script = 0; script < workload->scriptCount; script++) {
+		Scanner scanner;
+		initScanner(&scanner, workload->scripts[script].data, workload->scripts[script].length);
+
+		Chunk chunk;
+		initChunkIn(&chunk, &tracker.allocator);
+		compile(&scanner, &chunk, BACKEND_STACK);
+		freeChunk(&chunk);
+	}
+	return workload->tokens;
+}
+
+static long benchRun(void* state) {
+	Workload* workload = (Workload*)state;
+	for (int script = 0; script < workload->scriptCount; script++) interpretChunk(&vm, &workload->chunks[script]);
+	return workload->scriptCount;
+}
+
+static long benchInterpret(void* state) {
+	Workload* workload = (Workload*)state;
+	for (int script = 0; script < workload->scriptCount; script++) interpret(&vm, workload->scripts[script].data);
+	return workload->scriptCount;
+}
+
+// A chunk run by the dispatch benchmarks, with the number of instructions it executes
+typedef struct {
+	Chunk chunk;
+	long instructions;
+} DispatchChunk;
+
+static long benchDispatch(void* state) {
+	DispatchChunk* dispatch = (DispatchChunk*)state;
+	interpretChunk(&vm, &dispatch->chunk);
+	return dispatch->instructions;
+}
+
+/* Writes a chunk of arithmetic on constants, which the compiler would fold, so that it is really executed
+ *
+ */
+static void buildDispatchChunk(DispatchChunk* dispatch, bool fuse) {
+	static const uint8_t operators[] = {OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE};
+	Chunk* chunk = &dispatch->chunk;
+	initChunk(chunk);
+	writeConstant(chunk, NUMBER_VAL(1), 1, 1);
+
+	for (int instruction = 1; instruction + 2 < DISPATCH_INSTRUCTIONS; instruction += 2) {
+		int line = 1 + instruction / 16;
+		int column = 1 + instruction % 16;
+		writeConstant(chunk, NUMBER_VAL(1 + (double)(nextRandom() % 100) / 1000), line, column);
+		writeChunk(chunk, operators[nextRandom() % 4], line, column + 1);
+	}
+	writeChunk(chunk, OP_NEGATE, 1 + DISPATCH_INSTRUCTIONS / 16, 1);
+	writeChunk(chunk, OP_RETURN, 1 + DISPATCH_INSTRUCTIONS / 16, 2);
+
+	// Both chunks count the instructions as emitted, so that their ns/op compare the same work
+	dispatch->instructions = 0;
+	for (int offset = 0; offset < chunk->count; offset += instructionSize(chunk->code[offset])) {
+		dispatch->instructions++;
+	}
+	if (fuse) optimizeChunk(chunk);
+}
+
+/* Checks that two values are the same, numbers down to their bits
+ *
+ */
+static bool sameValue(Value a, Value b) {
+	if (IS_NUMBER(a) || IS_NUMBER(b)) {
+		double numberA = AS_NUMBER(a);
+		double numberB = AS_NUMBER(b);
+		return IS_NUMBER(a) && IS_NUMBER(b) && memcmp(&numberA, &numberB, sizeof(double)) == 0;
+	}
+	return IS_NIL(a) == IS_NIL(b) && (!IS_BOOL(a) || AS_BOOL(a) == AS_BOOL(b));
+}
+
+#ifdef CYNCH_JIT
+// A dispatch chunk compiled to machine code
+typedef struct {
+	DispatchChunk* dispatch;
+	JitCode code;
+} JitChunk;
+
+static long benchJit(void* state) {
+	JitChunk* jit = (JitChunk*)state;
+	interpretJitChunk(&vm, &jit->dispatch->chunk, &jit->code);
+	return jit->dispatch->instructions;
+}
+
+/* Runs a chunk interpreted and as machine code, with and without the instruction pointer kept up to date, and checks
+ *  that every run had the same outcome: the same result, or the same error at the same instruction
+ *
+ *  Returns:
+ *      True if the runs agreed, false otherwise (the difference is printed).
+ */
+static bool checkJit(const char* name, Chunk* chunk) {
+	InterpretResult expected = interpretChunk(&vm, chunk);
+	Value expectedValue = vm.result;
+	ptrdiff_t expectedIp = vm.ip - chunk->code;
+
+	for (int trackIp = 0; trackIp <= 1; trackIp++) {
+		JitCode jit;
+		if (!compileJit(chunk, trackIp, &jit)) {
+			fprintf(stderr, "[jit] %s: not compiled\n", name);
+			return false;
+		}
+
+		vm.result = NIL_VAL(0);
+		InterpretResult result = interpretJitChunk(&vm, chunk, &jit);
+		freeJit(&jit);
+
+		bool same = result == expected &&
+		            (result == INTERPRET_OK ? sameValue(vm.result, expectedValue) : vm.ip - chunk->code == expectedIp);
+		if (!same) {
+			fprintf(stderr, "[jit] %s: machine code%s differs from the interpreter\n", name,
+			        trackIp ? " tracking the instruction pointer" : "");
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Writes a chunk that pushes values and then runs instructions on them, an OP_RETURN is added at the end
+ *
+ */
+static void buildFailingChunk(Chunk* chunk, Value first, Value second, const uint8_t* code, int count) {
+	initChunk(chunk);
+	writeConstant(chunk, first, 1, 1);
+	writeConstant(chunk, second, 1, 3);
+	for (int index = 0; index < count; index++) writeChunk(chunk, code[index], 2, 1 + index);
+	writeChunk(chunk, OP_RETURN, 3, 1);
+}
+
+/* Compares the JIT with the interpreter on the workloads, the dispatch chunks, and chunks that fail in each of the
+ *  ways arithmetic can
+ *
+ *  Returns:
+ *      How many of the chunks the JIT disagreed with the interpreter on.
+ */
+static int checkJitChunks(Workload** workloads, int workloadCount, DispatchChunk* plain, DispatchChunk* fused) {
+	int failures = 0;
+	char name[64];
+	for (int index = 0; index < workloadCount; index++) {
+		for (int script = 0; script < workloads[index]->scriptCount; script++) {
+			snprintf(name, sizeof(name), "%s/%d", workloads[index]->name, script);
+			failures += !checkJit(name, &workloads[index]->chunks[script]);
+		}
+	}
+	failures += !checkJit("dispatch/plain", &plain->chunk);
+	failures += !checkJit("dispatch/superinstructions", &fused->chunk);
+
+	// OP_CONSTANT_MULTIPLY fails in its second half, after reading the operand of its first
+	const uint8_t add[] = {OP_ADD};
+	const uint8_t negate[] = {OP_NEGATE};
+	const uint8_t fusedMultiply[] = {OP_CONSTANT_MULTIPLY, 0};
+	const uint8_t fusedSubtract[] = {OP_CONSTANT_SUBTRACT, 1};
+
+	Chunk chunk;
+	buildFailingChunk(&chunk, NUMBER_VAL(1), NIL_VAL(0), add, 1);
+	failures += !checkJit("error/add-right", &chunk);
+	freeChunk(&chunk);
+	buildFailingChunk(&chunk, BOOL_VAL(true), NUMBER_VAL(1), add, 1);
+	failures += !checkJit("error/add-left", &chunk);
+	freeChunk(&chunk);
+	buildFailingChunk(&chunk, NUMBER_VAL(1), NIL_VAL(0), negate, 1);
+	failures += !checkJit("error/negate", &chunk);
+	freeChunk(&chunk);
+	buildFailingChunk(&chunk, BOOL_VAL(false), NUMBER_VAL(2), fusedMultiply, 2);
+	failures += !checkJit("error/superinstruction", &chunk);
+	freeChunk(&chunk);
+	buildFailingChunk(&chunk, NUMBER_VAL(3), NIL_VAL(0), fusedSubtract, 2);
+	failures += !checkJit("error/superinstruction-right", &chunk);
+	freeChunk(&chunk);
+
+	// More constants than OP_CONSTANT can index, so the last ones are pushed with OP_CONSTANT_LONG
+	initChunk(&chunk);
+	writeConstant(&chunk, NUMBER_VAL(0), 1, 1);
+	for (int constant = 1; constant < 300; constant++) {
+		writeConstant(&chunk, NUMBER_VAL(constant + 0.5), 1 + constant, 1);
+		writeChunk(&chunk, constant % 2 == 0 ? OP_ADD : OP_SUBTRACT, 1 + constant, 2);
+	}
+	writeChunk(&chunk, OP_RETURN, 301, 1);
+	failures += !checkJit("constant-long", &chunk);
+	freeChunk(&chunk);
+	return failures;
+}
+#endif
+
+// A chunk with a position table entry for every token of a source, and the offsets to look up in it
+typedef struct {
+	Chunk chunk;
+	int* randomOffsets;
+	int* tokenOffsets;
+	int tokenCount;
+} PositionBench;
+
+static long benchRandomPosition(void* state) {
+	PositionBench* bench = (PositionBench*)state;
+	long sum = 0;
+	for (int lookup = 0; lookup < POSITION_LOOKUPS; lookup++) {
+		sum += getPosition(&bench->chunk, bench->randomOffsets[lookup]).column;
+	}
+	return sum >= 0 ? POSITION_LOOKUPS : 0;
+}
+
+static long benchSeekPosition(void* state) {
+	PositionBench* bench = (PositionBench*)state;
+	PositionCursor cursor;
+	initPositionCursor(&cursor, &bench->chunk);
+
+	long sum = 0;
+	for (int token = 0; token < bench->tokenCount; token++) {
+		sum += seekPosition(&cursor, bench->tokenOffsets[token]).column;
+	}
+	return sum >= 0 ? bench->tokenCount : 0;
+}
+
+/* Writes an instruction's worth of bytes for every token of a workload: two for a number, one for anything else
+ *
+ */
+static void buildPositionBench(PositionBench* bench, Workload* workload) {
+	initChunk(&bench->chunk);
+	bench->tokenOffsets = malloc(sizeof(int) * (size_t)workload->tokens);
+	bench->randomOffsets = malloc(sizeof(int) * POSITION_LOOKUPS);
+	if (bench->tokenOffsets == NULL || bench->randomOffsets == NULL) exit(1);
+
+	Scanner scanner;
+	initScanner(&scanner, workload->scripts[0].data, workload->scripts[0].length);
+	bench->tokenCount = 0;
+	for (Token token = scanToken(&scanner); token.type != TOKEN_EOF; token = scanToken(&scanner)) {
+		bench->tokenOffsets[bench->tokenCount++] = bench->chunk.count;
+		writeChunk(&bench->chunk, OP_CONSTANT, token.line, token.column);
+		if (token.type == TOKEN_NUMBER) writeChunk(&bench->chunk, 0, token.line, token.column);
+	}
+
+	for (int lookup = 0; lookup < POSITION_LOOKUPS; lookup++) {
+		bench->randomOffsets[lookup] = (int)(nextRandom() % (uint32_t)bench->chunk.count);
+	}
+}
+
+/* Times a benchmark and prints its result
+ *
+ *  Params:
+ *      name:       the benchmark's name, also what --filter matches
+ *      fn:         runs one iteration of the benchmark and returns its ops
+ *      state:      what the benchmark works on
+ *      filter:     the text the name must contain, NULL to run every benchmark
+ *      minTime:    the nanoseconds each timed repeat runs for at least
+ */
+static void measure(const char* name, BenchFn fn, void* state, const char* filter, uint64_t minTime) {
+	if (filter != NULL && strstr(name, filter) == NULL) return;
+
+	// The first iteration warms up caches and arenas, the second is the one whose allocations are counted
+	fn(state);
+	MemoryStats before = tracker.stats;
+	long ops = fn(state);
+	uint64_t allocations = tracker.stats.allocations - before.allocations;
+	uint64_t allocatedBytes = tracker.stats.allocatedBytes - before.allocatedBytes;
+
+	long iterations = 1;
+	double best = 0;
+	for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+		uint64_t elapsed;
+		for (;;) {
+			uint64_t start = nanoseconds();
+			for (long iteration = 0; iteration < iterations; iteration++) fn(state);
+			elapsed = nanoseconds() - start;
+
+			if (elapsed >= minTime) break;
+			iterations *= 2;
+		}
+
+		double nsPerOp = (double)elapsed / ((double)iterations * (double)ops);
+		if (repeat == 0 || nsPerOp < best) best = nsPerOp;
+	}
+
+	printf("%s\n    {\"name\": \"%s\", \"opsPerIteration\": %ld, \"iterations\": %ld, \"nsPerOp\": %.3f, "
+	       "\"bytesPerOp\": %.3f, \"allocationsPerOp\": %.6f}",
+	       firstResult ? "" : ",", name, ops, iterations, best,
+	       (double)allocatedBytes / (double)ops, (double)allocations / (double)ops);
+	firstResult = false;
+	fflush(stdout);
+}
+
+/* Runs the JIT's differential check on its own, for --check-jit
+ *
+ *  Returns:
+ *      The exit code: 0 if the JIT agreed with the interpreter on every chunk, 1 if it didn't, 77 without a JIT.
+ */
+static int checkJitMain(Workload** workloads, int workloadCount) {
+#ifdef CYNCH_JIT
+	for (int index = 0; index < workloadCount; index++) prepareWorkload(workloads[index]);
+
+	DispatchChunk plain, fused;
+	buildDispatchChunk(&plain, false);
+	buildDispatchChunk(&fused, true);
+
+	int failures = checkJitChunks(workloads, workloadCount, &plain, &fused);
+	fprintf(stderr, "[jit] %s\n", failures == 0 ? "machine code agrees with the interpreter" : "mismatches found");
+	freeChunk(&plain.chunk);
+	freeChunk(&fused.chunk);
+	return failures == 0 ? 0 : 1;
+#else
+	(void)workloads;
+	(void)workloadCount;
+	fprintf(stderr, "[jit] not supported by this build\n");
+	return 77;
+#endif
+}
+
+/* Prints how to use the program and exits
+ *
+ */
+static void usage() {
+	fprintf(stderr, "Usage: cynch-bench [--filter text] [--min-time ms] | --check-jit\n");
+	exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+	const char* filter = NULL;
+	uint64_t minTime = BENCH_MIN_TIME;
+	bool checkOnly = false;
+	for (int arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "--check-jit") == 0) {
+			checkOnly = true;
+		} else if (strcmp(argv[arg], "--filter") == 0 && arg + 1 < argc) {
+			filter = argv[++arg];
+		} else if (strcmp(argv[arg], "--min-time") == 0 && arg + 1 < argc) {
+			char* end;
+			minTime = strtoull(argv[++arg], &end, 10) * 1000000u;
+			if (*end != '\0' || minTime == 0) usage();
+		} else {
+			usage();
+		}
+	}
+
+	initMemoryTracker(&tracker, NULL);
+	if (!initVM(&vm)) exit(1);
+	setOutput(&vm, NULL);
+	setAllocator(&vm, &tracker.allocator);
+
+	Workload* workloads[] = {deepWorkload(), literalsWorkload(), tinyWorkload()};
+	int workloadCount = (int)(sizeof(workloads) / sizeof(workloads[0]));
+	if (checkOnly) return checkJitMain(workloads, workloadCount);
+
+	printf("{\n  \"seed\": %u,\n  \"build\": {\"compiler\": \"%s\", \"optimized\": %s, \"nanBoxing\": %s, "
+	       "\"computedGoto\": %s, \"avx2\": %s},\n  \"workloads\": [",
+	       BENCH_SEED, __VERSION__,
+#ifdef __OPTIMIZE__
+	       "true",
+#else
+	       "false",
+#endif
+#ifdef NAN_BOXING
+	       "true",
+#else
+	       "false",
+#endif
+#ifdef CYNCH_COMPUTED_GOTO
+	       "true",
+#else
+	       "false",
+#endif
+#ifdef __AVX2__
+	       "true"
+#else
+	       "false"
+#endif
+	       );
+	for (int index = 0; index < workloadCount; index++) {
+		prepareWorkload(workloads[index]);
+		printf("%s\n    {\"name\": \"%s\", \"scripts\": %d, \"bytes\": %zu, \"tokens\": %ld}", index > 0 ? "," : "",
+		       workloads[index]->name, workloads[index]->scriptCount, workloads[index]->bytes, workloads[index]->tokens);
+	}
+	printf("\n  ],\n  \"benchmarks\": [");
+
+	char name[64];
+	for (int index = 0; index < workloadCount; index++) {
+		snprintf(name, sizeof(name), "scan/%s", workloads[index]->name);
+		measure(name, benchScan, workloads[index], filter, minTime);
+	}
+	for (int index = 0; index < workloadCount; index++) {
+		snprintf(name, sizeof(name), "compile/%s", workloads[index]->name);
+		measure(name, benchCompile, workloads[index], filter, minTime);
+	}
+	for (int index = 0; index < workloadCount; index++) {
+		snprintf(name, sizeof(name), "run/%s", workloads[index]->name);
+		measure(name, benchRun, workloads[index], filter, minTime);
+	}
+	measure("interpret/tiny", benchInterpret, workloads[2], filter, minTime);
+
+	// The generic chunk is built from the same random numbers as the plain one
+	DispatchChunk plain, generic, fused;
+	uint64_t dispatchState = randomState;
+	buildDispatchChunk(&plain, false);
+	randomState = dispatchState;
+	buildDispatchChunk(&generic, false);
+	generic.chunk.quicken = false;
+	buildDispatchChunk(&fused, true);
+
+	for (int run = 0; run < 2; run++) {
+		interpretChunk(&vm, &plain.chunk);
+		Value quickened = vm.result;
+		interpretChunk(&vm, &generic.chunk);
+		if (!sameValue(quickened, vm.result)) {
+			fprintf(stderr, "[quickening] dispatch/plain differs from dispatch/generic\n");
+			exit(1);
+		}
+	}
+
+	measure("dispatch/plain", benchDispatch, &plain, filter, minTime);
+	measure("dispatch/generic", benchDispatch, &generic, filter, minTime);
+	measure("dispatch/superinstructions", benchDispatch, &fused, filter, minTime);
+
+#ifdef CYNCH_JIT
+	if (filter == NULL || strstr("jit/plain jit/superinstructions", filter) != NULL) {
+		if (checkJitChunks(workloads, workloadCount, &plain, &fused) > 0) exit(1);
+
+		JitChunk plainJit = {&plain}, fusedJit = {&fused};
+		if (!compileJit(&plain.chunk, false, &plainJit.code) || !compileJit(&fused.chunk, false, &fusedJit.code)) exit(1);
+		measure("jit/plain", benchJit, &plainJit, filter, minTime);
+		measure("jit/superinstructions", benchJit, &fusedJit, filter, minTime);
+		freeJit(&plainJit.code);
+		freeJit(&fusedJit.code);
+	}
+#endif
+
+	PositionBench positions;
+	buildPositionBench(&positions, workloads[1]);
+	measure("position/random", benchRandomPosition, &positions, filter, minTime);
+	measure("position/cursor", benchSeekPosition, &positions, filter, minTime);
+
+	printf("\n  ]\n}\n");
+
+	freeVM(&vm);
+	return 0;
+}
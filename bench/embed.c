@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cynch.h"
+
+/* Measures what the embedding interface saves by compiling once:
+ *      - compile+execute:  a fresh program is compiled, executed and released every time, like interpret() does
+ *      - execute:          one program is compiled up front and only executed in the loop
+ *      - shared execute:   the same program executed by one VM per thread, all at once
+ *
+ *  Usage: cynch-embed-bench [iterations] [threads] [script]
+ *  Without a script, an expression of a few hundred operators is used.
+ */
+
+typedef struct {
+	const CynchProgram* program;
+	long iterations;
+	pthread_t thread;
+} SharedRun;
+
+/* Reads the monotonic clock
+ *
+ */
+static uint64_t nanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Reads a whole file, exiting on failure
+ *
+ */
+static char* readSource(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		exit(74);
+	}
+
+	fseek(file, 0L, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+
+	char* source = malloc((size_t)size + 1);
+	if (source == NULL || fread(source, 1, (size_t)size, file) < (size_t)size) {
+		fprintf(stderr, "Could not read file \"%s\".\n", path);
+		exit(74);
+	}
+	source[size] = '\0';
+	fclose(file);
+	return source;
+}
+
+/* Builds the default expression: (1 + 2 * 3 - 4 / 5) repeated and combined
+ *
+ */
+static char* defaultSource() {
+	const char* term = "(1 + 2 * 3 - 4 / 5)";
+	int terms = 100;
+	char* source = malloc((strlen(term) + 3) * terms + 1);
+	if (source == NULL) exit(1);
+
+	source[0] = '\0';
+	for (int index = 0; index < terms; index++) {
+		if (index > 0) strcat(source, index % 2 == 0 ? " + " : " * ");
+		strcat(source, term);
+	}
+	return source;
+}
+
+/* Executes a shared program on a VM of the thread's own
+ *
+ */
+static void* executeShared(void* argument) {
+	SharedRun* run = (SharedRun*)argument;
+	CynchVM* vm = cynchNewVM();
+
+	for (long iteration = 0; iteration < run->iterations; iteration++) {
+		if (cynchExecute(vm, run->program, NULL) != CYNCH_OK) exit(70);
+	}
+
+	cynchFreeVM(vm);
+	return NULL;
+}
+
+int main(int argc, const char* argv[]) {
+	long iterations = argc > 1 ? atol(argv[1]) : 100000;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	char* source = argc > 3 ? readSource(argv[3]) : defaultSource();
+	if (iterations <= 0 || threads <= 0) {
+		fprintf(stderr, "Usage: cynch-embed-bench [iterations] [threads] [script]\n");
+		return 64;
+	}
+
+	CynchVM* vm = cynchNewVM();
+	CynchValue result;
+
+	uint64_t start = nanoseconds();
+	for (long iteration = 0; iteration < iterations; iteration++) {
+		CynchProgram* program = cynchCompile(source, NULL);
+		if (program == NULL) return 65;
+		if (cynchExecute(vm, program, &result) != CYNCH_OK) return 70;
+		cynchReleaseProgram(program);
+	}
+	double compileAndExecute = (double)(nanoseconds() - start) / (double)iterations;
+
+	CynchProgram* program = cynchCompile(source, NULL);
+	start = nanoseconds();
+	for (long iteration = 0; iteration < iterations; iteration++) {
+		if (cynchExecute(vm, program, &result) != CYNCH_OK) return 70;
+	}
+	double execute = (double)(nanoseconds() - start) / (double)iterations;
+
+	SharedRun* runs = calloc(threads, sizeof(SharedRun));
+	if (runs == NULL) return 1;
+	start = nanoseconds();
+	for (int index = 0; index < threads; index++) {
+		runs[index].program = program;
+		runs[index].iterations = iterations;
+		pthread_create(&runs[index].thread, NULL, executeShared, &runs[index]);
+	}
+	for (int index = 0; index < threads; index++) pthread_join(runs[index].thread, NULL);
+	double sharedExecute = (double)(nanoseconds() - start) / ((double)iterations * threads);
+
+	printf("result: %g\n", result.type == CYNCH_NUMBER ? result.as.number : 0.0);
+	printf("compile+execute: %10.1f ns/op\n", compileAndExecute);
+	printf("execute:         %10.1f ns/op (%.1fx)\n", execute, compileAndExecute / execute);
+	printf("shared execute:  %10.1f ns/op across %d threads\n", sharedExecute, threads);
+
+	free(runs);
+	cynchReleaseProgram(program);
+	cynchFreeVM(vm);
+	free(source);
+	return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+
+/* Measures scan-only throughput of the scanner against the frozen copy of the one it replaced (baseline_scanner.c)
+ *
+ *  Both scanners run over the same source until TOKEN_EOF, best of a few runs each, and must produce the same number
+ *  of tokens.
+ *
+ *  Usage: cynch-scan-bench [megabytes] [script]
+ *  Without a script, megabytes (16 by default) of generated source are scanned: keywords, identifiers, numbers,
+ *  strings, operators, indentation and comments.
+ */
+
+#define RUNS 5
+
+void baselineInitScanner(Scanner* scanner, const char* source);
+Token baselineScanToken(Scanner* scanner);
+
+typedef struct {
+	double seconds;
+	long tokens;
+} ScanRun;
+
+/* Reads the monotonic clock
+ *
+ */
+static uint64_t nanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Reads a whole file, exiting on failure
+ *
+ */
+static char* readSource(const char* path, size_t* size) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		exit(74);
+	}
+
+	fseek(file, 0L, SEEK_END);
+	*size = (size_t)ftell(file);
+	rewind(file);
+
+	char* source = malloc(*size + 1);
+	if (source == NULL || fread(source, 1, *size, file) < *size) {
+		fprintf(stderr, "Could not read file \"%s\".\n", path);
+		exit(74);
+	}
+	source[*size] = '\0';
+	fclose(file);
+	return source;
+}
+
+/* Generates source of a given size from a fixed seed, so every run scans the same thing
+ *
+ */
+static char* generateSource(size_t size) {
+	static const char* pieces[] = {
+		"var", "while", "return", "print", "true", "false", "nil", "and", "or", "if", "else", "fun", "this",
+		"count", "index", "total_sum", "nextValue", "_tmp", "x", "y2", "variableWithALongerName",
+		"0", "1", "42", "1024", "3.14159", "65536.5",
+		"\"a string\"", "\"\"", "(", ")", "{", "}", ";", ",", ".", "+", "-", "*", "/", "=", "==", "!=", "<=", ">", "!",
+		"\n", "\n    ", "\n        ", "\n\t\t", "// a comment that runs to the end of the line\n",
+	};
+	const int pieceCount = (int)(sizeof(pieces) / sizeof(pieces[0]));
+
+	char* source = malloc(size + 1);
+	if (source == NULL) exit(1);
+
+	uint32_t seed = 12345;
+	size_t length = 0;
+	for (;;) {
+		seed = seed * 1103515245u + 12345u;
+		const char* piece = pieces[(seed >> 16) % pieceCount];
+		size_t pieceLength = strlen(piece);
+		if (length + pieceLength + 1 > size) break;
+
+		memcpy(source + length, piece, pieceLength);
+		length += pieceLength;
+		source[length++] = ' ';
+	}
+	source[length] = '\0';
+	return source;
+}
+
+/* Scans a whole source with the current scanner
+ *
+ */
+static ScanRun scanCurrent(const char* source) {
+	uint64_t start = nanoseconds();
+	Scanner scanner;
+	initScanner(&scanner, source, strlen(source));
+
+	long tokens = 1;
+	while (scanToken(&scanner).type != TOKEN_EOF) tokens++;
+	return (ScanRun){(double)(nanoseconds() - start) / 1e9, tokens};
+}
+
+/* Scans a whole source with the baseline scanner
+ *
+ */
+static ScanRun scanBaseline(const char* source) {
+	uint64_t start = nanoseconds();
+	Scanner scanner;
+	baselineInitScanner(&scanner, source);
+
+	long tokens = 1;
+	while (baselineScanToken(&scanner).type != TOKEN_EOF) tokens++;
+	return (ScanRun){(double)(nanoseconds() - start) / 1e9, tokens};
+}
+
+/* Keeps the fastest of several runs
+ *
+ */
+static ScanRun bestRun(ScanRun (*scan)(const char*), const char* source) {
+	ScanRun best = scan(source);
+	for (int run = 1; run < RUNS; run++) {
+		ScanRun next = scan(source);
+		if (next.seconds < best.seconds) best = next;
+	}
+	return best;
+}
+
+int main(int argc, const char* argv[]) {
+	long megabytes = argc > 1 ? atol(argv[1]) : 16;
+	if (megabytes <= 0) {
+		fprintf(stderr, "Usage: cynch-scan-bench [megabytes] [script]\n");
+		return 64;
+	}
+
+	size_t size = (size_t)megabytes * 1024 * 1024;
+	char* source = argc > 2 ? readSource(argv[2], &size) : generateSource(size);
+	size = strlen(source);
+
+	ScanRun baseline = bestRun(scanBaseline, source);
+	ScanRun current = bestRun(scanCurrent, source);
+	if (baseline.tokens != current.tokens) {
+		fprintf(stderr, "The scanners disagree: %ld tokens from the baseline, %ld now.\n", baseline.tokens, current.tokens);
+		return 70;
+	}
+
+	double megabyte = 1024.0 * 1024.0;
+	printf("source:   %.1f MB, %ld tokens\n", (double)size / megabyte, current.tokens);
+	printf("baseline: %8.1f MB/s %8.1f Mtokens/s\n", (double)size / megabyte / baseline.seconds,
+	       (double)baseline.tokens / 1e6 / baseline.seconds);
+	printf("current:  %8.1f MB/s %8.1f Mtokens/s (%.2fx)\n", (double)size / megabyte / current.seconds,
+	       (double)current.tokens / 1e6 / current.seconds, baseline.seconds / current.seconds);
+
+	free(source);
+	return 0;
+}
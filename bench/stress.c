@@ -0,0 +1,236 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+/* Runs the same scripts on one VM per thread, all at once, and checks that every run matches a single-threaded run
+ *
+ *  Every thread initializes its own VM and runs each script STRESS_ROUNDS times, with the VM's output going to a
+ *  memstream. A run must print the same thing, return the same InterpretResult and, for a runtime error, stop at
+ *  the same instruction as the script did on the main thread before any worker started. The scripts cover:
+ *      - sources, compiled and run by interpret() on both backends, including one that doesn't compile
+ *      - chunks built by hand, since the compiler folds every expression to a constant: arithmetic that is shared by
+ *        every thread (never quickened, as cynch.c's programs are) and rebuilt by each thread (quickened as it runs),
+ *        a type error, and enough constants to overflow the stack onto its guard page
+ *
+ *  The errors the scripts report go to stderr, which is pointed at /dev/null while the threads run so that only
+ *  mismatches are printed. Exits with 1 if any run differed.
+ *
+ *  Usage: cynch-stress [--threads n] [--rounds n]
+ */
+
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS 200
+#define STRESS_ARITHMETIC 2000  // Operators in the arithmetic chunk
+
+// A script to run, either source code or a chunk
+typedef struct {
+	const char* name;
+	const char* source;     // NULL for a chunk
+	Backend backend;
+	Chunk* chunk;           // Shared by every thread, or NULL for the thread to build its own with build
+	void (*build)(Chunk* chunk);
+} Script;
+
+// How a script's run ended
+typedef struct {
+	InterpretResult result;
+	char* output;
+	size_t outputSize;
+	ptrdiff_t errorOffset;  // Where the instruction pointer stopped on a runtime error, -1 otherwise
+} Outcome;
+
+typedef struct {
+	Script* scripts;
+	int scriptCount;
+	Outcome* expected;
+	int rounds;
+	int index;
+	int mismatches;
+	pthread_t thread;
+} Worker;
+
+/* Writes a chunk of STRESS_ARITHMETIC operators on constants, from a fixed seed so every call writes the same code
+ *
+ */
+static void buildArithmetic(Chunk* chunk) {
+	static const uint8_t operators[] = {OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE};
+	uint32_t state = 0x5eed2024u;
+	initChunk(chunk);
+	writeConstant(chunk, NUMBER_VAL(1), 1, 1);
+	for (int operator = 0; operator < STRESS_ARITHMETIC; operator++) {
+		state = state * 1664525u + 1013904223u;
+		writeConstant(chunk, NUMBER_VAL(1 + (double)(state >> 24) / 1000), 1 + operator, 1);
+		writeChunk(chunk, operators[(state >> 8) % 4], 1 + operator, 2);
+		if (operator % 7 == 0) writeChunk(chunk, OP_NEGATE, 1 + operator, 3);
+	}
+	writeChunk(chunk, OP_RETURN, 1 + STRESS_ARITHMETIC, 1);
+}
+
+/* Writes a chunk that adds nil to a number
+ *
+ */
+static void buildTypeError(Chunk* chunk) {
+	initChunk(chunk);
+	writeConstant(chunk, NUMBER_VAL(1), 1, 1);
+	writeConstant(chunk, NIL_VAL(0), 1, 3);
+	writeChunk(chunk, OP_ADD, 1, 2);
+	writeChunk(chunk, OP_RETURN, 2, 1);
+}
+
+/* Writes a chunk that pushes more constants than the stack holds
+ *
+ */
+static void buildOverflow(Chunk* chunk) {
+	initChunk(chunk);
+	for (int constant = 0; constant < STACK_MAX + 16; constant++) {
+		writeConstant(chunk, NUMBER_VAL(constant), 1 + constant, 1);
+	}
+	writeChunk(chunk, OP_RETURN, STACK_MAX + 17, 1);
+}
+
+/* Runs a script on a VM, capturing what it prints
+ *
+ */
+static Outcome runScript(VM* vm, Script* script) {
+	Outcome outcome = {INTERPRET_OK, NULL, 0, -1};
+	FILE* output = open_memstream(&outcome.output, &outcome.outputSize);
+	if (output == NULL) exit(1);
+	setOutput(vm, output);
+	setBackend(vm, script->backend);
+
+	if (script->source != NULL) {
+		outcome.result = interpret(vm, script->source);
+	} else if (script->chunk != NULL) {
+		outcome.result = interpretChunk(vm, script->chunk);
+		if (outcome.result == INTERPRET_RUNTIME_ERROR) outcome.errorOffset = vm->ip - script->chunk->code;
+	} else {
+		Chunk chunk;
+		script->build(&chunk);
+		outcome.result = interpretChunk(vm, &chunk);
+		if (outcome.result == INTERPRET_RUNTIME_ERROR) outcome.errorOffset = vm->ip - chunk.code;
+		freeChunk(&chunk);
+	}
+
+	fclose(output);
+	setOutput(vm, NULL);
+	return outcome;
+}
+
+/* Checks that a run ended the way the single-threaded run did
+ *
+ */
+static bool sameOutcome(const Outcome* a, const Outcome* b) {
+	return a->result == b->result && a->errorOffset == b->errorOffset && a->outputSize == b->outputSize &&
+	       memcmp(a->output, b->output, a->outputSize) == 0;
+}
+
+/* The body of a worker thread: runs every script on its own VM, round after round, counting the runs that differ
+ *
+ */
+static void* runWorker(void* argument) {
+	Worker* worker = (Worker*)argument;
+
+	VM vm;
+	if (!initVM(&vm)) {
+		worker->mismatches++;
+		return NULL;
+	}
+
+	for (int round = 0; round < worker->rounds; round++) {
+		for (int index = 0; index < worker->scriptCount; index++) {
+			Outcome outcome = runScript(&vm, &worker->scripts[index]);
+			if (!sameOutcome(&outcome, &worker->expected[index])) {
+				printf("[stress] thread %d, round %d: %s differs from the single-threaded run\n", worker->index, round,
+				       worker->scripts[index].name);
+				worker->mismatches++;
+			}
+			free(outcome.output);
+		}
+	}
+
+	freeVM(&vm);
+	return NULL;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: cynch-stress [--threads n] [--rounds n]\n");
+	exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+	int threadCount = STRESS_THREADS;
+	int rounds = STRESS_ROUNDS;
+	for (int arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+			threadCount = atoi(argv[++arg]);
+			if (threadCount <= 0) usage();
+		} else if (strcmp(argv[arg], "--rounds") == 0 && arg + 1 < argc) {
+			rounds = atoi(argv[++arg]);
+			if (rounds <= 0) usage();
+		} else {
+			usage();
+		}
+	}
+
+	Chunk arithmetic;
+	buildArithmetic(&arithmetic);
+	arithmetic.quicken = false;
+
+	Script scripts[] = {
+			{"source/arithmetic", "(1 + 2) * 3 - 4 / 5", BACKEND_STACK, NULL, NULL},
+			{"source/register", "-(1.5 * (2 - 8)) / (3 + 0.25)", BACKEND_REGISTER, NULL, NULL},
+			{"source/compile-error", "1 + * 2", BACKEND_STACK, NULL, NULL},
+			{"chunk/shared", NULL, BACKEND_STACK, &arithmetic, NULL},
+			{"chunk/quickened", NULL, BACKEND_STACK, NULL, buildArithmetic},
+			{"chunk/type-error", NULL, BACKEND_STACK, NULL, buildTypeError},
+			{"chunk/stack-overflow", NULL, BACKEND_STACK, NULL, buildOverflow},
+	};
+	int scriptCount = (int)(sizeof(scripts) / sizeof(scripts[0]));
+
+	// Keeps the scripts' own errors out of the way of the mismatches
+	fflush(stderr);
+	int savedStderr = dup(STDERR_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	if (savedStderr < 0 || null < 0 || dup2(null, STDERR_FILENO) < 0) exit(1);
+	close(null);
+
+	Outcome expected[sizeof(scripts) / sizeof(scripts[0])];
+	VM vm;
+	if (!initVM(&vm)) exit(1);
+	for (int index = 0; index < scriptCount; index++) expected[index] = runScript(&vm, &scripts[index]);
+	freeVM(&vm);
+
+	Worker* workers = calloc((size_t)threadCount, sizeof(Worker));
+	if (workers == NULL) exit(1);
+	for (int index = 0; index < threadCount; index++) {
+		workers[index] = (Worker){scripts, scriptCount, expected, rounds, index, 0, 0};
+		if (pthread_create(&workers[index].thread, NULL, runWorker, &workers[index]) != 0) {
+			printf("[stress] could not start thread %d\n", index);
+			exit(1);
+		}
+	}
+
+	int mismatches = 0;
+	for (int index = 0; index < threadCount; index++) {
+		pthread_join(workers[index].thread, NULL);
+		mismatches += workers[index].mismatches;
+	}
+
+	fflush(stderr);
+	dup2(savedStderr, STDERR_FILENO);
+	close(savedStderr);
+
+	fprintf(stderr, "[stress] %d threads x %d rounds x %d scripts: %d mismatches\n", threadCount, rounds, scriptCount,
+	        mismatches);
+	for (int index = 0; index < scriptCount; index++) free(expected[index].output);
+	free(workers);
+	freeChunk(&arithmetic);
+	return mismatches == 0 ? 0 : 1;
+}
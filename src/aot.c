@@ -0,0 +1,272 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/aot.h"
+#include "include/debug.h"
+#include "include/vm.h"
+
+/* Ahead-of-time compilation of stack-based chunks to C
+ *
+ *  A chunk has no jumps, so it becomes a single function of straight-line C, one statement or two per instruction,
+ *  working on a local array in place of the VM's stack. The generated code only needs value.h and the runtime in
+ *  value.c and memory.c (the cynch-runtime library) to print its result, and behaves as interpretChunk() would: the
+ *  same output, the same runtime errors with the same [line N, column M], and the exit codes of runFile().
+ *
+ *  Positions are looked up while generating, at the offset the interpreter's instruction pointer would point just
+ *  past when the error is raised, and written into the code as constants. The same goes for the stack: its depth is
+ *  known at every instruction, so an overflow is reported where the interpreter's guard page would have caught it,
+ *  and the array is exactly as deep as the chunk needs.
+ */
+
+// The output of the generator, and what it knows about the chunk so far
+typedef struct {
+	const Chunk* chunk;
+	FILE* body;                 // The statements of the generated function
+	int depth;                  // Values on the stack before the next instruction
+	int maxDepth;
+	bool usesBits;              // Whether a number had to be written as its bits
+	bool usesErrors;            // Whether the code can fail at runtime
+	bool returns;               // Whether the code can get to its return
+	bool finished;              // Whether the code returned or failed, anything after it is never executed
+	const char* error;          // Why the chunk can't be compiled, NULL if it can
+} Generator;
+
+/* Writes a statement that reports a runtime error and exits the script, and finishes the code
+ *
+ *  Params:
+ *      message:    the message, already a C string literal
+ *      offset:     the code offset the interpreter's error would have been reported at
+ */
+static void emitError(Generator* generator, const char* message, int offset) {
+	SourcePosition position = getPosition(generator->chunk, offset);
+	fprintf(generator->body, "\treturn runtimeError(\"%s\", %d, %d);\n", message, position.line, position.column);
+	generator->usesErrors = true;
+	generator->finished = true;
+}
+
+/* Writes a value as a C expression of the same Value
+ *      Finite numbers are written as hexadecimal floating point literals, which are exact. Infinities and NaNs, which
+ *      constant folding can produce, have no literal and are rebuilt from their bits.
+ *
+ */
+static void emitValue(Generator* generator, Value value) {
+	if (IS_BOOL(value)) {
+		fprintf(generator->body, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+	} else if (IS_NIL(value)) {
+		fprintf(generator->body, "NIL_VAL(0)");
+	} else if (isfinite(AS_NUMBER(value))) {
+		fprintf(generator->body, "NUMBER_VAL(%a)", AS_NUMBER(value));
+	} else {
+		double number = AS_NUMBER(value);
+		uint64_t bits;
+		memcpy(&bits, &number, sizeof(bits));
+		fprintf(generator->body, "NUMBER_VAL(numberFromBits(0x%016llxull))", (unsigned long long)bits);
+		generator->usesBits = true;
+	}
+}
+
+/* Writes the code of one instruction
+ *      A superinstruction is written as its two instructions, with the second one at the offset its operands would
+ *      start at minus one, which is where the interpreter's instruction pointer points to when it fails.
+ *
+ *  Params:
+ *      instruction:    the opcode to write
+ *      offset:         where the instruction is, its operands follow it
+ */
+static void emitInstruction(Generator* generator, uint8_t instruction, int offset) {
+	const Chunk* chunk = generator->chunk;
+	FILE* body = generator->body;
+	int size = instructionSize(instruction);
+	if (offset + size > chunk->count) {
+		generator->error = "an instruction is cut short";
+		return;
+	}
+
+	const uint8_t* operands = chunk->code + offset + 1;
+	instruction = genericOpcode(instruction);
+	switch (instruction) {
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG: {
+			int index = instruction == OP_CONSTANT ? operands[0] : operands[0] | (operands[1] << 8) | (operands[2] << 16);
+			if (index >= chunk->constants.count) {
+				generator->error = "a constant is out of range";
+			} else if (generator->depth == STACK_MAX) {
+				// The push faults on the guard page once the operand is read
+				emitError(generator, "Stack overflow.", offset + size - 1);
+			} else {
+				fprintf(body, "\t*top++ = ");
+				emitValue(generator, chunk->constants.values[index]);
+				fprintf(body, ";\n");
+				if (++generator->depth > generator->maxDepth) generator->maxDepth = generator->depth;
+			}
+			return;
+		}
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE: {
+			static const char operators[] = {'+', '-', '*', '/'};
+			if (generator->depth < 2) {
+				generator->error = "an instruction has too few operands";
+				return;
+			}
+
+			SourcePosition position = getPosition(chunk, offset);
+			fprintf(body, "\tif (!IS_NUMBER(top[-1]) || !IS_NUMBER(top[-2])) "
+			              "return runtimeError(\"Operands must be numbers.\", %d, %d);\n",
+			        position.line, position.column);
+			fprintf(body, "\ttop[-2] = NUMBER_VAL(AS_NUMBER(top[-2]) %c AS_NUMBER(top[-1]));\n",
+			        operators[instruction - OP_ADD]);
+			fprintf(body, "\ttop--;\n");
+			generator->usesErrors = true;
+			generator->depth--;
+			return;
+		}
+		case OP_NEGATE: {
+			if (generator->depth < 1) {
+				generator->error = "an instruction has too few operands";
+				return;
+			}
+
+			SourcePosition position = getPosition(chunk, offset);
+			fprintf(body, "\tif (!IS_NUMBER(top[-1])) return runtimeError(\"Operand must be a number.\", %d, %d);\n",
+			        position.line, position.column);
+			fprintf(body, "\ttop[-1] = NUMBER_VAL(-AS_NUMBER(top[-1]));\n");
+			generator->usesErrors = true;
+			return;
+		}
+		case OP_RETURN:
+			if (generator->depth < 1) {
+				generator->error = "an instruction has too few operands";
+				return;
+			}
+
+			fprintf(body, "\tprintResult(*--top);\n\treturn 0;\n");
+			generator->returns = true;
+			generator->finished = true;
+			return;
+
+#define SUPERINSTRUCTION_C(first, second) \
+		case OP_##first##_##second: \
+			emitInstruction(generator, OP_##first, offset); \
+			if (!generator->finished && generator->error == NULL) { \
+				emitInstruction(generator, OP_##second, offset + instructionSize(OP_##first) - 1); \
+			} \
+			return;
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_C)
+#undef SUPERINSTRUCTION_C
+
+		default: {
+			char message[32];
+			snprintf(message, sizeof(message), "Unknown opcode %d.", instruction);
+			emitError(generator, message, offset);
+			return;
+		}
+	}
+}
+
+/* Writes the translation unit around the generated function body
+ *
+ */
+static void writeUnit(FILE* file, Generator* generator, const char* scriptName, const char* body, size_t bodySize) {
+	// A line break in the name would end the comment early
+	fprintf(file, "// Generated by cynch --emit-c from \"");
+	for (const char* character = scriptName; *character != '\0'; character++) {
+		fputc(*character == '\n' || *character == '\r' ? '?' : *character, file);
+	}
+	fprintf(file, "\", do not edit\n");
+	fprintf(file, "//\n"
+	              "// Build it against the headers in src/include and the runtime library:\n"
+	              "//     cc -O2 -I src/include script.c libcynch-runtime.a -o script\n"
+	              "// Defining CYNCH_AOT_NO_MAIN leaves main() out, to link the script into a program or a shared object\n"
+	              "// that calls " AOT_ENTRY "() itself. It returns what the interpreter would exit with.\n\n");
+
+#ifdef NAN_BOXING
+	// The runtime was built with the same representation as the interpreter that generated the code
+	fprintf(file, "#ifndef NAN_BOXING\n#define NAN_BOXING\n#endif\n\n");
+#endif
+	fprintf(file, "#include <stdio.h>\n#include <string.h>\n\n#include \"value.h\"\n\n");
+
+	fprintf(file, "int " AOT_ENTRY "(void);\n\n");
+	if (generator->usesErrors) {
+		fprintf(file, "static int runtimeError(const char* message, int line, int column) {\n"
+		              "\tfprintf(stderr, \"%%s\\n[line %%d, column %%d] in script\\n\", message, line, column);\n"
+		              "\treturn 70;\n"
+		              "}\n\n");
+	}
+	if (generator->returns) {
+		fprintf(file, "static void printResult(Value result) {\n"
+		              "\tprintf(\"\\n\");\n"
+		              "\tfprintValue(stdout, result);\n"
+		              "\tprintf(\"\\n\");\n"
+		              "}\n\n");
+	}
+	if (generator->usesBits) {
+		fprintf(file, "static double numberFromBits(unsigned long long bits) {\n"
+		              "\tdouble number;\n"
+		              "\tmemcpy(&number, &bits, sizeof(number));\n"
+		              "\treturn number;\n"
+		              "}\n\n");
+	}
+
+	fprintf(file, "int " AOT_ENTRY "(void) {\n");
+	fprintf(file, "\tValue stack[%d];\n\tValue* top = stack;\n", generator->maxDepth > 0 ? generator->maxDepth : 1);
+	if (generator->maxDepth == 0) fprintf(file, "\t(void)top;\n");
+	fprintf(file, "\n");
+	fwrite(body, 1, bodySize, file);
+	fprintf(file, "}\n\n");
+
+	fprintf(file, "#ifndef CYNCH_AOT_NO_MAIN\n"
+	              "int main(void) {\n"
+	              "\treturn " AOT_ENTRY "();\n"
+	              "}\n"
+	              "#endif\n");
+}
+
+/* Compiles a chunk of stack-based instructions to a C translation unit
+ *
+ *  Params:
+ *      chunk:          the chunk to compile
+ *      scriptName:     the script the chunk was compiled from, for the generated file's header
+ *      path:           the path of the C file to create
+ *
+ *  Returns:
+ *      True if the file was written, false otherwise (an error is printed).
+ */
+bool writeCSource(const Chunk* chunk, const char* scriptName, const char* path) {
+	char* body = NULL;
+	size_t bodySize = 0;
+	Generator generator = {chunk, open_memstream(&body, &bodySize), 0, 0, false, false, false, false, NULL};
+	if (generator.body == NULL) {
+		fprintf(stderr, "Not enough memory to generate C.\n");
+		return false;
+	}
+
+	for (int offset = 0; offset < chunk->count && !generator.finished && generator.error == NULL;) {
+		uint8_t instruction = chunk->code[offset];
+		fprintf(generator.body, "\t// %04d %s\n", offset, opcodeName(instruction));
+		emitInstruction(&generator, instruction, offset);
+		offset += instructionSize(instruction);
+	}
+	if (!generator.finished && generator.error == NULL) generator.error = "the code runs past its end";
+	fclose(generator.body);
+
+	if (generator.error != NULL) {
+		fprintf(stderr, "Can't compile \"%s\" to C: %s.\n", scriptName, generator.error);
+		free(body);
+		return false;
+	}
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		free(body);
+		return false;
+	}
+
+	writeUnit(file, &generator, scriptName, body, bodySize);
+	free(body);
+	return fclose(file) == 0;
+}
@@ -0,0 +1,359 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/batch.h"
+#include "include/bytecode.h"
+#include "include/memory.h"
+#include "include/source.h"
+
+/* Batches run every script on its own interpreter, on a pool of worker threads:
+ *      - each worker owns a VM, which is reset before every script, and a queue of scripts to run
+ *      - the scripts are split between the queues up front, in contiguous runs
+ *      - a worker takes scripts from the back of its own queue, and once it is empty, steals from the front of the
+ *        other workers' queues, so workers given slower scripts are helped by the others
+ *  Running scripts never add scripts, so a worker that finds every queue empty is done.
+ *
+ *  What scripts print is captured and written out in the order of the script list once all of them have run.
+ */
+
+// One worker's share of the scripts, a range of the script list
+typedef struct {
+	pthread_mutex_t lock;
+	int front;
+	int back;               // One past the last script left
+} WorkQueue;
+
+// What happened to one script
+typedef struct {
+	int exitCode;           // 0, or the exit code runFile() would have exited with
+	uint64_t nanoseconds;   // Wall time from reading the script to its result
+	char* output;           // Everything the script printed
+	size_t outputSize;
+} ScriptResult;
+
+typedef struct {
+	ScriptList* scripts;
+	BatchOptions* options;
+	ScriptResult* results;
+	WorkQueue* queues;
+	int workerCount;
+} Batch;
+
+typedef struct {
+	Batch* batch;
+	int index;
+	pthread_t thread;
+} Worker;
+
+/* Initializes an empty script list
+ *
+ */
+void initScriptList(ScriptList* scripts) {
+	scripts->count = 0;
+	scripts->capacity = 0;
+	scripts->paths = NULL;
+}
+
+/* Adds a copy of a path to the end of a script list
+ *
+ */
+void addScript(ScriptList* scripts, const char* path) {
+	if (scripts->capacity < scripts->count + 1) {
+		int oldCapacity = scripts->capacity;
+		scripts->capacity = GROW_CAPACITY(oldCapacity);
+		scripts->paths = GROW_ARRAY(NULL, char*, scripts->paths, oldCapacity, scripts->capacity);
+	}
+
+	size_t length = strlen(path);
+	char* copy = reallocate(NULL, 0, length + 1);
+	memcpy(copy, path, length + 1);
+	scripts->paths[scripts->count++] = copy;
+}
+
+/* Adds the scripts named by a manifest file to a script list
+ *
+ *  A manifest holds one path per line. Blank lines and lines starting with '#' are skipped, as is whitespace around
+ *  each path.
+ *
+ *  Returns:
+ *      True if the manifest was read, false otherwise (an error is printed).
+ */
+bool readManifest(ScriptList* scripts, const char* path) {
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open manifest \"%s\".\n", path);
+		return false;
+	}
+
+	char* line = NULL;
+	size_t lineCapacity = 0;
+	ssize_t length;
+	while ((length = getline(&line, &lineCapacity, file)) != -1) {
+		char* start = line;
+		char* end = line + length;
+		while (start < end && (*start == ' ' || *start == '\t')) start++;
+		while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+
+		if (start == end || *start == '#') continue;
+		*end = '\0';
+		addScript(scripts, start);
+	}
+
+	free(line);
+	bool read = !ferror(file);
+	fclose(file);
+	if (!read) fprintf(stderr, "Could not read manifest \"%s\".\n", path);
+	return read;
+}
+
+/* Frees a script list and the paths it holds
+ *
+ */
+void freeScriptList(ScriptList* scripts) {
+	for (int index = 0; index < scripts->count; index++) {
+		FREE_ARRAY(NULL, char, scripts->paths[index], strlen(scripts->paths[index]) + 1);
+	}
+
+	FREE_ARRAY(NULL, char*, scripts->paths, scripts->capacity);
+	initScriptList(scripts);
+}
+
+/* Reads the monotonic clock
+ *
+ */
+static uint64_t nanoseconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Runs one script of the batch on a worker's VM, the way runFile() would
+ *
+ *  Params:
+ *      vm:         the worker's VM
+ *      path:       the script, either source code or a bytecode file
+ *      result:     where to store the script's exit code, time and output
+ */
+static void runScript(VM* vm, const char* path, ScriptResult* result) {
+	uint64_t start = nanoseconds();
+
+	FILE* output = open_memstream(&result->output, &result->outputSize);
+	if (output == NULL) {
+		result->exitCode = 74;
+		return;
+	}
+	setOutput(vm, output);
+	setScriptName(vm, path);
+
+	if (isBytecodeFile(path)) {
+		BytecodeFile file;
+		if (vm->backend != BACKEND_STACK) {
+			fprintf(stderr, "Bytecode file \"%s\" can't run on the register backend.\n", path);
+			result->exitCode = 64;
+		} else if (!loadBytecode(path, &file)) {
+			result->exitCode = 65;
+		} else {
+			result->exitCode = interpretChunk(vm, &file.chunk) == INTERPRET_OK ? 0 : 70;
+			unloadBytecode(&file);
+		}
+	} else {
+		SourceFile source;
+		if (!openSource(&source, path)) {
+			result->exitCode = 74;
+		} else {
+			Scanner scanner;
+			scanSource(&source, &scanner);
+			InterpretResult interpreted = interpretSource(vm, &scanner);
+			result->exitCode = source.failed ? 74 :
+			                   interpreted == INTERPRET_COMPILE_ERROR ? 65 :
+			                   interpreted == INTERPRET_RUNTIME_ERROR ? 70 : 0;
+			closeSource(&source);
+		}
+	}
+
+	setOutput(vm, stdout);
+	fclose(output);
+	result->nanoseconds = nanoseconds() - start;
+}
+
+/* Takes the next script for a worker, from the back of its own queue or else the front of another worker's
+ *
+ *  Returns:
+ *      The index of the script in the script list, or -1 once every queue is empty.
+ */
+static int takeScript(Batch* batch, int worker) {
+	for (int offset = 0; offset < batch->workerCount; offset++) {
+		WorkQueue* queue = &batch->queues[(worker + offset) % batch->workerCount];
+		int script = -1;
+
+		pthread_mutex_lock(&queue->lock);
+		if (queue->front < queue->back) {
+			script = offset == 0 ? --queue->back : queue->front++;
+		}
+		pthread_mutex_unlock(&queue->lock);
+
+		if (script >= 0) return script;
+	}
+
+	return -1;
+}
+
+/* The body of a worker thread: runs scripts on its own VM until there are none left
+ *
+ */
+static void* runWorker(void* argument) {
+	Worker* worker = (Worker*)argument;
+	Batch* batch = worker->batch;
+
+	// A worker without a VM still takes its share of the scripts, and fails them
+	VM vm;
+	bool ready = initVM(&vm);
+	if (ready) {
+		setBackend(&vm, batch->options->backend);
+		setOptimizer(&vm, batch->options->optimize, false);
+		setJit(&vm, batch->options->jit);
+		setMemoryLimit(&vm, batch->options->memoryLimit);
+	}
+
+	int script;
+	while ((script = takeScript(batch, worker->index)) >= 0) {
+		if (ready) {
+			runScript(&vm, batch->scripts->paths[script], &batch->results[script]);
+		} else {
+			batch->results[script].exitCode = 70;
+		}
+	}
+
+	if (ready) freeVM(&vm);
+	return NULL;
+}
+
+/* Orders latencies from shortest to longest
+ *
+ */
+static int compareLatencies(const void* a, const void* b) {
+	uint64_t latencyA = *(const uint64_t*)a;
+	uint64_t latencyB = *(const uint64_t*)b;
+	return latencyA < latencyB ? -1 : latencyA > latencyB ? 1 : 0;
+}
+
+/* Picks a percentile out of sorted latencies, by the nearest rank method
+ *
+ *  Returns:
+ *      The latency in milliseconds.
+ */
+static double percentile(uint64_t* latencies, int count, int percent) {
+	int rank = (count * percent + 99) / 100;
+	if (rank < 1) rank = 1;
+	return (double)latencies[rank - 1] / 1e6;
+}
+
+/* Prints the scripts that failed and a summary of the batch to stderr
+ *
+ */
+static void reportBatch(Batch* batch, uint64_t elapsed) {
+	int count = batch->scripts->count;
+	int failed = 0;
+	uint64_t* latencies = malloc(sizeof(uint64_t) * count);
+
+	for (int script = 0; script < count; script++) {
+		ScriptResult* result = &batch->results[script];
+		if (result->exitCode != 0) {
+			fprintf(stderr, "[batch] %s: exit %d\n", batch->scripts->paths[script], result->exitCode);
+			failed++;
+		}
+		if (latencies != NULL) latencies[script] = result->nanoseconds;
+	}
+
+	double seconds = (double)elapsed / 1e9;
+	fprintf(stderr, "[batch] %d scripts on %d worker%s: %d ok, %d failed in %.3f s (%.1f scripts/s)\n",
+	        count, batch->workerCount, batch->workerCount == 1 ? "" : "s",
+	        count - failed, failed, seconds, seconds > 0 ? count / seconds : 0.0);
+
+	if (latencies != NULL) {
+		qsort(latencies, count, sizeof(uint64_t), compareLatencies);
+		fprintf(stderr, "[batch] latency p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		        percentile(latencies, count, 50), percentile(latencies, count, 90),
+		        percentile(latencies, count, 99), (double)latencies[count - 1] / 1e6);
+		free(latencies);
+	}
+}
+
+/* Runs every script of a list in parallel, each on a fresh interpreter
+ *
+ *  Each script's output is printed once every script has run, in the order of the list. The scripts that failed,
+ *  with the exit code they would have exited with on their own, are listed on stderr followed by the throughput of
+ *  the batch and percentiles of the time taken by each script.
+ *
+ *  Params:
+ *      scripts:    the paths of the scripts, source code or bytecode files
+ *      options:    the backend, optimizer and number of workers to use
+ *
+ *  Returns:
+ *      0 if every script ran, otherwise the exit code of the first script in the list that failed.
+ */
+int runBatch(ScriptList* scripts, BatchOptions* options) {
+	int count = scripts->count;
+	if (count == 0) return 0;
+
+	int workerCount = options->jobs;
+	if (workerCount <= 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		workerCount = cores > 0 ? (int)cores : 1;
+	}
+	if (workerCount > count) workerCount = count;
+
+	Batch batch;
+	batch.scripts = scripts;
+	batch.options = options;
+	batch.workerCount = workerCount;
+	batch.results = calloc(count, sizeof(ScriptResult));
+	batch.queues = calloc(workerCount, sizeof(WorkQueue));
+	Worker* workers = calloc(workerCount, sizeof(Worker));
+	if (batch.results == NULL || batch.queues == NULL || workers == NULL) {
+		fprintf(stderr, "Not enough memory to run the batch.\n");
+		exit(1);
+	}
+
+	// Each queue starts with a contiguous run of scripts
+	for (int index = 0; index < workerCount; index++) {
+		WorkQueue* queue = &batch.queues[index];
+		pthread_mutex_init(&queue->lock, NULL);
+		queue->front = (int)((int64_t)count * index / workerCount);
+		queue->back = (int)((int64_t)count * (index + 1) / workerCount);
+	}
+
+	uint64_t start = nanoseconds();
+	for (int index = 0; index < workerCount; index++) {
+		workers[index].batch = &batch;
+		workers[index].index = index;
+		if (pthread_create(&workers[index].thread, NULL, runWorker, &workers[index]) != 0) {
+			fprintf(stderr, "Could not start a batch worker.\n");
+			exit(1);
+		}
+	}
+	for (int index = 0; index < workerCount; index++) pthread_join(workers[index].thread, NULL);
+	uint64_t elapsed = nanoseconds() - start;
+
+	int exitCode = 0;
+	for (int script = 0; script < count; script++) {
+		ScriptResult* result = &batch.results[script];
+		if (result->output != NULL) fwrite(result->output, 1, result->outputSize, stdout);
+		free(result->output);
+		if (exitCode == 0) exitCode = result->exitCode;
+	}
+	fflush(stdout);
+
+	reportBatch(&batch, elapsed);
+
+	for (int index = 0; index < workerCount; index++) pthread_mutex_destroy(&batch.queues[index].lock);
+	free(workers);
+	free(batch.queues);
+	free(batch.results);
+	return exitCode;
+}
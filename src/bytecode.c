@@ -0,0 +1,350 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/bytecode.h"
+#include "include/memory.h"
+
+/* Layout of a bytecode file (version 2):
+ *
+ *      header                  BytecodeHeader, 44 bytes
+ *      code                    codeSize bytes, executed in place
+ *      position checkpoints    checkpointCount PositionCheckpoints, 4 byte aligned, used in place
+ *      positions               positionSize bytes holding positionCount encoded entries, used in place
+ *      constant table          constantCount BytecodeConstants, 8 byte aligned, decoded into a ValueArray
+ *
+ *  The position table is stored as the chunk holds it (see PositionTable in chunk.h). Integers are stored in the byte
+ *  order of the machine that wrote the file, which byteOrder records: a file is only loaded by machines with the same
+ *  byte order, so its code and position table never need converting.
+ */
+#define BYTECODE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t byteOrder;
+	uint32_t codeSize;
+	uint32_t checkpointsOffset;
+	uint32_t checkpointCount;
+	uint32_t positionsOffset;
+	uint32_t positionSize;
+	uint32_t positionCount;
+	uint32_t constantsOffset;
+	uint32_t constantCount;
+} BytecodeHeader;
+
+// Constants are stored independently of the build's Value representation (see NAN_BOXING in value.h)
+typedef struct {
+	uint32_t type;          // A ValueType
+	uint32_t reserved;
+	uint64_t bits;          // The bits of a number, or 0/1 for a boolean
+} BytecodeConstant;
+
+/* Rounds an offset up to a multiple of the given alignment
+ *
+ */
+static uint32_t alignOffset(uint32_t offset, uint32_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/* Checks if a file starts with the bytecode magic number
+ *      Only regular files are looked at: reading the magic number from a pipe would take it away from the scanner.
+ *
+ *  Returns:
+ *      True if the file is a bytecode file, false if it is not (or can't be read).
+ */
+bool isBytecodeFile(const char* path) {
+	struct stat status;
+	if (stat(path, &status) != 0 || !S_ISREG(status.st_mode)) return false;
+
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+
+	char magic[4];
+	bool isBytecode = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+	                  memcmp(magic, BYTECODE_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return isBytecode;
+}
+
+/* Writes zero bytes until the file reaches the given offset
+ *
+ */
+static void writePadding(FILE* file, uint32_t from, uint32_t to) {
+	for (; from < to; from++) fputc(0, file);
+}
+
+/* Writes a chunk of stack-based instructions to a bytecode file
+ *
+ *  Params:
+ *      chunk:      the chunk to write
+ *      path:       the path of the file to create
+ *
+ *  Returns:
+ *      True if the file was written, false otherwise (an error is printed).
+ */
+bool writeBytecode(Chunk* chunk, const char* path) {
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		return false;
+	}
+
+	BytecodeHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+	header.version = BYTECODE_VERSION;
+	header.byteOrder = BYTECODE_BYTE_ORDER;
+	PositionTable* positions = &chunk->positions;
+	header.codeSize = (uint32_t)chunk->count;
+	header.checkpointsOffset = alignOffset(sizeof(BytecodeHeader) + header.codeSize, 4);
+	header.checkpointCount = (uint32_t)positions->checkpointCount;
+	header.positionsOffset = header.checkpointsOffset + header.checkpointCount * sizeof(PositionCheckpoint);
+	header.positionSize = (uint32_t)positions->byteCount;
+	header.positionCount = (uint32_t)positions->entryCount;
+	header.constantsOffset = alignOffset(header.positionsOffset + header.positionSize, 8);
+	header.constantCount = (uint32_t)chunk->constants.count;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(chunk->code, 1, chunk->count, file);
+	writePadding(file, sizeof(BytecodeHeader) + header.codeSize, header.checkpointsOffset);
+	fwrite(positions->checkpoints, sizeof(PositionCheckpoint), positions->checkpointCount, file);
+	fwrite(positions->bytes, 1, positions->byteCount, file);
+	writePadding(file, header.positionsOffset + header.positionSize, header.constantsOffset);
+
+	for (int index = 0; index < chunk->constants.count; index++) {
+		Value value = chunk->constants.values[index];
+		BytecodeConstant constant = {VAL_NIL, 0, 0};
+
+		if (IS_NUMBER(value)) {
+			double number = AS_NUMBER(value);
+			constant.type = VAL_NUMBER;
+			memcpy(&constant.bits, &number, sizeof(double));
+		} else if (IS_BOOL(value)) {
+			constant.type = VAL_BOOL;
+			constant.bits = AS_BOOL(value);
+		}
+
+		fwrite(&constant, sizeof(constant), 1, file);
+	}
+
+	bool written = !ferror(file);
+	if (fclose(file) != 0) written = false;
+	if (!written) fprintf(stderr, "Could not write file \"%s\".\n", path);
+	return written;
+}
+
+/* Checks one instruction of a loaded chunk, simulating its effect on the stack
+ *
+ *  Superinstructions are checked as the instructions they are made of, reading their operands in order.
+ *
+ *  Params:
+ *      chunk:      the chunk being validated
+ *      op:         the opcode to check
+ *      operand:    the offset of the opcode's next operand, advanced past the operands it reads
+ *      depth:      the number of values on the stack, updated by the instruction's pushes and pops
+ *
+ *  Returns:
+ *      NULL if the instruction is valid, or else a description of the problem.
+ */
+static const char* checkInstruction(Chunk* chunk, uint8_t op, int* operand, int* depth) {
+	switch (genericOpcode(op)) {
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG: {
+			int size = op == OP_CONSTANT ? 1 : 3;
+			if (*operand + size > chunk->count) return "operand runs past the end of the code";
+
+			uint8_t* bytes = &chunk->code[*operand];
+			int constant = op == OP_CONSTANT ? bytes[0] : bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+			if (constant >= chunk->constants.count) return "constant index out of range";
+
+			*operand += size;
+			(*depth)++;
+			return NULL;
+		}
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+			if (*depth < 2) return "stack underflow";
+			(*depth)--;
+			return NULL;
+		case OP_NEGATE:
+		case OP_RETURN:
+			if (*depth < 1) return "stack underflow";
+			return NULL;
+
+#define SUPERINSTRUCTION_CHECK(first, second) \
+		case OP_##first##_##second: { \
+			const char* problem = checkInstruction(chunk, OP_##first, operand, depth); \
+			return problem != NULL ? problem : checkInstruction(chunk, OP_##second, operand, depth); \
+		}
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_CHECK)
+#undef SUPERINSTRUCTION_CHECK
+
+		default:
+			return "unknown opcode";
+	}
+}
+
+/* Checks that a loaded chunk is safe to run as it is
+ *
+ *  Every opcode must be one the VM executes, every operand and constant index must be in bounds, no instruction may
+ *  pop from an empty stack, and the code must end with its only OP_RETURN so execution can never run off the end.
+ *  The position table must decode safely and cover the code (see checkPositions()).
+ *
+ *  Returns:
+ *      NULL if the chunk is valid, or else a description of the problem.
+ */
+static const char* validateChunk(Chunk* chunk) {
+	if (chunk->count == 0) return "no code";
+
+	const char* positionProblem = checkPositions(chunk);
+	if (positionProblem != NULL) return positionProblem;
+
+	int depth = 0;
+	for (int offset = 0; offset < chunk->count;) {
+		uint8_t op = chunk->code[offset];
+		int operand = offset + 1;
+
+		const char* problem = checkInstruction(chunk, op, &operand, &depth);
+		if (problem != NULL) return problem;
+
+		if (op == OP_RETURN && operand != chunk->count) return "code continues after OP_RETURN";
+		if (op != OP_RETURN && operand == chunk->count) return "code does not end with OP_RETURN";
+		offset = operand;
+	}
+
+	return NULL;
+}
+
+/* Decodes the constant table of a bytecode file
+ *
+ *  Returns:
+ *      True if every constant is valid, false otherwise.
+ */
+static bool readConstants(BytecodeConstant* constants, uint32_t count, ValueArray* values) {
+	for (uint32_t index = 0; index < count; index++) {
+		BytecodeConstant* constant = &constants[index];
+
+		switch (constant->type) {
+			case VAL_NUMBER: {
+				double number;
+				memcpy(&number, &constant->bits, sizeof(double));
+				writeValueArray(values, NUMBER_VAL(number));
+				break;
+			}
+			case VAL_BOOL:
+				if (constant->bits > 1) return false;
+				writeValueArray(values, BOOL_VAL(constant->bits == 1));
+				break;
+			case VAL_NIL:
+				writeValueArray(values, NIL_VAL(0));
+				break;
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/* Maps a bytecode file into memory and validates it:
+ *      The code and the position table are used in place from the read-only mapping, only the constants are copied out.
+ *      The resulting chunk must be released with unloadBytecode(), not freeChunk().
+ *
+ *  Params:
+ *      path:       the bytecode file to load
+ *      file:       where to store the loaded chunk and its mapping
+ *
+ *  Returns:
+ *      True if the file was loaded, false otherwise (an error is printed).
+ */
+bool loadBytecode(const char* path, BytecodeFile* file) {
+	int descriptor = open(path, O_RDONLY);
+	if (descriptor < 0) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(BytecodeHeader)) {
+		fprintf(stderr, "Invalid bytecode file \"%s\": truncated header.\n", path);
+		close(descriptor);
+		return false;
+	}
+
+	size_t size = (size_t)status.st_size;
+	void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	close(descriptor);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Could not map file \"%s\".\n", path);
+		return false;
+	}
+
+	file->mapping = mapping;
+	file->mappingSize = size;
+	initChunk(&file->chunk);
+	file->chunk.quicken = false;    // The code is in a read-only mapping
+
+	const char* problem = NULL;
+	BytecodeHeader* header = (BytecodeHeader*)mapping;
+	uint64_t positionsEnd = (uint64_t)header->positionsOffset + header->positionSize;
+	uint64_t constantsEnd = (uint64_t)header->constantsOffset +
+	                        (uint64_t)header->constantCount * sizeof(BytecodeConstant);
+
+	if (memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)) != 0) {
+		problem = "not a bytecode file";
+	} else if (header->version != BYTECODE_VERSION) {
+		problem = "unsupported version";
+	} else if (header->byteOrder != BYTECODE_BYTE_ORDER) {
+		problem = "written by a machine with a different byte order";
+	} else if ((uint64_t)sizeof(BytecodeHeader) + header->codeSize > header->checkpointsOffset ||
+	           header->checkpointsOffset % 4 != 0 ||
+	           (uint64_t)header->checkpointsOffset + (uint64_t)header->checkpointCount * sizeof(PositionCheckpoint) !=
+	           header->positionsOffset || positionsEnd > header->constantsOffset ||
+	           header->constantsOffset % 8 != 0 || constantsEnd > size ||
+	           header->codeSize > INT32_MAX || header->checkpointCount > INT32_MAX ||
+	           header->positionSize > INT32_MAX || header->positionCount > INT32_MAX) {
+		problem = "sections out of bounds";
+	} else {
+		Chunk* chunk = &file->chunk;
+		chunk->code = (uint8_t*)mapping + sizeof(BytecodeHeader);
+		chunk->count = (int)header->codeSize;
+		chunk->positions.checkpoints = (PositionCheckpoint*)((char*)mapping + header->checkpointsOffset);
+		chunk->positions.checkpointCount = (int)header->checkpointCount;
+		chunk->positions.bytes = (uint8_t*)mapping + header->positionsOffset;
+		chunk->positions.byteCount = (int)header->positionSize;
+		chunk->positions.entryCount = (int)header->positionCount;
+
+		if (!readConstants((BytecodeConstant*)((char*)mapping + header->constantsOffset), header->constantCount,
+		                   &chunk->constants)) {
+			problem = "invalid constant";
+		} else {
+			problem = validateChunk(chunk);
+		}
+	}
+
+	if (problem != NULL) {
+		fprintf(stderr, "Invalid bytecode file \"%s\": %s.\n", path, problem);
+		unloadBytecode(file);
+		return false;
+	}
+
+	return true;
+}
+
+/* Releases a chunk loaded by loadBytecode() and unmaps its file
+ *
+ */
+void unloadBytecode(BytecodeFile* file) {
+	freeValueArray(&file->chunk.constants);
+	initChunk(&file->chunk);
+	munmap(file->mapping, file->mappingSize);
+	file->mapping = NULL;
+	file->mappingSize = 0;
+}
@@ -1,21 +1,193 @@
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/chunk.h"
 #include "include/memory.h"
 
-/* Initializes a chunk
+/* Initializes an empty position table
+ *
+ */
+static void initPositionTable(PositionTable* table) {
+	table->entryCount = 0;
+	table->byteCount = 0;
+	table->byteCapacity = 0;
+	table->bytes = NULL;
+	table->checkpointCount = 0;
+	table->checkpointCapacity = 0;
+	table->checkpoints = NULL;
+	table->last = (PositionEntry){0, {0, 0}};
+}
+
+/* Initializes a chunk whose arrays are allocated on the heap
  *
  *  Params:
  *      chunk:      the chunk to initialize
 */
 void initChunk(Chunk* chunk) {
+	initChunkIn(chunk, NULL);
+}
+
+/* Initializes a chunk whose arrays are allocated by the given allocator
+ *      With an arena's allocator, freeChunk() only gives back what it can and the chunk's memory is released when
+ *      the arena is reset.
+ *
+ *  Params:
+ *      chunk:      the chunk to initialize
+ *      allocator:  the allocator to allocate with, NULL for the heap
+*/
+void initChunkIn(Chunk* chunk, const Allocator* allocator) {
 	chunk->count = 0;
 	chunk->capacity = 0;
 	chunk->code = NULL;
-	chunk->lineCount = 0;
-	chunk->lineCapacity = 0;
-	chunk->lines = NULL;
+	initPositionTable(&chunk->positions);
 	initValueArray(&chunk->constants);
+	chunk->constantSlotCount = 0;
+	chunk->constantSlotCapacity = 0;
+	chunk->constantSlots = NULL;
+	chunk->allocator = allocator;
+	chunk->constants.allocator = allocator;
+	chunk->quicken = true;
+}
+
+/* Position table encoding
+ *
+ *  Every entry starts with a byte saying how it moves on from the entry before it:
+ *      0ooo cccc       the offset moves ooo + 1 bytes (1 to 8), the line stays and the column moves cccc - 8 (-8 to 7)
+ *      10oo cccc       the offset moves oo + 1 bytes (1 to 4), the line moves down one and the column is cccc + 1
+ *      1100 0000       the moves of the offset, the line and the column follow as varints, the last two zigzag encoded
+ *  Instructions rarely take more than a few bytes and the tokens of one line are close together, so almost every entry
+ *  fits in the first two forms. A varint holds 7 bits a byte, lowest first, with the top bit set on all but the last.
+ */
+#define POSITION_NEXT_LINE 0x80
+#define POSITION_LONG 0xc0
+
+/* Adds a byte to the end of the encoded entries of a chunk's position table
+ *
+ */
+static void writePositionByte(Chunk* chunk, uint8_t byte) {
+	PositionTable* table = &chunk->positions;
+	if (table->byteCapacity < table->byteCount + 1) {
+		int oldCapacity = table->byteCapacity;
+		table->byteCapacity = GROW_CAPACITY(oldCapacity);
+		table->bytes = GROW_ARRAY(chunk->allocator, uint8_t, table->bytes, oldCapacity, table->byteCapacity);
+	}
+
+	table->bytes[table->byteCount++] = byte;
+}
+
+/* Adds a varint to the encoded entries of a chunk's position table
+ *
+ */
+static void writePositionVarint(Chunk* chunk, uint32_t value) {
+	while (value >= 0x80) {
+		writePositionByte(chunk, (uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	writePositionByte(chunk, (uint8_t)value);
+}
+
+/* Maps a signed move onto an unsigned one, keeping small moves either way small: 0, -1, 1, -2, ... become 0, 1, 2, 3
+ *
+ */
+static uint32_t zigzag(int value) {
+	return value < 0 ? ((uint32_t)~value << 1) | 1 : (uint32_t)value << 1;
+}
+
+static int unzigzag(uint32_t value) {
+	return value & 1 ? -(int)(value >> 1) - 1 : (int)(value >> 1);
+}
+
+/* Reads a varint of a position table
+ *
+ *  Returns:
+ *      True if the varint was read, false if it runs past the end of the table.
+ */
+static bool readPositionVarint(const PositionTable* table, int* byte, uint32_t* value) {
+	*value = 0;
+	for (int shift = 0; shift < 32; shift += 7) {
+		if (*byte >= table->byteCount) return false;
+
+		uint8_t part = table->bytes[(*byte)++];
+		*value |= (uint32_t)(part & 0x7f) << shift;
+		if (!(part & 0x80)) return true;
+	}
+
+	return false;
+}
+
+/* Decodes an entry of a position table
+ *
+ *  Params:
+ *      byte:       where the entry's encoding starts, advanced past it
+ *      entry:      the entry before it, replaced by the decoded entry
+ *
+ *  Returns:
+ *      True if an entry was decoded, false at the end of the table (or if the encoding is broken).
+ */
+static bool decodeEntry(const PositionTable* table, int* byte, PositionEntry* entry) {
+	if (*byte >= table->byteCount) return false;
+
+	// Moves wrap instead of overflowing, a broken table from a bytecode file is caught by checkPositions()
+	uint8_t header = table->bytes[(*byte)++];
+	if (header < POSITION_NEXT_LINE) {
+		entry->offset = (int)((uint32_t)entry->offset + (header >> 4) + 1);
+		entry->position.column = (int)((uint32_t)entry->position.column + (header & 0x0f) - 8);
+	} else if (header < POSITION_LONG) {
+		entry->offset = (int)((uint32_t)entry->offset + ((header >> 4) & 0x03) + 1);
+		entry->position.line = (int)((uint32_t)entry->position.line + 1);
+		entry->position.column = (header & 0x0f) + 1;
+	} else {
+		uint32_t offsetMove, lineMove, columnMove;
+		if (header != POSITION_LONG || !readPositionVarint(table, byte, &offsetMove) ||
+		    !readPositionVarint(table, byte, &lineMove) || !readPositionVarint(table, byte, &columnMove)) {
+			return false;
+		}
+
+		entry->offset = (int)((uint32_t)entry->offset + offsetMove);
+		entry->position.line = (int)((uint32_t)entry->position.line + (uint32_t)unzigzag(lineMove));
+		entry->position.column = (int)((uint32_t)entry->position.column + (uint32_t)unzigzag(columnMove));
+	}
+
+	return true;
+}
+
+/* Adds an entry to the end of a chunk's position table
+ *
+ */
+static void addPosition(Chunk* chunk, PositionEntry entry) {
+	PositionTable* table = &chunk->positions;
+	int offsetMove = entry.offset - table->last.offset;
+	int lineMove = entry.position.line - table->last.position.line;
+	int columnMove = entry.position.column - table->last.position.column;
+
+	if (offsetMove >= 1 && offsetMove <= 8 && lineMove == 0 && columnMove >= -8 && columnMove <= 7) {
+		writePositionByte(chunk, (uint8_t)((offsetMove - 1) << 4 | (columnMove + 8)));
+	} else if (offsetMove >= 1 && offsetMove <= 4 && lineMove == 1 &&
+	           entry.position.column >= 1 && entry.position.column <= 16) {
+		writePositionByte(chunk, (uint8_t)(POSITION_NEXT_LINE | (offsetMove - 1) << 4 | (entry.position.column - 1)));
+	} else {
+		writePositionByte(chunk, POSITION_LONG);
+		writePositionVarint(chunk, (uint32_t)offsetMove);
+		writePositionVarint(chunk, zigzag(lineMove));
+		writePositionVarint(chunk, zigzag(columnMove));
+	}
+
+	if (table->entryCount % POSITION_CHECKPOINT_INTERVAL == 0) {
+		if (table->checkpointCapacity < table->checkpointCount + 1) {
+			int oldCapacity = table->checkpointCapacity;
+			table->checkpointCapacity = GROW_CAPACITY(oldCapacity);
+			table->checkpoints = GROW_ARRAY(chunk->allocator, PositionCheckpoint, table->checkpoints, oldCapacity,
+			                                table->checkpointCapacity);
+		}
+
+		PositionCheckpoint* checkpoint = &table->checkpoints[table->checkpointCount++];
+		checkpoint->byte = table->byteCount;
+		checkpoint->entry = entry;
+	}
+
+	table->entryCount++;
+	table->last = entry;
 }
 
 /* Adds the data to a chunk, grows the arrays if necessary
@@ -23,50 +195,144 @@ void initChunk(Chunk* chunk) {
  * Params:
  *      chunk:      the chunk to write to
  *      byte:       the information to write to the chunk
- *      line:       the source line of the chunk
+ *      line:       the source line of the byte
+ *      column:     the source column of the byte
 */
-void writeChunk(Chunk* chunk, uint8_t byte, int line) {
+void writeChunk(Chunk* chunk, uint8_t byte, int line, int column) {
 	// If there is no more room in the array, increase its size
 	if (chunk->capacity < chunk->count + 1) {
 		int oldCapacity = chunk->capacity;
 		chunk->capacity = GROW_CAPACITY(oldCapacity);
-		chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+		chunk->code = GROW_ARRAY(chunk->allocator, uint8_t, chunk->code, oldCapacity, chunk->capacity);
 	}
 
 	// Then add the new data and increment the count
 	chunk->code[chunk->count] = byte;
 	chunk->count++;
 
-	// Checks if chunk is still on the same line
-	if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+	// Only a byte from somewhere else in the source starts a new entry of the position table
+	PositionTable* table = &chunk->positions;
+	if (table->entryCount > 0 && table->last.position.line == line && table->last.position.column == column) {
 		return;
 	}
 
-	// Otherwise, a LineStart needs to be added
-	// Checks if there is room in the array, grows if necessary
-	if (chunk->lineCapacity < chunk->lineCount + 1) {
-		int oldCapacity = chunk->lineCapacity;
-		chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
-		chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+	PositionEntry entry = {chunk->count - 1, {line, column}};
+	addPosition(chunk, entry);
+}
+
+/* Gets the bits that identify a constant
+ *
+ *  Numbers are identified by their exact bits rather than compared with ==, so 0 and -0 stay separate constants and a
+ *  NaN can be shared with itself.
+ */
+static uint64_t constantBits(Value value) {
+#ifdef NAN_BOXING
+	return value;
+#else
+	uint64_t bits = 0;
+	if (IS_NUMBER(value)) {
+		memcpy(&bits, &value.as.number, sizeof(double));
+	} else if (IS_BOOL(value)) {
+		bits = AS_BOOL(value);
+	}
+
+	return bits ^ ((uint64_t)value.type << 56);
+#endif
+}
+
+/* Checks if two values are the same constant
+ *
+ */
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+	return a == b;
+#else
+	return a.type == b.type && constantBits(a) == constantBits(b);
+#endif
+}
+
+/* Hashes a constant, mixing every bit of it into the low bits used to pick a slot
+ *
+ */
+static uint32_t hashConstant(Value value) {
+	uint64_t hash = constantBits(value);
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return (uint32_t)hash;
+}
+
+/* Finds the slot of the constant index where a value is, or where it should go
+ *
+ *  Slots that point past the end of the constant table were left behind by truncateConstants(). They are skipped
+ *  like tombstones and reused for new values.
+ *
+ *  Returns:
+ *      The slot holding the value's index, or else the first reusable slot of its probe sequence.
+ */
+static int findConstantSlot(Chunk* chunk, Value value) {
+	uint32_t mask = (uint32_t)chunk->constantSlotCapacity - 1;
+	uint32_t slot = hashConstant(value) & mask;
+	int reusable = -1;
+
+	for (;;) {
+		int index = chunk->constantSlots[slot];
+
+		if (index < 0) {
+			return reusable >= 0 ? reusable : (int)slot;
+		} else if (index >= chunk->constants.count) {
+			if (reusable < 0) reusable = (int)slot;
+		} else if (sameConstant(chunk->constants.values[index], value)) {
+			return (int)slot;
+		}
+
+		slot = (slot + 1) & mask;
 	}
+}
+
+/* Rebuilds the constant index with room for more constants, dropping stale slots
+ *
+ */
+static void growConstantSlots(Chunk* chunk) {
+	int oldCapacity = chunk->constantSlotCapacity;
+	FREE_ARRAY(chunk->allocator, int, chunk->constantSlots, oldCapacity);
 
-	// Adds the new LineStart
-	LineStart* lineStart = &chunk->lines[chunk->lineCount++];
-	lineStart->offset = chunk->count - 1;
-	lineStart->line = line;
+	chunk->constantSlotCapacity = GROW_CAPACITY(oldCapacity);
+	chunk->constantSlots = GROW_ARRAY(chunk->allocator, int, NULL, 0, chunk->constantSlotCapacity);
+	for (int slot = 0; slot < chunk->constantSlotCapacity; slot++) chunk->constantSlots[slot] = -1;
+
+	chunk->constantSlotCount = 0;
+	for (int index = 0; index < chunk->constants.count; index++) {
+		int slot = findConstantSlot(chunk, chunk->constants.values[index]);
+		if (chunk->constantSlots[slot] < 0) chunk->constantSlotCount++;
+		chunk->constantSlots[slot] = index;
+	}
 }
 
-/* Adds a value to a chunk's list of constants
+/* Adds a value to a chunk's list of constants, unless the chunk already has it
  *
  *  Params:
  *      chunk:      the chunk to that will contain the value
  *      value:      the constant to be included in the chunk
  *
  *  Returns:
- *      The index of the added value
+ *      The index of the value, either the one it already had or the one it was added at.
  */
 int addConstant(Chunk* chunk, Value value) {
+	// Keeps the index at most 3/4 full so probe sequences stay short
+	if ((chunk->constantSlotCount + 1) * 4 > chunk->constantSlotCapacity * 3) {
+		growConstantSlots(chunk);
+	}
+
+	int slot = findConstantSlot(chunk, value);
+	int index = chunk->constantSlots[slot];
+	if (index >= 0 && index < chunk->constants.count) return index;
+
+	if (index < 0) chunk->constantSlotCount++;
 	writeValueArray(&chunk->constants, value);
+	chunk->constantSlots[slot] = chunk->constants.count - 1;
 	return chunk->constants.count - 1;
 }
 
@@ -76,17 +342,127 @@ int addConstant(Chunk* chunk, Value value) {
  *      chunk:      the chunk to write to
  *      byte:       the information to write to the chunk
 */
-void writeConstant(Chunk* chunk, Value value, int line) {
+void writeConstant(Chunk* chunk, Value value, int line, int column) {
 	int index = addConstant(chunk, value);
 
 	if (index < 256) {
-		writeChunk(chunk, OP_CONSTANT, line);
-		writeChunk(chunk, (uint8_t)index, line);
+		writeChunk(chunk, OP_CONSTANT, line, column);
+		writeChunk(chunk, (uint8_t)index, line, column);
 	} else {
-		writeChunk(chunk, OP_CONSTANT_LONG, line);
-		writeChunk(chunk, (uint8_t)(index & 0xff), line);
-		writeChunk(chunk, (uint8_t)((index >> 8) & 0xff), line);
-		writeChunk(chunk, ((uint8_t)(index >> 16) & 0xff), line);
+		writeChunk(chunk, OP_CONSTANT_LONG, line, column);
+		writeChunk(chunk, (uint8_t)(index & 0xff), line, column);
+		writeChunk(chunk, (uint8_t)((index >> 8) & 0xff), line, column);
+		writeChunk(chunk, ((uint8_t)(index >> 16) & 0xff), line, column);
+	}
+}
+
+/* Finds the last checkpoint of a position table at or before a code offset
+ *
+ *  Returns:
+ *      The index of the checkpoint, the table must have at least one.
+ */
+static int findCheckpoint(const PositionTable* table, int offset) {
+	int low = 0;
+	int high = table->checkpointCount - 1;
+	while (low < high) {
+		int middle = low + (high - low + 1) / 2;
+		if (table->checkpoints[middle].entry.offset <= offset) {
+			low = middle;
+		} else {
+			high = middle - 1;
+		}
+	}
+
+	return low;
+}
+
+/* Removes every byte from the given offset onward, along with the entries of the position table that only they used
+ *
+ *  Params:
+ *      chunk:      the chunk to shorten
+ *      count:      how many bytes of code to keep
+ */
+void truncateCode(Chunk* chunk, int count) {
+	if (count >= chunk->count) return;
+
+	chunk->count = count;
+	PositionTable* table = &chunk->positions;
+	if (count == 0) {
+		table->entryCount = 0;
+		table->byteCount = 0;
+		table->checkpointCount = 0;
+		table->last = (PositionEntry){0, {0, 0}};
+		return;
+	}
+
+	// Keeps the entries up to the one the last kept byte comes from
+	int checkpoint = findCheckpoint(table, count - 1);
+	int index = checkpoint * POSITION_CHECKPOINT_INTERVAL;
+	PositionEntry entry = table->checkpoints[checkpoint].entry;
+	int byte = table->checkpoints[checkpoint].byte;
+	for (;;) {
+		PositionEntry next = entry;
+		int nextByte = byte;
+		if (!decodeEntry(table, &nextByte, &next) || next.offset >= count) break;
+
+		entry = next;
+		byte = nextByte;
+		index++;
+	}
+
+	table->entryCount = index + 1;
+	table->byteCount = byte;
+	table->checkpointCount = checkpoint + 1;
+	table->last = entry;
+}
+
+/* Removes every constant from the given index onward
+ *
+ *  Their slots in the constant index go stale and are reused by addConstant() (see findConstantSlot()).
+ *
+ *  Params:
+ *      chunk:      the chunk to remove constants from
+ *      count:      how many constants to keep
+ */
+void truncateConstants(Chunk* chunk, int count) {
+	if (count < chunk->constants.count) chunk->constants.count = count;
+}
+
+/* Gets the size of a stack-based instruction
+ *
+ *  Params:
+ *      instruction:    the instruction's opcode
+ *
+ *  Returns:
+ *      The number of bytes taken by the opcode and its operands.
+ */
+int instructionSize(uint8_t instruction) {
+	switch (instruction) {
+		case OP_CONSTANT:       return 2;
+		case OP_CONSTANT_LONG:  return 4;
+
+// A superinstruction has one opcode followed by the operands of both of its instructions
+#define SUPERINSTRUCTION_SIZE(first, second) \
+		case OP_##first##_##second: return instructionSize(OP_##first) + instructionSize(OP_##second) - 1;
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_SIZE)
+#undef SUPERINSTRUCTION_SIZE
+
+		default:                return 1;
+	}
+}
+
+/* Gets the instruction a quickened instruction was rewritten from (see QUICKENED_INSTRUCTIONS in chunk.h)
+ *
+ *  Returns:
+ *      The generic opcode of a quickened instruction, or the opcode itself for any other instruction.
+ */
+uint8_t genericOpcode(uint8_t instruction) {
+	switch (instruction) {
+#define QUICKENED_GENERIC(op) case OP_##op##_NUMBERS: return OP_##op;
+		QUICKENED_INSTRUCTIONS(QUICKENED_GENERIC)
+#undef QUICKENED_GENERIC
+
+		default:                return instruction;
 	}
 }
 
@@ -96,34 +472,138 @@ void writeConstant(Chunk* chunk, Value value, int line) {
  *      chunk:      the chunk to free and reinitialize
  */
 void freeChunk(Chunk* chunk) {
-	FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-	FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+	FREE_ARRAY(chunk->allocator, uint8_t, chunk->code, chunk->capacity);
+	FREE_ARRAY(chunk->allocator, uint8_t, chunk->positions.bytes, chunk->positions.byteCapacity);
+	FREE_ARRAY(chunk->allocator, PositionCheckpoint, chunk->positions.checkpoints, chunk->positions.checkpointCapacity);
 	freeValueArray(&chunk->constants);
-	initChunk(chunk);
+	FREE_ARRAY(chunk->allocator, int, chunk->constantSlots, chunk->constantSlotCapacity);
+	initChunkIn(chunk, chunk->allocator);
 }
 
-/* Finds the current line given the chunk and instruction using a binary search.
+/* Finds the source position of a byte of code
+ *      Binary searches the checkpoints of the position table, then decodes fewer than POSITION_CHECKPOINT_INTERVAL
+ *      entries. Use a PositionCursor to look up the bytes of a chunk in order.
  *
  *  Params:
- *      chunk:          the chunk to search
- *      instruction:    the instruction to find within the chunk
+ *      chunk:      the chunk to search
+ *      offset:     the offset of the byte within the chunk's code
  *
  *  Returns:
- *      The line number of the specified instruction within the chunk.
+ *      The position the byte was compiled from, or line and column 0 if the chunk has no code.
  */
-int getLine(Chunk* chunk, int instruction) {
-	int start = 0;
-	int end = chunk->lineCount - 1;
+SourcePosition getPosition(const Chunk* chunk, int offset) {
+	const PositionTable* table = &chunk->positions;
+	if (table->entryCount == 0) return (SourcePosition){0, 0};
 
-	for (;;) {
-		int mid = (start + end) / 2;
-		LineStart* line = &chunk->lines[mid];
-		if (instruction < line->offset) {
-			end = mid - 1;
-		} else if (mid == chunk->lineCount - 1 || instruction < chunk->lines[mid + 1].offset) {
-			return line->line;
-		} else {
-			start = mid + 1;
+	const PositionCheckpoint* checkpoint = &table->checkpoints[findCheckpoint(table, offset)];
+	PositionEntry entry = checkpoint->entry;
+	PositionEntry next = entry;
+	int byte = checkpoint->byte;
+	while (decodeEntry(table, &byte, &next) && next.offset <= offset) entry = next;
+
+	return entry.position;
+}
+
+/* Decodes the entry after a cursor's current one
+ *
+ */
+static void loadNextEntry(PositionCursor* cursor) {
+	cursor->next = cursor->current;
+	if (!decodeEntry(cursor->table, &cursor->byte, &cursor->next)) cursor->next.offset = INT_MAX;
+}
+
+/* Moves a cursor to a checkpoint of its table
+ *
+ */
+static void startAtCheckpoint(PositionCursor* cursor, int checkpoint) {
+	const PositionCheckpoint* start = &cursor->table->checkpoints[checkpoint];
+	cursor->entry = checkpoint * POSITION_CHECKPOINT_INTERVAL;
+	cursor->current = start->entry;
+	cursor->byte = start->byte;
+	loadNextEntry(cursor);
+}
+
+/* Initializes a cursor at the start of a chunk's code
+ *
+ *  Params:
+ *      cursor:     the cursor to initialize
+ *      chunk:      the chunk whose position table to walk, which must not change while the cursor is used
+ */
+void initPositionCursor(PositionCursor* cursor, const Chunk* chunk) {
+	cursor->table = &chunk->positions;
+	if (cursor->table->entryCount > 0) {
+		startAtCheckpoint(cursor, 0);
+		return;
+	}
+
+	cursor->entry = 0;
+	cursor->current = (PositionEntry){0, {0, 0}};
+	cursor->next = (PositionEntry){INT_MAX, {0, 0}};
+	cursor->byte = 0;
+}
+
+/* Moves a cursor to a byte of code and finds its source position
+ *      Moving to the next instruction decodes at most the entries in between, so walking a chunk in order takes
+ *      constant time per instruction. Moving backwards or far ahead starts over from a checkpoint, like getPosition().
+ *
+ *  Params:
+ *      cursor:     the cursor to move
+ *      offset:     the offset of the byte within the chunk's code
+ *
+ *  Returns:
+ *      The position the byte was compiled from, or line and column 0 if the chunk has no code.
+ */
+SourcePosition seekPosition(PositionCursor* cursor, int offset) {
+	const PositionTable* table = cursor->table;
+	int nextCheckpoint = cursor->entry / POSITION_CHECKPOINT_INTERVAL + 1;
+	if (offset < cursor->current.offset ||
+	    (nextCheckpoint < table->checkpointCount && table->checkpoints[nextCheckpoint].entry.offset <= offset)) {
+		startAtCheckpoint(cursor, findCheckpoint(table, offset));
+	}
+
+	while (cursor->next.offset <= offset) {
+		cursor->current = cursor->next;
+		cursor->entry++;
+		loadNextEntry(cursor);
+	}
+
+	return cursor->current.position;
+}
+
+/* Checks that a position table read from outside, such as a bytecode file, can be decoded safely
+ *
+ *  The entries must decode without running past the end of the table, start at offset 0 and move forward within the
+ *  code, and every checkpoint must match the entry it was taken at.
+ *
+ *  Returns:
+ *      NULL if the table is valid, or else a description of the problem.
+ */
+const char* checkPositions(const Chunk* chunk) {
+	const PositionTable* table = &chunk->positions;
+	if (table->entryCount <= 0 ||
+	    table->checkpointCount != (table->entryCount - 1) / POSITION_CHECKPOINT_INTERVAL + 1) {
+		return "position table does not cover the code";
+	}
+
+	PositionEntry entry = {0, {0, 0}};
+	int byte = 0;
+	for (int index = 0; index < table->entryCount; index++) {
+		int previousOffset = entry.offset;
+		if (!decodeEntry(table, &byte, &entry)) return "position table cut short";
+		if (index == 0 ? entry.offset != 0 : entry.offset <= previousOffset || entry.offset >= chunk->count) {
+			return "position table out of order";
+		}
+
+		if (index % POSITION_CHECKPOINT_INTERVAL == 0) {
+			const PositionCheckpoint* checkpoint = &table->checkpoints[index / POSITION_CHECKPOINT_INTERVAL];
+			if (checkpoint->byte != byte || checkpoint->entry.offset != entry.offset ||
+			    checkpoint->entry.position.line != entry.position.line ||
+			    checkpoint->entry.position.column != entry.position.column) {
+				return "position table checkpoint does not match its entry";
+			}
 		}
 	}
-}
\ No newline at end of file
+
+	if (byte != table->byteCount) return "position table runs past its last entry";
+	return NULL;
+}
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/common.h"
 #include "include/compiler.h"
+#include "include/memory.h"
 #include "include/scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -31,7 +33,51 @@ typedef enum {
 	PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)(); // A function pointer for parsing
+// Where the result of a compiled subexpression lives
+typedef enum {
+	OPERAND_CONSTANT,       // A literal (or folded) value in the constant table
+	OPERAND_STACK,          // Computed onto the VM stack (stack backend)
+	OPERAND_REGISTER        // Computed into a register (register backend)
+} OperandType;
+
+typedef struct {
+	OperandType type;
+	int index;              // Index into the constant table or the register file
+	int offset;             // Where the subexpression's code starts in the chunk
+	bool fresh;             // Whether the constant table entry was added for this operand alone
+} Operand;
+
+/* The compiler's view of the expression tree
+ *
+ *  The Pratt parser visits the tree in postfix order, exactly the order the stack backend emits its instructions in.
+ *  Alongside the code, the compiler keeps the results of the subexpressions on an operand stack at compile time:
+ *      - both backends use it to spot operations whose operands are all constants and fold them at compile time
+ *      - the register backend emits no code for literals at all, they stay constants until an instruction reads
+ *        them, while every computed result is given the lowest free register. Because operands are always consumed
+ *        from the top, registers are freed in the reverse order they were allocated in and a single counter is
+ *        enough to allocate them.
+ */
+typedef struct {
+	Operand* operands;
+	int operandCount;
+	int operandCapacity;
+	int freeRegister;       // The lowest register not held by an operand
+} OperandStack;
+
+/* Everything one compilation works on
+ *
+ *  compile() keeps it on its own stack frame and passes it to every function, so any number of threads can compile
+ *  at once.
+ */
+typedef struct {
+	Parser parser;
+	Scanner* scanner;       // Where the tokens come from, which may still be reading the source
+	Chunk* chunk;           // The chunk being compiled
+	Backend backend;        // The instruction set being compiled to
+	OperandStack operandStack;
+} Compiler;
+
+typedef void (*ParseFn)(Compiler* compiler); // A function pointer for parsing
 
 typedef struct {
 	ParseFn prefix;
@@ -39,22 +85,22 @@ typedef struct {
 	Precedence precedence;
 } ParseRule;
 
-Parser parser;
-Chunk* compilingChunk;
-
 /* Returns the current chunk being compiled
  *
  */
-static Chunk* currentChunk() {
-	return compilingChunk;
+static Chunk* currentChunk(Compiler* compiler) {
+	return compiler->chunk;
 }
 
 /* Prints information about the error, given the token and a message corresponding to the error type
  *
  */
-static void errorAt(Token* token, const char* message) {
-	if (parser.panicMode) return;
-	parser.panicMode = true;
+static void errorAt(Compiler* compiler, Token* token, const char* message) {
+	if (compiler->parser.panicMode) return;
+	compiler->parser.panicMode = true;
+
+	// Keeps the message in one piece when several threads compile at once
+	flockfile(stderr);
 	fprintf(stderr, "[line %d] Error", token->line);
 
 	if (token->type == TOKEN_EOF) {
@@ -66,7 +112,8 @@ static void errorAt(Token* token, const char* message) {
 	}
 
 	fprintf(stderr, ": %s\n", message);
-	parser.hadError = true;
+	funlockfile(stderr);
+	compiler->parser.hadError = true;
 }
 
 /* Indicates that there was an error
@@ -74,15 +121,15 @@ static void errorAt(Token* token, const char* message) {
  *  Params:
  *      message:        a string that indicates that the error is
  */
-static void error(const char* message) {
-	errorAt(&parser.previous, message);
+static void error(Compiler* compiler, const char* message) {
+	errorAt(compiler, &compiler->parser.previous, message);
 }
 
 /* Indicates the error occurred at the current token, calls errorAt()
  *
  */
-static void errorAtCurrent(const char* message) {
-	errorAt(&parser.current, message);
+static void errorAtCurrent(Compiler* compiler, const char* message) {
+	errorAt(compiler, &compiler->parser.current, message);
 }
 
 /* Scans the next token
@@ -90,14 +137,14 @@ static void errorAtCurrent(const char* message) {
  *  Returns:
  *      Prints an error if a TOKEN_ERROR is encountered (by calling errorAtCurrent()).
  */
-static void advance() {
-	parser.previous = parser.current;
+static void advance(Compiler* compiler) {
+	compiler->parser.previous = compiler->parser.current;
 
 	for (;;) {
-		parser.current = scanToken();
-		if (parser.current.type != TOKEN_ERROR) break;
+		compiler->parser.current = scanToken(compiler->scanner);
+		if (compiler->parser.current.type != TOKEN_ERROR) break;
 
-		errorAtCurrent(parser.current.start);
+		errorAtCurrent(compiler, compiler->parser.current.start);
 	}
 }
 
@@ -106,13 +153,13 @@ static void advance() {
  *  Returns:
  *      Reports an error if the token type does not match what it expected
  */
-static void consume(TokenType type, const char* message) {
-	if (parser.current.type == type) {
-		advance();
+static void consume(Compiler* compiler, TokenType type, const char* message) {
+	if (compiler->parser.current.type == type) {
+		advance(compiler);
 		return;
 	}
 
-	errorAtCurrent(message);
+	errorAtCurrent(compiler, message);
 }
 
 /* Writes a byte to the current chunk
@@ -120,76 +167,291 @@ static void consume(TokenType type, const char* message) {
  *  Params:
  *      byte:       the byte to be written to the current chunk (could be opcode or operand)
  */
-static void emitByte(uint8_t byte) {
-	writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Compiler* compiler, uint8_t byte) {
+	writeChunk(currentChunk(compiler), byte, compiler->parser.previous.line, compiler->parser.previous.column);
 }
 
 /* A convenience function to emit two bytes
  *
  */
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-	emitByte(byte1);
-	emitByte(byte2);
+static void emitBytes(Compiler* compiler, uint8_t byte1, uint8_t byte2) {
+	emitByte(compiler, byte1);
+	emitByte(compiler, byte2);
+}
+
+/* Writes a four byte register-based instruction to the current chunk
+ *
+ */
+static void emitRegisterInstruction(Compiler* compiler, RegisterOpCode op, uint8_t a, uint8_t b, uint8_t c) {
+	emitBytes(compiler, op, a);
+	emitBytes(compiler, b, c);
+}
+
+/* Adds an operand to the top of the operand stack
+ *
+ *  Params:
+ *      type:       where the operand's value lives
+ *      index:      the operand's constant table index or register
+ *      offset:     where the code of the operand's subexpression starts
+ */
+static void pushOperand(Compiler* compiler, OperandType type, int index, int offset) {
+	if (compiler->operandStack.operandCapacity < compiler->operandStack.operandCount + 1) {
+		int oldCapacity = compiler->operandStack.operandCapacity;
+		compiler->operandStack.operandCapacity = GROW_CAPACITY(oldCapacity);
+		compiler->operandStack.operands = GROW_ARRAY(compiler->chunk->allocator, Operand, compiler->operandStack.operands, oldCapacity, compiler->operandStack.operandCapacity);
+	}
+
+	Operand* operand = &compiler->operandStack.operands[compiler->operandStack.operandCount++];
+	operand->type = type;
+	operand->index = index;
+	operand->offset = offset;
+	operand->fresh = false;
+}
+
+/* Removes the operand on top of the operand stack
+ *
+ *  Returns:
+ *      The removed operand, or a computed placeholder if an earlier error left the stack empty.
+ */
+static Operand popOperand(Compiler* compiler) {
+	if (compiler->operandStack.operandCount == 0) {
+		Operand placeholder = {OPERAND_STACK, 0, currentChunk(compiler)->count, false};
+		return placeholder;
+	}
+
+	return compiler->operandStack.operands[--compiler->operandStack.operandCount];
+}
+
+/* Claims the lowest free register
+ *
+ *  Returns:
+ *      The index of the claimed register.
+ */
+static uint8_t allocateRegister(Compiler* compiler) {
+	if (compiler->operandStack.freeRegister == REGISTER_MAX) {
+		error(compiler, "Expression too complex.");
+		return 0;
+	}
+
+	return (uint8_t)compiler->operandStack.freeRegister++;
+}
+
+/* Converts an operand into an RK operand, loading constants that do not fit into a fresh register
+ *
+ *  Returns:
+ *      The RK encoding of the operand.
+ */
+static uint8_t operandToRK(Compiler* compiler, Operand* operand) {
+	if (operand->type == OPERAND_REGISTER) return (uint8_t)operand->index;
+	if (operand->index < REGISTER_MAX) return (uint8_t)(RK_CONSTANT + operand->index);
+
+	uint8_t reg = allocateRegister(compiler);
+	emitRegisterInstruction(compiler, ROP_LOAD_CONSTANT, reg, (uint8_t)(operand->index & 0xff),
+	                        (uint8_t)((operand->index >> 8) & 0xff));
+	return reg;
+}
+
+/* Counts how many of the given operands hold registers, which are always the most recently allocated ones
+ *
+ */
+static int heldRegisters(Operand* operands, int count) {
+	int held = 0;
+	for (int index = 0; index < count; index++) {
+		if (operands[index].type == OPERAND_REGISTER) held++;
+	}
+
+	return held;
+}
+
+/* Emits a register-based instruction for an arithmetic operation, then pushes the register holding the result
+ *
+ *  Params:
+ *      op:         the stack-based opcode of the operation (OP_ADD, OP_NEGATE, ...)
+ *      arity:      how many operands the operation consumes (1 or 2)
+ *      operands:   the operands, already popped from the operand stack
+ */
+static void registerOperation(Compiler* compiler, OpCode op, int arity, Operand* operands) {
+	int offset = operands[0].type == OPERAND_CONSTANT ? currentChunk(compiler)->count : operands[0].offset;
+
+	// The operands' registers are released only after the instruction is emitted, so loading a constant can't
+	// overwrite one of them
+	int base = compiler->operandStack.freeRegister - heldRegisters(operands, arity);
+	uint8_t b = operandToRK(compiler, &operands[0]);
+	uint8_t c = arity == 2 ? operandToRK(compiler, &operands[1]) : 0;
+
+	compiler->operandStack.freeRegister = base;
+	uint8_t a = allocateRegister(compiler);
+
+	RegisterOpCode registerOp;
+	switch (op) {
+		case OP_ADD:        registerOp = ROP_ADD; break;
+		case OP_SUBTRACT:   registerOp = ROP_SUBTRACT; break;
+		case OP_MULTIPLY:   registerOp = ROP_MULTIPLY; break;
+		case OP_DIVIDE:     registerOp = ROP_DIVIDE; break;
+		default:            registerOp = ROP_NEGATE; break;
+	}
+
+	emitRegisterInstruction(compiler, registerOp, a, b, c);
+	pushOperand(compiler, OPERAND_REGISTER, a, offset);
 }
 
 /*  Emits a return instruction to the end of the chunk
  *
  */
-static void emitReturn() {
-	emitByte(OP_RETURN);
+static void emitReturn(Compiler* compiler) {
+	Operand result = popOperand(compiler);
+	if (compiler->backend == BACKEND_REGISTER) {
+		emitRegisterInstruction(compiler, ROP_RETURN, 0, operandToRK(compiler, &result), 0);
+	} else {
+		emitByte(compiler, OP_RETURN);
+	}
 }
 
 /* Adds a constant to the current chunk, reports an error if there are too many constants in the chunk
+ *
+ *  Params:
+ *      max:        the largest constant index the instruction using the constant can encode
  *
  *  Returns:
- *      A Value constant.
+ *      The index of the constant.
  */
-static uint8_t makeConstant(Value value) {
-	int constant = addConstant(currentChunk(), value);
-	if (constant > UINT8_MAX) {
-		error("Too many constants in one chunk.");
+static int makeConstant(Compiler* compiler, Value value, int max) {
+	int constant = addConstant(currentChunk(compiler), value);
+	if (constant > max) {
+		error(compiler, "Too many constants in one chunk.");
 		return 0;
 	}
 
-	return (uint8_t)constant;
+	return constant;
 }
 
 /* Compiles a constant value
  *
+ *  The stack backend pushes it right away, the register backend keeps it as an operand until an instruction uses it.
+ *  Repeated values share one constant table entry (see addConstant()).
+ */
+static void emitConstant(Compiler* compiler, Value value) {
+	Chunk* chunk = currentChunk(compiler);
+	int offset = chunk->count;
+	int constantCount = chunk->constants.count;
+	int constant;
+
+	if (compiler->backend == BACKEND_REGISTER) {
+		constant = makeConstant(compiler, value, UINT16_MAX);
+	} else {
+		// Indexes past a byte take the three byte operand of OP_CONSTANT_LONG
+		constant = makeConstant(compiler, value, CONSTANT_LONG_MAX);
+		if (constant <= UINT8_MAX) {
+			emitBytes(compiler, OP_CONSTANT, (uint8_t)constant);
+		} else {
+			emitBytes(compiler, OP_CONSTANT_LONG, (uint8_t)(constant & 0xff));
+			emitBytes(compiler, (uint8_t)((constant >> 8) & 0xff), (uint8_t)((constant >> 16) & 0xff));
+		}
+	}
+
+	pushOperand(compiler, OPERAND_CONSTANT, constant, offset);
+	compiler->operandStack.operands[compiler->operandStack.operandCount - 1].fresh = chunk->constants.count > constantCount;
+}
+
+/* Evaluates an arithmetic operation on constant operands at compile time
+ *
+ *  The operation is done with the same C arithmetic on doubles as run(), so division by zero, NaN and signed zeros
+ *  behave exactly as they would at runtime. Operations that would fail at runtime are left for the VM to report.
+ *
+ *  Params:
+ *      op:         the stack-based opcode of the operation (OP_ADD, OP_NEGATE, ...)
+ *      arity:      how many operands the operation consumes (1 or 2)
+ *      operands:   the operands, already popped from the operand stack
+ *
+ *  Returns:
+ *      True if the operation was folded into a single constant, false if code still has to be emitted for it.
  */
-static void emitConstant(Value value) {
-	emitBytes(OP_CONSTANT, makeConstant(value));
+static bool foldOperation(Compiler* compiler, OpCode op, int arity, Operand* operands) {
+	Chunk* chunk = currentChunk(compiler);
+	for (int index = 0; index < arity; index++) {
+		if (operands[index].type != OPERAND_CONSTANT) return false;
+		if (!IS_NUMBER(chunk->constants.values[operands[index].index])) return false;
+	}
+
+	double a = AS_NUMBER(chunk->constants.values[operands[0].index]);
+	double b = arity == 2 ? AS_NUMBER(chunk->constants.values[operands[1].index]) : 0;
+	double result;
+	switch (op) {
+		case OP_ADD:        result = a + b; break;
+		case OP_SUBTRACT:   result = a - b; break;
+		case OP_MULTIPLY:   result = a * b; break;
+		case OP_DIVIDE:     result = a / b; break;
+		case OP_NEGATE:     result = -a; break;
+		default:            return false;
+	}
+
+	// Drop the operands' code, and their constants when nothing else uses them
+	truncateCode(chunk, operands[0].offset);
+	for (int index = arity - 1; index >= 0; index--) {
+		if (operands[index].fresh && operands[index].index == chunk->constants.count - 1) {
+			truncateConstants(chunk, operands[index].index);
+		}
+	}
+
+	emitConstant(compiler, NUMBER_VAL(result));
+	return true;
+}
+
+/* Emits an arithmetic operation for the backend being compiled to, folding it if its operands are constants
+ *
+ *  Params:
+ *      op:         the stack-based opcode of the operation (OP_ADD, OP_NEGATE, ...)
+ *      arity:      how many operands the operation consumes (1 or 2)
+ */
+static void emitOperation(Compiler* compiler, OpCode op, int arity) {
+	Operand operands[2];
+	for (int index = arity - 1; index >= 0; index--) {
+		operands[index] = popOperand(compiler);
+	}
+
+	if (foldOperation(compiler, op, arity, operands)) return;
+
+	if (compiler->backend == BACKEND_REGISTER) {
+		registerOperation(compiler, op, arity, operands);
+	} else {
+		emitByte(compiler, op);
+		pushOperand(compiler, OPERAND_STACK, 0, operands[0].offset);
+	}
 }
 
 /* Signals the end of compilation
  *
  */
-static void endCompiler() {
-	emitReturn();
+static void endCompiler(Compiler* compiler) {
+	emitReturn(compiler);
 #ifdef DEBUG_PRINT_CODE
-	if (!parser.hadError) {
-		disassembleChunk(currentChunk(), "code");
+	if (!compiler->parser.hadError) {
+		if (compiler->backend == BACKEND_REGISTER) {
+			disassembleRegisterChunk(currentChunk(compiler), "code");
+		} else {
+			disassembleChunk(currentChunk(compiler), "code");
+		}
 	}
 #endif
 }
 
-static void expression();
-static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void expression(Compiler* compiler);
+static const ParseRule* getRule(TokenType type);
+static void parsePrecedence(Compiler* compiler, Precedence precedence);
 
 /* Compiles a binary expression
  *
  */
-static void binary() {
-	TokenType operatorType = parser.previous.type;
-	ParseRule* rule = getRule(operatorType);
-	parsePrecedence((Precedence)(rule->precedence + 1));
+static void binary(Compiler* compiler) {
+	TokenType operatorType = compiler->parser.previous.type;
+	const ParseRule* rule = getRule(operatorType);
+	parsePrecedence(compiler, (Precedence)(rule->precedence + 1));
 
 	switch (operatorType) {
-		case TOKEN_PLUS:        emitByte(OP_ADD); break;
-		case TOKEN_MINUS:       emitByte(OP_SUBTRACT); break;
-		case TOKEN_STAR:        emitByte(OP_MULTIPLY); break;
-		case TOKEN_SLASH:       emitByte(OP_DIVIDE); break;
+		case TOKEN_PLUS:        emitOperation(compiler, OP_ADD, 2); break;
+		case TOKEN_MINUS:       emitOperation(compiler, OP_SUBTRACT, 2); break;
+		case TOKEN_STAR:        emitOperation(compiler, OP_MULTIPLY, 2); break;
+		case TOKEN_SLASH:       emitOperation(compiler, OP_DIVIDE, 2); break;
 		default: return;
 	}
 }
@@ -197,36 +459,46 @@ static void binary() {
 /* Compiles a group of parentheses
  *
  */
-static void grouping() {
-	expression();
-	consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Compiler* compiler) {
+	expression(compiler);
+	consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
 /* Compiles a number literal
  *
  */
-static void number() {
-	double value = strtod(parser.previous.start, NULL);
-	emitConstant(NUMBER_VAL(value));
+static void number(Compiler* compiler) {
+	// The token isn't followed by a terminator (the source may be mapped), so strtod() reads a copy of it, on the
+	// stack unless it is too long, and then from the chunk's allocator so that the VM's tracker counts it
+	Token* token = &compiler->parser.previous;
+	const Allocator* allocator = compiler->chunk->allocator;
+	char digits[64];
+	char* text = token->length < (int)sizeof(digits) ? digits : GROW_ARRAY(allocator, char, NULL, 0, token->length + 1);
+	memcpy(text, token->start, (size_t)token->length);
+	text[token->length] = '\0';
+
+	double value = strtod(text, NULL);
+	if (text != digits) FREE_ARRAY(allocator, char, text, token->length + 1);
+	emitConstant(compiler, NUMBER_VAL(value));
 }
 
 /* Compiles a unary operator
  *
  */
-static void unary() {
-	TokenType operatorType = parser.previous.type;
+static void unary(Compiler* compiler) {
+	TokenType operatorType = compiler->parser.previous.type;
 
 	// Compile operand
-	parsePrecedence(PREC_UNARY);
+	parsePrecedence(compiler, PREC_UNARY);
 
 	// Emit operator instruction
 	switch(operatorType) {
-		case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+		case TOKEN_MINUS: emitOperation(compiler, OP_NEGATE, 1); break;
 		default: return;
 	}
 }
 
-ParseRule rules[] = {
+static const ParseRule rules[] = {
 		[TOKEN_LEFT_PAREN]    = {grouping,  NULL,   PREC_NONE},
 		[TOKEN_RIGHT_PAREN]   = {NULL,NULL,   PREC_NONE},
 		[TOKEN_LEFT_BRACE]    = {NULL,NULL,   PREC_NONE},
@@ -272,20 +544,20 @@ ParseRule rules[] = {
 /* Orchestrates the usage of the define parsing functions
  *
  */
-static void parsePrecedence(Precedence precedence) {
-	advance();
-	ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+static void parsePrecedence(Compiler* compiler, Precedence precedence) {
+	advance(compiler);
+	ParseFn prefixRule = getRule(compiler->parser.previous.type)->prefix;
 	if (prefixRule == NULL) {
-		error("Expect expression.");
+		error(compiler, "Expect expression.");
 		return;
 	}
 
-	prefixRule();
+	prefixRule(compiler);
 
-	while (precedence <= getRule(parser.current.type)->precedence) {
-		advance();
-		ParseFn infixRule = getRule(parser.previous.type)->infix;
-		infixRule();
+	while (precedence <= getRule(compiler->parser.current.type)->precedence) {
+		advance(compiler);
+		ParseFn infixRule = getRule(compiler->parser.previous.type)->infix;
+		infixRule(compiler);
 	}
 }
 
@@ -294,37 +566,39 @@ static void parsePrecedence(Precedence precedence) {
  *  Returns:
  *      A pointer to the parsing rule associated with given token type.
  */
-static ParseRule* getRule(TokenType type) {
+static const ParseRule* getRule(TokenType type) {
 	return &rules[type];
 }
 
 /* Compiles expressions
  *
  */
-static void expression() {
-	parsePrecedence(PREC_ASSIGNMENT);
+static void expression(Compiler* compiler) {
+	parsePrecedence(compiler, PREC_ASSIGNMENT);
 }
 
 /* Compiles the code from the given source
  *
  *  Params:
- *      source:     file containing the code
+ *      scanner:    a scanner initialized on the source containing the code
  *      chunk:      where to store the corresponding bytecode
+ *      backend:    which instruction set to compile to
  *
  *  Returns:
  *      True if there was no error, false otherwise (indicates a compilation error).
  */
-bool compile(const char* source, Chunk* chunk) {
-	initScanner(source);
-	compilingChunk = chunk;
-
-	parser.hadError = false;
-	parser.panicMode = false;
-
-	advance();
-	expression();
-	consume(TOKEN_EOF, "Expect end of expression.");
-
-	endCompiler();
-	return !parser.hadError;
-}
\ No newline at end of file
+bool compile(Scanner* scanner, Chunk* chunk, Backend backend) {
+	// Zeroed as a whole, parser tokens included: advance() copies the current token before the first one is read
+	Compiler compiler = {0};
+	compiler.scanner = scanner;
+	compiler.chunk = chunk;
+	compiler.backend = backend;
+
+	advance(&compiler);
+	expression(&compiler);
+	consume(&compiler, TOKEN_EOF, "Expect end of expression.");
+
+	endCompiler(&compiler);
+	FREE_ARRAY(chunk->allocator, Operand, compiler.operandStack.operands, compiler.operandStack.operandCapacity);
+	return !compiler.parser.hadError;
+}
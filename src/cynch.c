@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/cynch.h"
+#include "include/bytecode.h"
+#include "include/vm.h"
+
+struct CynchVM {
+	VM vm;
+	Allocator allocator;        // Where the CynchVM itself was allocated
+};
+
+/* A compiled program, either compiled from source or mapped from a bytecode file
+ *
+ *  Nothing writes to a program's chunk after it is built, which is what lets VMs share it: the VM doesn't quicken it.
+ */
+struct CynchProgram {
+	Backend backend;
+	bool mapped;                // Whether the chunk lives in file's mapping rather than on the heap
+	bool jitted;                // Whether jit holds the chunk compiled to machine code
+	BytecodeFile file;
+	Chunk chunk;
+	JitCode jit;
+};
+
+/* Creates a VM for executing programs, with its memory on the heap
+ *
+ *  Returns:
+ *      The VM, or NULL if there is not enough memory for it or its stack.
+ */
+CynchVM* cynchNewVM(void) {
+	return cynchNewVMWithAllocator(NULL);
+}
+
+/* Creates a VM for executing programs, with its memory from the host
+ *
+ *  Params:
+ *      allocator:  the allocator, copied into the VM, or NULL for the heap
+ *
+ *  Returns:
+ *      The VM, or NULL if the allocator couldn't allocate it or its stack couldn't be mapped.
+ */
+CynchVM* cynchNewVMWithAllocator(const CynchAllocator* allocator) {
+	Allocator parent = heapAllocator;
+	if (allocator != NULL) parent = (Allocator){allocator->reallocate, allocator->userData};
+
+	CynchVM* vm = parent.reallocate(parent.state, NULL, 0, sizeof(CynchVM));
+	if (vm == NULL) return NULL;
+
+	vm->allocator = parent;
+	if (!initVM(&vm->vm)) {
+		parent.reallocate(parent.state, vm, sizeof(CynchVM), 0);
+		return NULL;
+	}
+	setAllocator(&vm->vm, &parent);
+	setOutput(&vm->vm, NULL);
+	return vm;
+}
+
+/* Frees a VM, which must not be executing a program
+ *
+ */
+void cynchFreeVM(CynchVM* vm) {
+	if (vm == NULL) return;
+
+	freeVM(&vm->vm);
+	vm->allocator.reallocate(vm->allocator.state, vm, sizeof(CynchVM), 0);
+}
+
+/* Caps the memory a VM may have allocated at once
+ *
+ *  Params:
+ *      limit:      the most bytes the VM may hold, 0 for no limit
+ */
+void cynchSetMemoryLimit(CynchVM* vm, size_t limit) {
+	setMemoryLimit(&vm->vm, limit);
+}
+
+/* Reports what a VM has allocated so far
+ *
+ */
+CynchMemoryStats cynchGetMemoryStats(const CynchVM* vm) {
+	const MemoryStats* stats = &vm->vm.memory.stats;
+	return (CynchMemoryStats){stats->liveBytes, stats->peakBytes, stats->allocations};
+}
+
+/* Compiles source code into a program
+ *
+ *  Params:
+ *      source:     the source code
+ *      options:    the backend to compile to and whether to optimize, or NULL for the defaults
+ *
+ *  Returns:
+ *      The program, or NULL if the source doesn't compile (the errors are printed to stderr).
+ */
+CynchProgram* cynchCompile(const char* source, const CynchOptions* options) {
+	CynchOptions defaults = {CYNCH_BACKEND_STACK, true, false};
+	if (options == NULL) options = &defaults;
+
+	CynchProgram* program = malloc(sizeof(CynchProgram));
+	if (program == NULL) return NULL;
+
+	program->backend = options->backend == CYNCH_BACKEND_REGISTER ? BACKEND_REGISTER : BACKEND_STACK;
+	program->mapped = false;
+	program->jitted = false;
+	initChunk(&program->chunk);
+
+	Scanner scanner;
+	initScanner(&scanner, source, strlen(source));
+	if (!buildChunk(&scanner, &program->chunk, program->backend, options->optimize, false)) {
+		free(program);
+		return NULL;
+	}
+	program->chunk.quicken = false;
+
+	// The chunk stays where it is for as long as the program lives, so its machine code can be kept alongside it
+	if (options->jit && program->backend == BACKEND_STACK) {
+		program->jitted = compileJit(&program->chunk, false, &program->jit);
+	}
+
+	return program;
+}
+
+/* Loads a program from a bytecode file written by cynch --compile-only
+ *
+ *  Returns:
+ *      The program, or NULL if the file can't be loaded (the error is printed to stderr).
+ */
+CynchProgram* cynchLoadProgram(const char* path) {
+	CynchProgram* program = malloc(sizeof(CynchProgram));
+	if (program == NULL) return NULL;
+
+	if (!loadBytecode(path, &program->file)) {
+		free(program);
+		return NULL;
+	}
+
+	program->backend = BACKEND_STACK;
+	program->mapped = true;
+	program->jitted = false;
+	return program;
+}
+
+/* Converts a value into the host's representation
+ *
+ */
+static CynchValue toCynchValue(Value value) {
+	CynchValue converted;
+	if (IS_BOOL(value)) {
+		converted.type = CYNCH_BOOL;
+		converted.as.boolean = AS_BOOL(value);
+	} else if (IS_NUMBER(value)) {
+		converted.type = CYNCH_NUMBER;
+		converted.as.number = AS_NUMBER(value);
+	} else {
+		converted.type = CYNCH_NIL;
+		converted.as.number = 0;
+	}
+
+	return converted;
+}
+
+/* Executes a program on a VM
+ *
+ *  Params:
+ *      vm:         the VM to execute on, switched to the program's backend
+ *      program:    the program, which may be executing on other VMs at the same time
+ *      result:     where to store the value the program returns, or NULL
+ *
+ *  Returns:
+ *      CYNCH_OK, or CYNCH_RUNTIME_ERROR if the program failed (the error is printed to stderr).
+ */
+CynchStatus cynchExecute(CynchVM* vm, const CynchProgram* program, CynchValue* result) {
+	setBackend(&vm->vm, program->backend);
+
+	// interpretChunk() only reads the chunk
+	Chunk* chunk = program->mapped ? (Chunk*)&program->file.chunk : (Chunk*)&program->chunk;
+	const JitCode* jit = program->jitted ? &program->jit : NULL;
+	if (interpretJitChunk(&vm->vm, chunk, jit) != INTERPRET_OK) return CYNCH_RUNTIME_ERROR;
+
+	if (result != NULL) *result = toCynchValue(vm->vm.result);
+	return CYNCH_OK;
+}
+
+/* Compiles and runs source code on a VM in one go, with the VM's memory and backend
+ *
+ *  Params:
+ *      vm:         the VM to evaluate on
+ *      source:     the source code
+ *      result:     where to store the value the source returns, or NULL
+ *
+ *  Returns:
+ *      CYNCH_OK, CYNCH_COMPILE_ERROR if the source doesn't compile, or CYNCH_RUNTIME_ERROR if it failed or ran out
+ *      of memory (the errors are printed to stderr).
+ */
+CynchStatus cynchEvaluate(CynchVM* vm, const char* source, CynchValue* result) {
+	switch (interpret(&vm->vm, source)) {
+		case INTERPRET_OK:
+			break;
+		case INTERPRET_COMPILE_ERROR:
+			return CYNCH_COMPILE_ERROR;
+		default:
+			return CYNCH_RUNTIME_ERROR;
+	}
+
+	if (result != NULL) *result = toCynchValue(vm->vm.result);
+	return CYNCH_OK;
+}
+
+/* Frees a program, which must not be executing on any VM
+ *
+ */
+void cynchReleaseProgram(CynchProgram* program) {
+	if (program == NULL) return;
+
+	if (program->jitted) freeJit(&program->jit);
+	if (program->mapped) {
+		unloadBytecode(&program->file);
+	} else {
+		freeChunk(&program->chunk);
+	}
+	free(program);
+}
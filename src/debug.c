@@ -3,6 +3,13 @@
 #include "include/debug.h"
 #include "include/value.h"
 
+static void printLocation(PositionCursor* positions, int offset);
+static int superinstruction(const char* name, Chunk* chunk, int offset, uint8_t first, uint8_t second);
+static void printRK(Chunk* chunk, uint8_t operand);
+static int registerInstruction(const char* name, Chunk* chunk, int offset, int arity);
+static int loadConstantInstruction(const char* name, Chunk* chunk, int offset);
+static int returnInstruction(const char* name, Chunk* chunk, int offset);
+
 /* Disassembles all of the instructions in a chunk for debugging purposes
  *
  *  Params:
@@ -13,8 +20,10 @@ void disassembleChunk(Chunk* chunk, const char* name) {
 	printf("== %s ==\n", name); // Print a header for the current chunk
 
 	// Disassemble each instruction within the chunk
+	PositionCursor positions;
+	initPositionCursor(&positions, chunk);
 	for (int offset = 0; offset < chunk->count;) {
-		offset = disassembleInstruction(chunk, offset);
+		offset = disassembleInstruction(chunk, &positions, offset);
 	}
 }
 
@@ -22,20 +31,14 @@ void disassembleChunk(Chunk* chunk, const char* name) {
  *
  *  Params:
  *      chunk:      the chunk containing the instruction to disassemble
+ *      positions:  a cursor over the chunk's positions, moved to the instruction
  *      offset:     the offset of the current instruction
  *
  *  Returns:
  *      int:        the offset value of the next instruction
  */
-int disassembleInstruction(Chunk* chunk, int offset) {
-	printf("%04d ", offset); // Prints the byte offset of the current instruction
-
-	int line = getLine(chunk, offset);
-	if (offset > 0 && line == getLine(chunk, offset - 1)) {
-		printf("   | "); // Instructions from the same line are shown using this print statement
-	} else {
-		printf("%4d ", line);
-	}
+int disassembleInstruction(Chunk* chunk, PositionCursor* positions, int offset) {
+	printLocation(positions, offset);
 
 	// Read a single byte at the given offset
 	uint8_t instruction = chunk->code[offset];
@@ -58,12 +61,200 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 			return simpleInstruction("OP_NEGATE", offset);
 		case OP_RETURN:
 			return simpleInstruction("OP_RETURN", offset);
+
+#define SUPERINSTRUCTION_CASE(first, second) \
+		case OP_##first##_##second: \
+			return superinstruction("OP_" #first "_" #second, chunk, offset, OP_##first, OP_##second);
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_CASE)
+#undef SUPERINSTRUCTION_CASE
+
+#define QUICKENED_CASE(op) \
+		case OP_##op##_NUMBERS: \
+			return simpleInstruction("OP_" #op "_NUMBERS", offset);
+		QUICKENED_INSTRUCTIONS(QUICKENED_CASE)
+#undef QUICKENED_CASE
+
 		default:
 			printf("Unknown opcode %d\n", instruction);
 			return offset + 1;
 	}
 }
 
+/* Disassembles all of the register-based instructions in a chunk for debugging purposes
+ *
+ *  Params:
+ *      chunk:      the chunk to disassemble
+ *      name:       the name of the chunk
+ */
+void disassembleRegisterChunk(Chunk* chunk, const char* name) {
+	printf("== %s ==\n", name);
+
+	PositionCursor positions;
+	initPositionCursor(&positions, chunk);
+	for (int offset = 0; offset < chunk->count;) {
+		offset = disassembleRegisterInstruction(chunk, &positions, offset);
+	}
+}
+
+/* Disassembles an individual register-based instruction
+ *
+ *  Params:
+ *      chunk:      the chunk containing the instruction to disassemble
+ *      positions:  a cursor over the chunk's positions, moved to the instruction
+ *      offset:     the offset of the current instruction
+ *
+ *  Returns:
+ *      int:        the offset value of the next instruction
+ */
+int disassembleRegisterInstruction(Chunk* chunk, PositionCursor* positions, int offset) {
+	printLocation(positions, offset);
+
+	uint8_t instruction = chunk->code[offset];
+	switch (instruction) {
+		case ROP_LOAD_CONSTANT:
+			return loadConstantInstruction("ROP_LOAD_CONSTANT", chunk, offset);
+		case ROP_ADD:
+			return registerInstruction("ROP_ADD", chunk, offset, 2);
+		case ROP_SUBTRACT:
+			return registerInstruction("ROP_SUBTRACT", chunk, offset, 2);
+		case ROP_MULTIPLY:
+			return registerInstruction("ROP_MULTIPLY", chunk, offset, 2);
+		case ROP_DIVIDE:
+			return registerInstruction("ROP_DIVIDE", chunk, offset, 2);
+		case ROP_NEGATE:
+			return registerInstruction("ROP_NEGATE", chunk, offset, 1);
+		case ROP_RETURN:
+			return returnInstruction("ROP_RETURN", chunk, offset);
+		default:
+			printf("Unknown opcode %d\n", instruction);
+			return offset + REGISTER_INSTRUCTION_SIZE;
+	}
+}
+
+/* Gets the name of a stack-based opcode
+ *
+ *  Returns:
+ *      The opcode's name (ex. OP_ADD), or "OP_UNKNOWN" for bytes that are not opcodes.
+ */
+const char* opcodeName(uint8_t instruction) {
+	switch (instruction) {
+		case OP_CONSTANT:       return "OP_CONSTANT";
+		case OP_CONSTANT_LONG:  return "OP_CONSTANT_LONG";
+		case OP_NIL:            return "OP_NIL";
+		case OP_TRUE:           return "OP_TRUE";
+		case OP_FALSE:          return "OP_FALSE";
+		case OP_ADD:            return "OP_ADD";
+		case OP_SUBTRACT:       return "OP_SUBTRACT";
+		case OP_MULTIPLY:       return "OP_MULTIPLY";
+		case OP_DIVIDE:         return "OP_DIVIDE";
+		case OP_NEGATE:         return "OP_NEGATE";
+		case OP_RETURN:         return "OP_RETURN";
+
+#define SUPERINSTRUCTION_NAME(first, second) case OP_##first##_##second: return "OP_" #first "_" #second;
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_NAME)
+#undef SUPERINSTRUCTION_NAME
+#define QUICKENED_NAME(op) case OP_##op##_NUMBERS: return "OP_" #op "_NUMBERS";
+		QUICKENED_INSTRUCTIONS(QUICKENED_NAME)
+#undef QUICKENED_NAME
+
+		default:                return "OP_UNKNOWN";
+	}
+}
+
+/* Gets the name of a register-based opcode
+ *
+ *  Returns:
+ *      The opcode's name (ex. ROP_ADD), or "ROP_UNKNOWN" for bytes that are not opcodes.
+ */
+const char* registerOpcodeName(uint8_t instruction) {
+	switch (instruction) {
+		case ROP_LOAD_CONSTANT: return "ROP_LOAD_CONSTANT";
+		case ROP_ADD:           return "ROP_ADD";
+		case ROP_SUBTRACT:      return "ROP_SUBTRACT";
+		case ROP_MULTIPLY:      return "ROP_MULTIPLY";
+		case ROP_DIVIDE:        return "ROP_DIVIDE";
+		case ROP_NEGATE:        return "ROP_NEGATE";
+		case ROP_RETURN:        return "ROP_RETURN";
+		default:                return "ROP_UNKNOWN";
+	}
+}
+
+/* Prints the byte offset and source position of an instruction
+ *
+ *  Params:
+ *      positions:  a cursor over the positions of the chunk containing the instruction
+ *      offset:     the offset of the instruction
+ */
+static void printLocation(PositionCursor* positions, int offset) {
+	printf("%04d ", offset); // Prints the byte offset of the current instruction
+
+	// The cursor only moves forward over the previous instruction's last byte and this one
+	int previousLine = offset > 0 ? seekPosition(positions, offset - 1).line : -1;
+	SourcePosition position = seekPosition(positions, offset);
+	if (position.line == previousLine) {
+		printf("   |:%-3d ", position.column); // Instructions from the same line are shown using this print statement
+	} else {
+		printf("%4d:%-3d ", position.line, position.column);
+	}
+}
+
+/* Prints an RK operand: either a register (r0) or a constant with its value (k0 '1')
+ *
+ */
+static void printRK(Chunk* chunk, uint8_t operand) {
+	if (operand < RK_CONSTANT) {
+		printf(" r%d", operand);
+		return;
+	}
+
+	printf(" k%d '", operand - RK_CONSTANT);
+	printValue(chunk->constants.values[operand - RK_CONSTANT]);
+	printf("'");
+}
+
+/* Prints a register-based arithmetic instruction
+ *
+ *  Params:
+ *      name:       the name of the instruction (ex. ROP_ADD)
+ *      chunk:      the chunk containing the instruction
+ *      offset:     the offset of the current instruction
+ *      arity:      how many RK operands the instruction reads
+ *
+ *  Returns:
+ *      int:        the offset value of the next instruction
+ */
+static int registerInstruction(const char* name, Chunk* chunk, int offset, int arity) {
+	printf("%-17s r%d <-", name, chunk->code[offset + 1]);
+	printRK(chunk, chunk->code[offset + 2]);
+	if (arity == 2) printRK(chunk, chunk->code[offset + 3]);
+	printf("\n");
+
+	return offset + REGISTER_INSTRUCTION_SIZE;
+}
+
+/* Prints a register-based instruction that loads a constant into a register
+ *
+ */
+static int loadConstantInstruction(const char* name, Chunk* chunk, int offset) {
+	int constant = chunk->code[offset + 2] | (chunk->code[offset + 3] << 8);
+	printf("%-17s r%d <- k%d '", name, chunk->code[offset + 1], constant);
+	printValue(chunk->constants.values[constant]);
+	printf("'\n");
+
+	return offset + REGISTER_INSTRUCTION_SIZE;
+}
+
+/* Prints a register-based return instruction
+ *
+ */
+static int returnInstruction(const char* name, Chunk* chunk, int offset) {
+	printf("%-17s", name);
+	printRK(chunk, chunk->code[offset + 2]);
+	printf("\n");
+
+	return offset + REGISTER_INSTRUCTION_SIZE;
+}
+
 /* Prints simple instructions
  *
  *  Params:
@@ -95,6 +286,42 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
 	return offset + 2;
 }
 
+/* Prints a superinstruction along with the operands of the instructions it is made of
+ *
+ *  Params:
+ *      name:       the name of the superinstruction (ex. OP_CONSTANT_ADD)
+ *      chunk:      the chunk containing the superinstruction
+ *      offset:     the offset of the superinstruction
+ *      first:      the opcode of the first instruction it does the work of
+ *      second:     the opcode of the second instruction it does the work of
+ *
+ *  Returns:
+ *      int:        the offset value of the next instruction
+ */
+static int superinstruction(const char* name, Chunk* chunk, int offset, uint8_t first, uint8_t second) {
+	printf("%-16s", name);
+
+	// Operands follow the single opcode in the order of the instructions they belong to
+	int operand = offset + 1;
+	uint8_t parts[] = {first, second};
+	for (int part = 0; part < 2; part++) {
+		if (parts[part] == OP_CONSTANT || parts[part] == OP_CONSTANT_LONG) {
+			uint32_t constant = chunk->code[operand];
+			if (parts[part] == OP_CONSTANT_LONG) {
+				constant |= (chunk->code[operand + 1] << 8) | (chunk->code[operand + 2] << 16);
+			}
+
+			printf(" %4d '", constant);
+			printValue(chunk->constants.values[constant]);
+			printf("'");
+		}
+		operand += instructionSize(parts[part]) - 1;
+	}
+	printf("\n");
+
+	return offset + instructionSize(chunk->code[offset]);
+}
+
 static int longConstantInstruction(const char* name, Chunk* chunk, int offset) {
 	uint32_t constant = chunk->code[offset + 1] |
 						(chunk->code[offset + 2] << 8) |
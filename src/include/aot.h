@@ -0,0 +1,10 @@
+#ifndef CYNCH_AOT_H
+#define CYNCH_AOT_H
+
+#include "chunk.h"
+
+#define AOT_ENTRY "cynchRunScript"  // The function a generated translation unit runs its script with
+
+bool writeCSource(const Chunk* chunk, const char* scriptName, const char* path);
+
+#endif //CYNCH_AOT_H
@@ -0,0 +1,28 @@
+#ifndef CYNCH_BATCH_H
+#define CYNCH_BATCH_H
+
+#include "vm.h"
+
+// The scripts of a batch, in the order their output is printed in
+typedef struct {
+	int count;
+	int capacity;
+	char** paths;
+} ScriptList;
+
+// How every script of a batch is compiled and run
+typedef struct {
+	Backend backend;
+	bool optimize;
+	int jobs;               // Worker threads, 0 for one per online core
+	size_t memoryLimit;     // Bytes each worker's VM may hold, 0 for no limit
+	bool jit;               // Run stack-based chunks as machine code (see jit.c)
+} BatchOptions;
+
+void initScriptList(ScriptList* scripts);
+void addScript(ScriptList* scripts, const char* path);
+bool readManifest(ScriptList* scripts, const char* path);
+void freeScriptList(ScriptList* scripts);
+int runBatch(ScriptList* scripts, BatchOptions* options);
+
+#endif //CYNCH_BATCH_H
@@ -0,0 +1,21 @@
+#ifndef CYNCH_BYTECODE_H
+#define CYNCH_BYTECODE_H
+
+#include "chunk.h"
+
+#define BYTECODE_MAGIC "CYNB"
+#define BYTECODE_VERSION 2
+
+// A chunk loaded from a bytecode file, whose code and position table are used in place from the file's mapping
+typedef struct {
+	Chunk chunk;
+	void* mapping;
+	size_t mappingSize;
+} BytecodeFile;
+
+bool isBytecodeFile(const char* path);
+bool writeBytecode(Chunk* chunk, const char* path);
+bool loadBytecode(const char* path, BytecodeFile* file);
+void unloadBytecode(BytecodeFile* file);
+
+#endif //CYNCH_BYTECODE_H
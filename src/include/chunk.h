@@ -4,6 +4,36 @@
 #include "common.h"
 #include "value.h"
 
+/* Superinstructions: pairs of instructions that are executed by a single dispatch
+ *
+ *  Each entry X(first, second) adds the opcode OP_first_second, which does the work of OP_first followed by OP_second
+ *  and takes the operands of both, in order. The VM's handlers, the disassembler and the optimizer's fusion pass are
+ *  all generated from this list, so the set of superinstructions can follow the opcode pair counts measured by
+ *  cynch-prof by editing this list alone. A pair may use any instruction except OP_RETURN, and is only worth listing
+ *  if compiled chunks can contain it: CONSTANT NEGATE, for one, is folded by the compiler and by the optimizer's
+ *  peephole pass before fusion ever sees it.
+ */
+#define SUPERINSTRUCTIONS(X) \
+	X(CONSTANT, ADD) \
+	X(CONSTANT, SUBTRACT) \
+	X(CONSTANT, MULTIPLY) \
+	X(CONSTANT, DIVIDE)
+
+/* Quickened instructions: the arithmetic instructions specialized to number operands, which the VM rewrites in place
+ *
+ *  Each entry X(op) adds the opcode OP_op_NUMBERS. The first time OP_op runs on numbers, run() overwrites its opcode
+ *  with OP_op_NUMBERS, whose handler only checks that the operands are still numbers in a single branch. When they are
+ *  not, the handler writes OP_op back and carries on as OP_op, which reports the error or, once there are other types,
+ *  does the work for them. A quickened instruction takes the operands of its generic one, and every other part of the
+ *  tree (the JIT, the C generator, the bytecode checks) sees it as its generic instruction (see genericOpcode()).
+ */
+#define QUICKENED_INSTRUCTIONS(X) \
+	X(ADD) \
+	X(SUBTRACT) \
+	X(MULTIPLY) \
+	X(DIVIDE) \
+	X(NEGATE)
+
 // List of instructions
 typedef enum {
 	OP_CONSTANT,
@@ -17,29 +47,111 @@ typedef enum {
 	OP_DIVIDE,
 	OP_NEGATE,
 	OP_RETURN,
+#define SUPERINSTRUCTION_OPCODE(first, second) OP_##first##_##second,
+	SUPERINSTRUCTIONS(SUPERINSTRUCTION_OPCODE)
+#undef SUPERINSTRUCTION_OPCODE
+#define QUICKENED_OPCODE(op) OP_##op##_NUMBERS,
+	QUICKENED_INSTRUCTIONS(QUICKENED_OPCODE)
+#undef QUICKENED_OPCODE
 } OpCode;
 
+// List of register-based instructions
+//
+// Every instruction is four bytes wide: the opcode followed by the operands A, B and C. A is the destination register,
+// B and C are "RK" operands: values below RK_CONSTANT name a register, the rest name the constant at index
+// (operand - RK_CONSTANT). ROP_LOAD_CONSTANT instead reads B and C as one 16-bit constant index.
+typedef enum {
+	ROP_LOAD_CONSTANT,      // R(A) = K(B | C << 8)
+	ROP_ADD,                // R(A) = RK(B) + RK(C)
+	ROP_SUBTRACT,           // R(A) = RK(B) - RK(C)
+	ROP_MULTIPLY,           // R(A) = RK(B) * RK(C)
+	ROP_DIVIDE,             // R(A) = RK(B) / RK(C)
+	ROP_NEGATE,             // R(A) = -RK(B)
+	ROP_RETURN,             // return RK(B)
+} RegisterOpCode;
+
+#define REGISTER_INSTRUCTION_SIZE 4
+#define RK_CONSTANT 128
+#define REGISTER_MAX RK_CONSTANT
+
+#define CONSTANT_LONG_MAX 0xffffff   // The largest constant index OP_CONSTANT_LONG's three byte operand holds
+
+// Where in the source an instruction was compiled from
 typedef struct {
-	int offset;
 	int line;
-} LineStart;
+	int column;
+} SourcePosition;
+
+// An entry of a position table: the bytes of code from offset up to the next entry come from position
+typedef struct {
+	int offset;
+	SourcePosition position;
+} PositionEntry;
+
+#define POSITION_CHECKPOINT_INTERVAL 32  // Entries of a position table between two checkpoints
+
+// A decoded entry of a position table to start decoding the entries after it from
+typedef struct {
+	int byte;               // Where the encoding of the entry after it starts
+	PositionEntry entry;
+} PositionCheckpoint;
+
+/* The source position of every byte of a chunk's code
+ *
+ *  An entry is added whenever the position of the code changes, and is encoded as the difference from the entry
+ *  before it: most take a single byte (see "Position table encoding" in chunk.c for the format, and addPosition(),
+ *  which writes it). Decoding from the start of the table would make looking up an offset linear in the size of the
+ *  chunk, so every POSITION_CHECKPOINT_INTERVAL entries the decoded entry is also kept as a checkpoint. A lookup
+ *  binary searches the checkpoints and decodes at most the entries up to the next one. Walking the code in order is
+ *  done with a PositionCursor, which only ever decodes the next entry.
+ */
+typedef struct {
+	int entryCount;
+	int byteCount;
+	int byteCapacity;
+	uint8_t* bytes;         // The encoded entries
+	int checkpointCount;
+	int checkpointCapacity;
+	PositionCheckpoint* checkpoints;
+	PositionEntry last;     // The last entry, which the next one is encoded against
+} PositionTable;
+
+// Walks a chunk's position table forward, one entry at a time
+typedef struct {
+	const PositionTable* table;
+	int entry;              // The index of the current entry
+	PositionEntry current;
+	PositionEntry next;     // The entry after the current one, at offset INT_MAX past the last entry
+	int byte;               // Where the encoding of the entry after next starts
+} PositionCursor;
 
 // A sequence of bytcode, stored in a dynamic array
 typedef struct {
 	int count;              // Number of data elements
 	int capacity;           // Max size of the array
 	uint8_t* code;          // Pointer to the array
-	int lineCount;
-	int lineCapacity;
-	LineStart* lines;       // Source lines contained by the chunk
+	PositionTable positions;    // The source position of each byte of code
 	ValueArray constants;   // Values contained by the chunk
+	int constantSlotCount;  // Used slots of the constant index, including stale ones
+	int constantSlotCapacity;
+	int* constantSlots;     // Open addressing hash index into constants, -1 marks an empty slot
+	const Allocator* allocator; // What allocates every array of the chunk, NULL for the heap
+	bool quicken;           // Whether run() may rewrite instructions in place, false for read-only or shared code
 } Chunk;
 
 void initChunk(Chunk* chunk);
-void writeChunk(Chunk* chunk, uint8_t byte, int line);
+void initChunkIn(Chunk* chunk, const Allocator* allocator);
+void writeChunk(Chunk* chunk, uint8_t byte, int line, int column);
 int addConstant(Chunk* chunk, Value value);
-void writeConstant(Chunk* chunk, Value value, int line);
+void writeConstant(Chunk* chunk, Value value, int line, int column);
+void truncateCode(Chunk* chunk, int count);
+void truncateConstants(Chunk* chunk, int count);
 void freeChunk(Chunk* chunk);
-int getLine(Chunk* chunk, int instruction);
+SourcePosition getPosition(const Chunk* chunk, int offset);
+void initPositionCursor(PositionCursor* cursor, const Chunk* chunk);
+SourcePosition seekPosition(PositionCursor* cursor, int offset);
+const char* checkPositions(const Chunk* chunk);
+int instructionSize(uint8_t instruction);
+uint8_t genericOpcode(uint8_t instruction);
 
 #endif //CYNCH_CHUNK_H
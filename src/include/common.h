@@ -5,7 +5,16 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Development builds (the CYNCH_DEBUG option in CMakeLists.txt) print every compiled chunk and trace execution
+#ifdef CYNCH_DEBUG
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+// Dispatch instructions with "computed goto" (labels as values) when the compiler supports it,
+// building with CYNCH_SWITCH_DISPATCH forces the portable switch loop instead
+#if defined(__GNUC__) && !defined(CYNCH_SWITCH_DISPATCH)
+#define CYNCH_COMPUTED_GOTO
+#endif
 
 #endif //CYNCH_COMMON_H
@@ -1,8 +1,9 @@
 #ifndef CYNCH_COMPILER_H
 #define CYNCH_COMPILER_H
 
+#include "scanner.h"
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+bool compile(Scanner* scanner, Chunk* chunk, Backend backend);
 
 #endif //CYNCH_COMPILER_H
@@ -0,0 +1,89 @@
+#ifndef CYNCH_H
+#define CYNCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The embedding interface
+ *
+ *  A host compiles source code once into a program, then executes the program as many times as it needs to, on one
+ *  or more VMs. Programs are immutable once compiled: any number of VMs may execute the same program at once, from
+ *  different threads, as long as each VM is only used by one thread at a time. Results are handed back to the host
+ *  instead of being printed.
+ *
+ *      CynchProgram* program = cynchCompile("1 + 2 * 3", NULL);
+ *      CynchVM* vm = cynchNewVM();
+ *      CynchValue result;
+ *      if (program != NULL && cynchExecute(vm, program, &result) == CYNCH_OK) printf("%g\n", result.as.number);
+ *      cynchFreeVM(vm);
+ *      cynchReleaseProgram(program);
+ *
+ *  Compilation and runtime errors are reported on stderr.
+ *
+ *  What a VM allocates comes from an allocator the host can supply, is counted, and can be capped with
+ *  cynchSetMemoryLimit(). Source evaluated on a VM with cynchEvaluate() is compiled with the VM's memory, so going
+ *  over the cap fails that evaluation with CYNCH_RUNTIME_ERROR instead of taking down the host. Programs compiled with
+ *  cynchCompile() are the host's, and live on the heap.
+ */
+
+typedef struct CynchVM CynchVM;
+typedef struct CynchProgram CynchProgram;
+
+typedef enum {
+	CYNCH_OK,
+	CYNCH_COMPILE_ERROR,
+	CYNCH_RUNTIME_ERROR
+} CynchStatus;
+
+typedef enum {
+	CYNCH_BACKEND_STACK,
+	CYNCH_BACKEND_REGISTER
+} CynchBackend;
+
+// How cynchCompile() compiles a program, NULL options are the defaults: the stack backend, optimized, interpreted
+typedef struct {
+	CynchBackend backend;
+	bool optimize;
+	bool jit;                   // Also compile a stack backend program to machine code, where the machine is supported
+} CynchOptions;
+
+typedef enum {
+	CYNCH_NIL,
+	CYNCH_BOOL,
+	CYNCH_NUMBER
+} CynchType;
+
+// A value returned by a program
+typedef struct {
+	CynchType type;
+	union {
+		bool boolean;
+		double number;
+	} as;
+} CynchValue;
+
+// Where a VM's memory comes from: reallocate() behaves like realloc() with the old size given, and frees when newSize
+// is 0. Returning NULL fails whatever the VM was doing when it ran out.
+typedef struct {
+	void* (*reallocate)(void* userData, void* pointer, size_t oldSize, size_t newSize);
+	void* userData;
+} CynchAllocator;
+
+typedef struct {
+	size_t liveBytes;           // Allocated right now
+	size_t peakBytes;           // The most ever allocated at once
+	unsigned long long allocations;
+} CynchMemoryStats;
+
+CynchVM* cynchNewVM(void);
+CynchVM* cynchNewVMWithAllocator(const CynchAllocator* allocator);
+void cynchFreeVM(CynchVM* vm);
+void cynchSetMemoryLimit(CynchVM* vm, size_t limit);
+CynchMemoryStats cynchGetMemoryStats(const CynchVM* vm);
+CynchStatus cynchEvaluate(CynchVM* vm, const char* source, CynchValue* result);
+CynchProgram* cynchCompile(const char* source, const CynchOptions* options);
+CynchProgram* cynchLoadProgram(const char* path);
+CynchStatus cynchExecute(CynchVM* vm, const CynchProgram* program, CynchValue* result);
+void cynchReleaseProgram(CynchProgram* program);
+
+#endif //CYNCH_H
@@ -4,7 +4,11 @@
 #include "chunk.h"
 
 void disassembleChunk(Chunk* chunk, const char* name);
-int disassembleInstruction(Chunk* chunk, int offset);
+int disassembleInstruction(Chunk* chunk, PositionCursor* positions, int offset);
+void disassembleRegisterChunk(Chunk* chunk, const char* name);
+int disassembleRegisterInstruction(Chunk* chunk, PositionCursor* positions, int offset);
+const char* opcodeName(uint8_t instruction);
+const char* registerOpcodeName(uint8_t instruction);
 static int simpleInstruction(const char* name, int offset);
 static int constantInstruction(const char* name, Chunk* chunk, int offset);
 static int longConstantInstruction(const char* name, Chunk* chunk, int offset);
@@ -0,0 +1,45 @@
+#ifndef CYNCH_JIT_H
+#define CYNCH_JIT_H
+
+#include "chunk.h"
+#include "value.h"
+
+// The JIT emits x86-64 code for the System V calling convention, everywhere else chunks are always interpreted. The
+// profiling and tracing builds interpret too, since jitted code neither counts nor traces instructions.
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(CYNCH_PROFILE) && !defined(DEBUG_TRACE_EXECUTION)
+#define CYNCH_JIT
+#endif
+
+// How jitted code returned, the bailouts each name the runtime error the interpreter would have reported
+typedef enum {
+	JIT_OK,
+	JIT_OPERANDS_NOT_NUMBERS,
+	JIT_OPERAND_NOT_NUMBER
+} JitExit;
+
+/* Runs a jitted chunk
+ *
+ *  Params:
+ *      stack:      the bottom of the VM's stack
+ *      ip:         the VM's instruction pointer, set to just past the failing instruction on a bailout
+ *      result:     where the value the chunk returns is stored
+ */
+typedef JitExit (*JitFunction)(Value* stack, uint8_t** ip, Value* result);
+
+/* A chunk compiled to machine code
+ *
+ *  The code embeds the chunk's constants and the addresses of its instructions, so it may only run the chunk it was
+ *  compiled from, and only while that chunk's code stays where it is. It only reads and writes the stack and the
+ *  arguments it is given, so it can run on several VMs at once.
+ */
+typedef struct {
+	JitFunction entry;
+	void* mapping;              // Executable, and never writable at the same time
+	size_t mappingSize;
+	bool tracksIp;              // Whether the instruction pointer is kept up to date for the sampler (see sampler.c)
+} JitCode;
+
+bool compileJit(const Chunk* chunk, bool trackIp, JitCode* jit);
+void freeJit(JitCode* jit);
+
+#endif //CYNCH_JIT_H
@@ -1,19 +1,93 @@
 #ifndef CYNCH_MEMORY_H
 #define CYNCH_MEMORY_H
 
+#include <setjmp.h>
+
+#include "common.h"
+
+#define ARENA_MIN_BLOCK_SIZE 4096           // Bytes in an arena's first block, each new block doubles
+#define ARENA_BLOCK_SIZE (64 * 1024)        // The most bytes in a block, unless an allocation needs a bigger one
+#define ARENA_ALIGNMENT 8                   // Every arena allocation starts on a multiple of this, enough for a Value
+
 // Doubles the size of the array, if the array is less than 8 bytes, grows the capacity to 8 bytes
 #define GROW_CAPACITY(capacity) \
 	((capacity) < 8 ? 8 : (capacity) * 2)
 
-// Reallocates memory to a larger array
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
-	(type*)reallocate(pointer, sizeof(type) * (oldCount),\
+// Reallocates memory to a larger array with the given allocator, or on the heap if the allocator is NULL
+#define GROW_ARRAY(allocator, type, pointer, oldCount, newCount) \
+	(type*)reallocateWith(allocator, pointer, sizeof(type) * (oldCount),\
 			sizeof(type) * (newCount))
 
 // Deallocates the memory of an array
-#define FREE_ARRAY(type, pointer, oldCount) \
-	reallocate(pointer, sizeof(type) * oldCount, 0)
+#define FREE_ARRAY(allocator, type, pointer, oldCount) \
+	reallocateWith(allocator, pointer, sizeof(type) * (oldCount), 0)
+
+/* An allocator, as a function and the state it works on
+ *
+ *  The function has the contract of reallocate(): a NULL pointer allocates, a newSize of 0 frees, anything else
+ *  resizes. It returns NULL if the memory can't be allocated.
+ */
+typedef struct {
+	void* (*reallocate)(void* state, void* pointer, size_t oldSize, size_t newSize);
+	void* state;
+} Allocator;
+
+// A chunk of memory that an arena hands out from its start onward
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t size;                // Bytes in data
+	size_t used;                // Bytes handed out, the rest of data is free
+	char data[];
+} ArenaBlock;
+
+/* A bump allocator for memory that is all released at once
+ *
+ *  Allocations are carved from the current block one after the other. Freeing or growing the most recent allocation
+ *  (the top) happens in place, anything else is left where it is until the arena is reset. Resetting keeps the
+ *  blocks, so an arena that is reset between uses stops allocating once it has grown to its working size.
+ */
+typedef struct {
+	Allocator allocator;        // Allocates from the arena
+	const Allocator* parent;    // Allocates the blocks, NULL for the heap
+	ArenaBlock* first;
+	ArenaBlock* current;        // The block allocations are carved from
+	void* top;                  // The most recent allocation, NULL if it was freed or the arena was reset
+} Arena;
+
+// How much memory a tracker has handed out
+typedef struct {
+	size_t liveBytes;           // Allocated and not yet freed
+	size_t peakBytes;           // The most that was ever live at once
+	uint64_t allocations;       // How many times memory was allocated or resized
+	uint64_t allocatedBytes;    // The size of every allocation plus what every resize added
+} MemoryStats;
+
+// Why a MemoryTracker unwound to its recovery point, the value setjmp() returns there
+typedef enum {
+	MEMORY_EXHAUSTED = 1,       // The allocator below returned NULL
+	MEMORY_LIMIT_EXCEEDED,
+} MemoryFailure;
+
+/* An allocator that counts what passes through it to another allocator, and enforces a limit on live memory
+ *
+ *  When the limit would be exceeded, or the allocator below fails, the tracker unwinds to its recovery point if one
+ *  is set. Otherwise the process exits, as reallocate() does.
+ */
+typedef struct {
+	Allocator allocator;        // Allocates through the tracker
+	Allocator parent;           // Does the actual allocating
+	MemoryStats stats;
+	size_t limit;               // The most live bytes allowed, 0 for no limit
+	jmp_buf* recover;           // Where to unwind to on failure, NULL to exit
+} MemoryTracker;
+
+extern const Allocator heapAllocator;
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* reallocateWith(const Allocator* allocator, void* pointer, size_t oldSize, size_t newSize);
+void initArena(Arena* arena, const Allocator* parent);
+void resetArena(Arena* arena);
+void freeArena(Arena* arena);
+void initMemoryTracker(MemoryTracker* tracker, const Allocator* parent);
 
 #endif //CYNCH_MEMORY_H
@@ -0,0 +1,17 @@
+#ifndef CYNCH_OPTIMIZER_H
+#define CYNCH_OPTIMIZER_H
+
+#include "chunk.h"
+
+// How much a chunk changed while being optimized
+typedef struct {
+	int instructionsBefore;
+	int instructionsAfter;
+	int bytesBefore;
+	int bytesAfter;
+	int superinstructions;      // How many pairs of instructions were fused into one
+} OptimizeStats;
+
+OptimizeStats optimizeChunk(Chunk* chunk);
+
+#endif //CYNCH_OPTIMIZER_H
@@ -0,0 +1,86 @@
+#ifndef CYNCH_PROFILE_H
+#define CYNCH_PROFILE_H
+
+#include "common.h"
+
+// Only the cynch-prof target (built with CYNCH_PROFILE) counts instructions, everything else compiles the hooks away
+#ifdef CYNCH_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_CYCLE_SOURCE "rdtsc"
+#else
+#include <time.h>
+#define PROFILE_CYCLE_SOURCE "clock_gettime"
+#endif
+
+#define PROFILE_SAMPLE_PERIOD 64    // On average, time one out of every PROFILE_SAMPLE_PERIOD instructions
+#define PROFILE_BUCKETS 16          // Bucket n of a cycle histogram holds samples of [2^n, 2^(n+1)) cycles
+
+// The instruction sets profiled separately
+typedef enum {
+	PROFILE_STACK,
+	PROFILE_REGISTER
+} ProfileSet;
+
+// Counters for one instruction set of one VM, indexed by opcode
+typedef struct OpcodeProfile {
+	uint64_t counts[256];                       // How many times each opcode was executed
+	uint64_t pairs[256][256];                   // How many times opcode [i] was directly followed by opcode [j]
+	uint64_t samples[256];                      // How many executions of each opcode were timed
+	uint64_t cycles[256];                       // Total cycles of the timed executions
+	uint64_t histogram[256][PROFILE_BUCKETS];   // Distribution of the timed executions' cycles
+	int previous;                               // The last opcode executed in the current run, -1 before the first
+	int sampled;                                // The opcode being timed, -1 if none is
+	uint64_t sampleStart;
+	uint32_t countdown;                         // Instructions left until the next one is timed
+	uint32_t seed;                              // Jitters the countdown so loops don't always sample the same opcode
+	ProfileSet set;                             // Which totals the counters are added to when released
+	struct OpcodeProfile* next;                 // The next profile still owned by a VM
+} OpcodeProfile;
+
+OpcodeProfile* newProfile(ProfileSet set);
+void releaseProfile(OpcodeProfile* profile);
+void beginProfileRun(OpcodeProfile* profile);
+void endProfileRun(OpcodeProfile* profile);
+void recordProfileSample(OpcodeProfile* profile, uint64_t now);
+
+/* Reads the cycle counter (or a nanosecond clock where there is none)
+ *
+ */
+static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/* Counts an instruction that is about to be executed, called on every dispatch
+ *
+ *  The common path is two increments and a decrement: the cycle counter is only read when a sampled instruction
+ *  finishes (at the next dispatch) and when the countdown selects the next instruction to sample.
+ */
+static inline void profileInstruction(OpcodeProfile* profile, uint8_t instruction) {
+	profile->counts[instruction]++;
+	if (profile->previous >= 0) profile->pairs[profile->previous][instruction]++;
+	profile->previous = instruction;
+
+	if (profile->sampled >= 0) recordProfileSample(profile, readCycles());
+
+	if (--profile->countdown == 0) {
+		// A xorshift step picks the next countdown from [1, 2 * PROFILE_SAMPLE_PERIOD - 1]
+		profile->seed ^= profile->seed << 13;
+		profile->seed ^= profile->seed >> 17;
+		profile->seed ^= profile->seed << 5;
+		profile->countdown = 1 + profile->seed % (2 * PROFILE_SAMPLE_PERIOD - 1);
+		profile->sampled = instruction;
+		profile->sampleStart = readCycles();
+	}
+}
+
+#endif
+
+#endif //CYNCH_PROFILE_H
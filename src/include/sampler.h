@@ -0,0 +1,35 @@
+#ifndef CYNCH_SAMPLER_H
+#define CYNCH_SAMPLER_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+#define SAMPLER_DEFAULT_FREQUENCY 99    // Samples a second of CPU time, off a round number so loops don't alias with it
+
+/* The samples taken while one chunk runs
+ *
+ *  The SIGPROF handler only ever adds one to the count of the code offset the VM was at, and notes the offset the
+ *  first time, so it needs neither locks nor allocations. The noted offsets are resolved to source lines once the
+ *  chunk stops running, while it is still alive, and the arrays are kept for the next run with every count at zero.
+ */
+typedef struct SampledRun {
+	uint32_t* counts;           // Samples at each byte of the chunk's code
+	uint32_t* touched;          // The offsets with a count, in the order they were first sampled
+	uint32_t touchedCount;
+	int capacity;               // Bytes of code both arrays have room for
+	const Chunk* chunk;
+	uint8_t* const* ip;         // The VM's instruction pointer, read by the handler
+	const char* script;         // The root frame of the run's stacks
+	struct SampledRun* enclosing;   // The run this one interrupted on the same thread, if any
+} SampledRun;
+
+bool startSampler(int frequency);
+bool stopSampler(const char* path);
+bool samplerRunning();
+void initSampledRun(SampledRun* run);
+void freeSampledRun(SampledRun* run);
+void beginSampledRun(SampledRun* run, const Chunk* chunk, uint8_t* const* ip, const char* script);
+void endSampledRun(SampledRun* run);
+
+#endif //CYNCH_SAMPLER_H
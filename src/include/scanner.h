@@ -1,6 +1,8 @@
 #ifndef CYNCH_SCANNER_H
 #define CYNCH_SCANNER_H
 
+#include "common.h"
+
 typedef enum {
 	// Single-character tokens.
 	TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -23,14 +25,55 @@ typedef enum {
 	TOKEN_ERROR, TOKEN_EOF
 } TokenType;
 
+// A token of the source, at the line and column of its first character
 typedef struct {
 	TokenType type;
 	const char* start;
 	int length;
 	int line;
+	int column;             // Counted in characters from 1, a tab is one column
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+/* Where a scanner gets more of its source from, for sources that arrive over time (see source.h)
+ *
+ *  refill() hands the scanner its next window of the source. The window starts with a copy of the kept characters,
+ *  which the scanner hasn't finished with, and has at least one new character after them. The memory that pinned
+ *  points into must stay where it is, as the last token scanned from it is still in use. refill() returns false once
+ *  the source is exhausted.
+ */
+typedef struct SourceStream {
+	bool (*refill)(struct SourceStream* stream, const char* kept, size_t keptLength, const char* pinned,
+	               const char** window, size_t* windowLength);
+} SourceStream;
+
+struct TokenBuffer;
+
+/* The scanner's position in the source, owned by whoever is scanning it so several sources can be scanned at once
+ *
+ *  The source ends at end rather than at a terminator, so it can be scanned in place from a mapped file or a window
+ *  of a stream. A token points into the source: it stays valid until the scanner has returned the next token from
+ *  the source after it (error tokens don't count), which is as long as the compiler holds on to its previous token.
+ *
+ *  A scanner can also hand out tokens that were all scanned ahead of time (see tokens.h).
+ */
+typedef struct {
+	const char* start;      // The first character of the token being scanned
+	const char* current;    // The next character to be consumed
+	const char* end;        // One past the last character the scanner has
+	int line;
+	int startLine;          // The line and column of start
+	int startColumn;
+	const char* lineStart;  // The first character of the line, or the window's first if the line began in an earlier one
+	int lineColumns;        // The characters of the line in earlier windows
+	SourceStream* stream;   // Where the rest of the source comes from, NULL if the scanner has all of it
+	const char* pinned;     // The start of the last token returned
+	const struct TokenBuffer* tokens;   // The tokens to hand out instead of scanning, NULL to scan
+	size_t nextToken;                   // The index of the next token to hand out
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source, size_t length);
+void initStreamScanner(Scanner* scanner, SourceStream* stream);
+void initTokenScanner(Scanner* scanner, const struct TokenBuffer* tokens);
+Token scanToken(Scanner* scanner);
 
 #endif //CYNCH_SCANNER_H
\ No newline at end of file
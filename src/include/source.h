@@ -0,0 +1,37 @@
+#ifndef CYNCH_SOURCE_H
+#define CYNCH_SOURCE_H
+
+#include "common.h"
+#include "scanner.h"
+
+#define SOURCE_WINDOW_SIZE (64 * 1024)  // Bytes read from a streamed source at a time
+
+// A buffer a streamed source is read into
+typedef struct {
+	char* data;
+	size_t capacity;
+} SourceWindow;
+
+/* The source code of a script, either mapped or streamed
+ *
+ *  Regular files are mapped and scanned in place, without a copy. Anything else (pipes, terminals, and "-" for
+ *  standard input) is streamed: read SOURCE_WINDOW_SIZE bytes at a time as the scanner gets to them, so compiling
+ *  starts with the first window, and only two windows are ever held however long the source is. A window grows when
+ *  a single token doesn't fit in it.
+ */
+typedef struct {
+	SourceStream stream;        // Hands a scanner the next window, first so it can be cast back to the file
+	const char* path;
+	int descriptor;             // The streamed file, -1 once it is exhausted or when the source is mapped
+	bool failed;                // Whether reading the streamed file failed, leaving the source cut short
+	const char* text;           // The mapped source, NULL when streamed
+	size_t length;
+	SourceWindow windows[2];    // The window being scanned and the one before it
+	int window;                 // The index of the window being scanned
+} SourceFile;
+
+bool openSource(SourceFile* file, const char* path);
+void scanSource(SourceFile* file, Scanner* scanner);
+void closeSource(SourceFile* file);
+
+#endif //CYNCH_SOURCE_H
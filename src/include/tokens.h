@@ -0,0 +1,35 @@
+#ifndef CYNCH_TOKENS_H
+#define CYNCH_TOKENS_H
+
+#include "common.h"
+#include "scanner.h"
+
+#define TOKENIZE_MIN_PIECE (1024 * 1024)   // The fewest bytes of source worth another lexing thread
+
+/* Every token of a source, scanned ahead of parsing
+ *
+ *  The tokens are kept as parallel arrays rather than an array of Tokens: 17 bytes a token instead of 32, and the
+ *  source pointer is only stored once. Offsets are from the start of the source, so a source can be at most 4 GB. An
+ *  error token has no characters in the source: its offset is where scanning failed and its length is the index of
+ *  its message in errors.
+ */
+typedef struct TokenBuffer {
+	const char* source;
+	size_t count;
+	size_t capacity;
+	uint8_t* types;             // TokenTypes
+	uint32_t* offsets;
+	uint32_t* lengths;
+	int32_t* lines;
+	int32_t* columns;
+	const char** errors;
+	int errorCount;
+	int errorCapacity;
+} TokenBuffer;
+
+void initTokenBuffer(TokenBuffer* tokens, const char* source);
+void freeTokenBuffer(TokenBuffer* tokens);
+bool tokenize(TokenBuffer* tokens, const char* source, size_t length, int threads);
+Token readToken(const TokenBuffer* tokens, size_t index);
+
+#endif //CYNCH_TOKENS_H
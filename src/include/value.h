@@ -1,7 +1,10 @@
 #ifndef CYNCH_VALUE_H
 #define CYNCH_VALUE_H
 
+#include <stdio.h>
+
 #include "common.h"
+#include "memory.h"
 
 typedef enum {
 	VAL_BOOL,
@@ -9,6 +12,64 @@ typedef enum {
 	VAL_NUMBER
 } ValueType;
 
+#ifdef NAN_BOXING
+
+/* NaN boxing: every value fits in 8 bytes
+ *
+ *  Numbers are stored as plain doubles. Every other value is stored in the unused bits of a quiet NaN, which no
+ *  arithmetic operation produces on its own, so the two can never be confused:
+ *
+ *      QNAN:           the exponent bits, the quiet bit and Intel's "QNaN Floating-Point Indefinite" bit
+ *      TAG_*:          the low two bits distinguish the non-number values from each other
+ */
+#include <string.h>
+
+#define QNAN                    ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL                 1 // 01
+#define TAG_FALSE               2 // 10
+#define TAG_TRUE                3 // 11
+
+typedef uint64_t Value;
+
+#define FALSE_VAL               ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL                ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+// Checks a value's type
+#define IS_BOOL(value)          (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)           ((value) == NIL_VAL(0))
+#define IS_NUMBER(value)        (((value) & QNAN) != QNAN)
+#define ARE_NUMBERS(a, b)       ((((a) & QNAN) != QNAN) & (((b) & QNAN) != QNAN))  // One branch for both values
+
+// Given a value, returns the corresponding C value
+#define AS_BOOL(value)          ((value) == TRUE_VAL)
+#define AS_NUMBER(value)        valueToNum(value)
+
+// Produces a value of a given type
+#define BOOL_VAL(value)         ((value) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL(value)          ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(value)       numToValue(value)
+
+/* Reinterprets the bits of a boxed value as a double (memcpy is the portable way to type pun)
+ *
+ */
+static inline double valueToNum(Value value) {
+	double num;
+	memcpy(&num, &value, sizeof(Value));
+	return num;
+}
+
+/* Reinterprets the bits of a double as a boxed value
+ *
+ */
+static inline Value numToValue(double num) {
+	Value value;
+	memcpy(&value, &num, sizeof(double));
+	return value;
+}
+
+#else
+
 typedef struct {
 	ValueType type;
 	union {
@@ -21,6 +82,7 @@ typedef struct {
 #define IS_BOOL(value)          ((value.type) == VAL_BOOL)
 #define IS_NIL(value)           ((value.type) == VAL_NIL)
 #define IS_NUMBER(value)        ((value.type) == VAL_NUMBER)
+#define ARE_NUMBERS(a, b)       ((((a).type ^ VAL_NUMBER) | ((b).type ^ VAL_NUMBER)) == 0)  // One branch for both
 
 // Given a value, returns the corresponding C value
 #define AS_BOOL(value)          ((value).as.boolean)
@@ -31,15 +93,19 @@ typedef struct {
 #define NIL_VAL(value)          ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value)       ((Value){VAL_NUMBER, {.number = value}})
 
+#endif
+
 typedef struct {
 	int capacity;
 	int count;
 	Value* values;
+	const Allocator* allocator; // What allocates values, NULL for the heap
 } ValueArray;
 
 void initValueArray(ValueArray* arr);
 void writeValueArray(ValueArray* arr, Value value);
 void freeValueArray(ValueArray* arr);
 void printValue(Value value);
+void fprintValue(FILE* file, Value value);
 
 #endif //CYNCH_VALUE_H
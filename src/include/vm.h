@@ -1,17 +1,57 @@
 #ifndef CYNCH_VM_H
 #define CYNCH_VM_H
 
+#include <setjmp.h>
+#include <stdio.h>
+
 #include "chunk.h"
+#include "jit.h"
+#include "profile.h"
+#include "sampler.h"
+#include "scanner.h"
 #include "value.h"
 
-#define STACK_MAX 256
+#define STACK_MAX 256   // Number of values the VM stack holds, anything more overflows onto the guard page
+
+// The instruction sets the VM can compile to and execute
+typedef enum {
+	BACKEND_STACK,
+	BACKEND_REGISTER
+} Backend;
 
+/* An interpreter instance
+ *
+ *  All of the interpreter's mutable state lives here and every function takes the VM it works on, so each thread can
+ *  run its own VM. A VM itself must only be used by one thread at a time, and must not be moved once initialized.
+ */
 typedef struct {
+	Backend backend;
+	bool optimize;              // Run the peephole optimizer over every compiled chunk
+	bool printOptimizeStats;    // Report the optimizer's before/after instruction counts on stderr
+	bool jit;                   // Compile stack-based chunks to machine code before running them, where supported
+	FILE* output;               // Where results are printed, or NULL to only keep them in result
+	Value result;               // What the last chunk to run to completion returned
+	MemoryTracker memory;       // Counts and limits everything the VM allocates
+	Arena arena;                // Holds the chunk of each interpret() call, reset when the call returns
 	Chunk* chunk;
 	uint8_t* ip;
 	Value* stack;
-	int stackCount;
-	int stackCapacity;
+	Value* stackTop;            // Points just past the last value on the stack
+	char* stackMapping;         // The stack's memory mapping, including its guard page
+	size_t stackMappingSize;
+	char* guardPage;            // The inaccessible page right after the last stack slot
+	size_t guardSize;
+	sigjmp_buf stackOverflow;   // Where the guard page's fault handler unwinds to
+	Value registers[REGISTER_MAX];
+	const char* scriptName;     // What the running script is called in samples, NULL for "script"
+	SampledRun samples;         // Where the sampler counts the running chunk's samples, when it is running
+#ifdef DEBUG_TRACE_EXECUTION
+	PositionCursor tracePositions;  // Follows the traced instructions through the chunk's position table
+#endif
+#ifdef CYNCH_PROFILE
+	OpcodeProfile* stackProfile;
+	OpcodeProfile* registerProfile;
+#endif
 } VM;
 
 typedef enum {
@@ -20,10 +60,22 @@ typedef enum {
 	INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+bool initVM(VM* vm);
+void freeVM(VM* vm);
+void setBackend(VM* vm, Backend backend);
+void setOptimizer(VM* vm, bool enabled, bool printStats);
+void setJit(VM* vm, bool enabled);
+void setOutput(VM* vm, FILE* output);
+void setAllocator(VM* vm, const Allocator* allocator);
+void setMemoryLimit(VM* vm, size_t limit);
+void setScriptName(VM* vm, const char* name);
+bool buildChunk(Scanner* scanner, Chunk* chunk, Backend backend, bool optimize, bool printStats);
+bool compileChunk(VM* vm, Scanner* scanner, Chunk* chunk);
+InterpretResult interpretChunk(VM* vm, Chunk* chunk);
+InterpretResult interpretJitChunk(VM* vm, Chunk* chunk, const JitCode* jit);
+InterpretResult interpretSource(VM* vm, Scanner* scanner);
+InterpretResult interpret(VM* vm, const char* source);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
 #endif //CYNCH_VM_H
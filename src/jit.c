@@ -0,0 +1,341 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "include/jit.h"
+#include "include/vm.h"
+
+/* A baseline template JIT for stack-based chunks
+ *
+ *  Every instruction is replaced by a fixed sequence of machine code, in the order of the chunk, so the code does no
+ *  decoding and no dispatch. Chunks have no jumps, so the whole chunk becomes one straight-line function:
+ *      - rdi is the stack top, rsi points to the VM's instruction pointer and rdx to the result
+ *      - constants are stored as immediates instead of being loaded from the constant table
+ *      - superinstructions are split back into the templates of their two instructions
+ *      - the type guards of arithmetic jump to a bailout stub after the function body, which stores the instruction
+ *        pointer the interpreter would have had when it failed and returns the error for the VM to report
+ *
+ *  A chunk the JIT can't compile exactly (an opcode the interpreter doesn't execute, a malformed operand, or code that
+ *  would overflow the stack, which only the interpreter can report at the right instruction) is left to the
+ *  interpreter by compileJit() returning false.
+ */
+
+#ifdef CYNCH_JIT
+
+#define VALUE_SIZE ((int8_t)sizeof(Value))
+#ifdef NAN_BOXING
+#define NUMBER_OFFSET 0
+#else
+#define TYPE_OFFSET ((int8_t)offsetof(Value, type))
+#define NUMBER_OFFSET ((int8_t)offsetof(Value, as))
+#endif
+
+// A guard's jump to the stub that reports its failure
+typedef struct {
+	int jump;                   // Where the jump's 32-bit displacement is in the code
+	const uint8_t* ip;          // The instruction pointer the interpreter would have had
+	JitExit exit;
+} Bailout;
+
+// Machine code being emitted, in a growable buffer that is copied into executable memory once it is complete
+typedef struct {
+	const Allocator* allocator; // The allocator of the chunk being compiled, so its limit covers the buffers too
+	uint8_t* code;
+	int count;
+	int capacity;
+	Bailout* bailouts;
+	int bailoutCount;
+	int bailoutCapacity;
+} Assembler;
+
+static void emitByte(Assembler* assembler, uint8_t byte) {
+	if (assembler->count + 1 > assembler->capacity) {
+		int capacity = assembler->capacity < 256 ? 256 : assembler->capacity * 2;
+		assembler->code = GROW_ARRAY(assembler->allocator, uint8_t, assembler->code, assembler->capacity, capacity);
+		assembler->capacity = capacity;
+	}
+	assembler->code[assembler->count++] = byte;
+}
+
+static void emitBytes(Assembler* assembler, const uint8_t* bytes, int count) {
+	for (int index = 0; index < count; index++) emitByte(assembler, bytes[index]);
+}
+
+// Emits an integer in little endian order, the way x86 immediates and displacements are encoded
+static void emitInteger(Assembler* assembler, uint64_t value, int bytes) {
+	for (int index = 0; index < bytes; index++) emitByte(assembler, (uint8_t)(value >> (8 * index)));
+}
+
+/* Emits a conditional jump to a new bailout stub
+ *
+ *  Params:
+ *      condition:  the second byte of the jcc rel32 opcode, 0x84 for je or 0x85 for jne
+ *      ip:         the instruction pointer to store before returning
+ *      exit:       what to return
+ */
+static void emitBailout(Assembler* assembler, uint8_t condition, const uint8_t* ip, JitExit exit) {
+	if (assembler->bailoutCount + 1 > assembler->bailoutCapacity) {
+		int capacity = GROW_CAPACITY(assembler->bailoutCapacity);
+		assembler->bailouts = GROW_ARRAY(assembler->allocator, Bailout, assembler->bailouts,
+		                                 assembler->bailoutCapacity, capacity);
+		assembler->bailoutCapacity = capacity;
+	}
+
+	emitByte(assembler, 0x0f);
+	emitByte(assembler, condition);
+	assembler->bailouts[assembler->bailoutCount++] = (Bailout){assembler->count, ip, exit};
+	emitInteger(assembler, 0, 4);
+}
+
+/* Emits a check that the value at a distance from the stack top is a number
+ *
+ */
+static void emitNumberGuard(Assembler* assembler, int distance, const uint8_t* ip, JitExit exit) {
+	int8_t slot = (int8_t)(-VALUE_SIZE * (distance + 1));
+#ifdef NAN_BOXING
+	// A number is anything without every bit of QNAN set, which r8 holds
+	const uint8_t load[] = {0x48, 0x8b, 0x47, (uint8_t)slot};      // mov rax, [rdi + slot]
+	const uint8_t test[] = {0x4c, 0x21, 0xc0, 0x4c, 0x39, 0xc0};    // and rax, r8; cmp rax, r8
+	emitBytes(assembler, load, sizeof(load));
+	emitBytes(assembler, test, sizeof(test));
+	emitBailout(assembler, 0x84, ip, exit);
+#else
+	const uint8_t compare[] = {0x83, 0x7f, (uint8_t)(slot + TYPE_OFFSET), VAL_NUMBER};  // cmp dword [rdi + type], imm8
+	emitBytes(assembler, compare, sizeof(compare));
+	emitBailout(assembler, 0x85, ip, exit);
+#endif
+}
+
+/* Emits a push of a constant
+ *
+ */
+static void emitConstant(Assembler* assembler, Value value) {
+	uint64_t bits;
+	memcpy(&bits, (const char*)&value + NUMBER_OFFSET, sizeof(bits));
+
+#ifndef NAN_BOXING
+	const uint8_t storeType[] = {0xc7, 0x47, (uint8_t)TYPE_OFFSET};  // mov dword [rdi + type], imm32
+	emitBytes(assembler, storeType, sizeof(storeType));
+	emitInteger(assembler, (uint32_t)value.type, 4);
+#endif
+
+	emitByte(assembler, 0x48);                                      // mov rax, imm64
+	emitByte(assembler, 0xb8);
+	emitInteger(assembler, bits, 8);
+	const uint8_t store[] = {0x48, 0x89, 0x47, (uint8_t)NUMBER_OFFSET,  // mov [rdi + number], rax
+	                         0x48, 0x83, 0xc7, (uint8_t)VALUE_SIZE};     // add rdi, VALUE_SIZE
+	emitBytes(assembler, store, sizeof(store));
+}
+
+/* Emits an arithmetic instruction: both operands are checked, and the result replaces the first
+ *
+ *  Params:
+ *      operation:  the second opcode byte of the scalar double instruction (addsd, subsd, mulsd or divsd)
+ *      ip:         the instruction pointer a failed guard stores
+ */
+static void emitBinary(Assembler* assembler, uint8_t operation, const uint8_t* ip) {
+	emitNumberGuard(assembler, 0, ip, JIT_OPERANDS_NOT_NUMBERS);
+	emitNumberGuard(assembler, 1, ip, JIT_OPERANDS_NOT_NUMBERS);
+
+	int8_t a = (int8_t)(-2 * VALUE_SIZE + NUMBER_OFFSET);
+	int8_t b = (int8_t)(-VALUE_SIZE + NUMBER_OFFSET);
+	const uint8_t code[] = {
+			0xf2, 0x0f, 0x10, 0x47, (uint8_t)a,                 // movsd xmm0, [rdi + a]
+			0xf2, 0x0f, operation, 0x47, (uint8_t)b,            // op xmm0, [rdi + b]
+			0xf2, 0x0f, 0x11, 0x47, (uint8_t)a,                 // movsd [rdi + a], xmm0
+			0x48, 0x83, 0xef, (uint8_t)VALUE_SIZE,              // sub rdi, VALUE_SIZE
+	};
+	emitBytes(assembler, code, sizeof(code));
+}
+
+/* Emits a negation, which flips the sign bit of the number in place
+ *
+ */
+static void emitNegate(Assembler* assembler, const uint8_t* ip) {
+	emitNumberGuard(assembler, 0, ip, JIT_OPERAND_NOT_NUMBER);
+	const uint8_t code[] = {0x48, 0x0f, 0xba, 0x7f, (uint8_t)(-VALUE_SIZE + NUMBER_OFFSET), 63};   // btc qword [], 63
+	emitBytes(assembler, code, sizeof(code));
+}
+
+/* Emits a return of the value on top of the stack
+ *
+ */
+static void emitReturn(Assembler* assembler) {
+#ifdef NAN_BOXING
+	const uint8_t code[] = {0x48, 0x8b, 0x47, (uint8_t)-VALUE_SIZE,    // mov rax, [rdi - VALUE_SIZE]
+	                        0x48, 0x89, 0x02};                         // mov [rdx], rax
+#else
+	const uint8_t code[] = {0x0f, 0x10, 0x47, (uint8_t)-VALUE_SIZE,    // movups xmm0, [rdi - VALUE_SIZE]
+	                        0x0f, 0x11, 0x02};                         // movups [rdx], xmm0
+#endif
+	const uint8_t exit[] = {0x31, 0xc0, 0xc3};                         // xor eax, eax; ret
+	emitBytes(assembler, code, sizeof(code));
+	emitBytes(assembler, exit, sizeof(exit));
+}
+
+/* Emits a store of an instruction pointer into the VM
+ *
+ */
+static void emitStoreIp(Assembler* assembler, const uint8_t* ip) {
+	emitByte(assembler, 0x48);                                      // mov rax, imm64
+	emitByte(assembler, 0xb8);
+	emitInteger(assembler, (uint64_t)(uintptr_t)ip, 8);
+	const uint8_t store[] = {0x48, 0x89, 0x06};                     // mov [rsi], rax
+	emitBytes(assembler, store, sizeof(store));
+}
+
+/* Emits the template of one instruction
+ *      A superinstruction is emitted as its two instructions, with the second one at the offset its operands would
+ *      start at minus one, which is where the interpreter's instruction pointer points to when it fails.
+ *
+ *  Params:
+ *      instruction:    the opcode to emit
+ *      offset:         where the instruction is, its operands follow it
+ *      depth:          the values on the stack before the instruction, updated to the values after it
+ *
+ *  Returns:
+ *      False if the instruction can't be compiled.
+ */
+static bool emitInstruction(Assembler* assembler, const Chunk* chunk, uint8_t instruction, int offset, int* depth) {
+	const uint8_t* ip = chunk->code + offset + 1;
+	int size = instructionSize(instruction);
+	if (offset + size > chunk->count) return false;
+
+	// The templates check the operands' types themselves, whether or not the interpreter quickened the instruction
+	instruction = genericOpcode(instruction);
+	switch (instruction) {
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG: {
+			int index = instruction == OP_CONSTANT ? ip[0] : ip[0] | (ip[1] << 8) | (ip[2] << 16);
+			if (index >= chunk->constants.count) return false;
+			emitConstant(assembler, chunk->constants.values[index]);
+			(*depth)++;
+			return *depth <= STACK_MAX;
+		}
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE: {
+			static const uint8_t operations[] = {0x58, 0x5c, 0x59, 0x5e};   // addsd, subsd, mulsd, divsd
+			if (*depth < 2) return false;
+			emitBinary(assembler, operations[instruction - OP_ADD], ip);
+			(*depth)--;
+			return true;
+		}
+		case OP_NEGATE:
+			if (*depth < 1) return false;
+			emitNegate(assembler, ip);
+			return true;
+		case OP_RETURN:
+			if (*depth < 1) return false;
+			emitReturn(assembler);
+			return true;
+
+#define SUPERINSTRUCTION_TEMPLATE(first, second) \
+		case OP_##first##_##second: \
+			return emitInstruction(assembler, chunk, OP_##first, offset, depth) && \
+			       emitInstruction(assembler, chunk, OP_##second, offset + instructionSize(OP_##first) - 1, depth);
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_TEMPLATE)
+#undef SUPERINSTRUCTION_TEMPLATE
+
+		default:
+			return false;
+	}
+}
+
+/* Compiles a stack-based chunk into machine code
+ *
+ *  Params:
+ *      chunk:      the chunk, which must not move or change while the code is in use
+ *      trackIp:    whether to store the instruction pointer before every instruction, so that samples taken in the
+ *                  code land on the right line; otherwise it is only stored when bailing out
+ *      jit:        where to store the code
+ *
+ *  Returns:
+ *      True if the chunk was compiled, false if it must be interpreted.
+ */
+bool compileJit(const Chunk* chunk, bool trackIp, JitCode* jit) {
+	Assembler assembler = {chunk->allocator, NULL, 0, 0, NULL, 0, 0};
+
+#ifdef NAN_BOXING
+	emitByte(&assembler, 0x49);                                     // mov r8, QNAN
+	emitByte(&assembler, 0xb8);
+	emitInteger(&assembler, QNAN, 8);
+#endif
+
+	// Code after the first return is never executed
+	bool returned = false;
+	int depth = 0;
+	for (int offset = 0; offset < chunk->count && !returned;) {
+		uint8_t instruction = chunk->code[offset];
+		if (trackIp) emitStoreIp(&assembler, chunk->code + offset + 1);
+		if (!emitInstruction(&assembler, chunk, instruction, offset, &depth)) break;
+
+		returned = instruction == OP_RETURN;
+		offset += instructionSize(instruction);
+	}
+
+	for (int index = 0; index < assembler.bailoutCount && returned; index++) {
+		Bailout* bailout = &assembler.bailouts[index];
+		int32_t displacement = assembler.count - (bailout->jump + 4);
+		memcpy(assembler.code + bailout->jump, &displacement, sizeof(displacement));
+
+		emitStoreIp(&assembler, bailout->ip);
+		emitByte(&assembler, 0xb8);                                 // mov eax, exit
+		emitInteger(&assembler, (uint32_t)bailout->exit, 4);
+		emitByte(&assembler, 0xc3);                                 // ret
+	}
+
+	bool compiled = returned;
+	if (compiled) {
+		size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		size_t size = ((size_t)assembler.count + pageSize - 1) / pageSize * pageSize;
+		void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapping == MAP_FAILED) {
+			compiled = false;
+		} else {
+			memcpy(mapping, assembler.code, (size_t)assembler.count);
+			if (mprotect(mapping, size, PROT_READ | PROT_EXEC) != 0) {
+				munmap(mapping, size);
+				compiled = false;
+			} else {
+				jit->mapping = mapping;
+				jit->mappingSize = size;
+				jit->entry = (JitFunction)mapping;
+				jit->tracksIp = trackIp;
+			}
+		}
+	}
+
+	FREE_ARRAY(assembler.allocator, uint8_t, assembler.code, assembler.capacity);
+	FREE_ARRAY(assembler.allocator, Bailout, assembler.bailouts, assembler.bailoutCapacity);
+	return compiled;
+}
+
+/* Releases a chunk's machine code
+ *
+ */
+void freeJit(JitCode* jit) {
+	if (jit->mapping != NULL) munmap(jit->mapping, jit->mappingSize);
+	jit->mapping = NULL;
+	jit->mappingSize = 0;
+	jit->entry = NULL;
+}
+
+#else
+
+bool compileJit(const Chunk* chunk, bool trackIp, JitCode* jit) {
+	(void)chunk;
+	(void)trackIp;
+	(void)jit;
+	return false;
+}
+
+void freeJit(JitCode* jit) {
+	(void)jit;
+}
+
+#endif
@@ -3,11 +3,17 @@
 #include <string.h>
 
 #include "include/common.h"
+#include "include/aot.h"
+#include "include/batch.h"
+#include "include/bytecode.h"
 #include "include/chunk.h"
 #include "include/debug.h"
+#include "include/sampler.h"
+#include "include/source.h"
+#include "include/tokens.h"
 #include "include/vm.h"
 
-static void repl() {
+static void repl(VM* vm) {
 	char line[1024];
 	for (;;) {
 		printf("> ");
@@ -17,72 +23,229 @@ static void repl() {
 			break;
 		}
 
-		interpret(line);
+		interpret(vm, line);
 	}
 }
 
-/* Reads the data of the specified file.
+/* Starts scanning an opened script, from tokens scanned ahead on several threads if pretokenize is set
+ *      Only mapped scripts are scanned ahead: a streamed one is never all in memory, and is scanned as it is compiled.
  *
  *  Params:
- *      path:      the path to the given file
- *
- *  Returns:
- *      An array of bytes read from the file.
+ *      tokens:         the buffer to scan ahead into, to free once compiling is done
+ *      pretokenize:    whether to scan the whole script before compiling it
+ *      jobs:           the most lexing threads, 0 for one per online core
  */
-static char* readFile(const char* path) {
-	FILE* file = fopen(path, "rb");
-
-	if (file == NULL) {
-		fprintf(stderr, "Could not open file \"%s\".\n", path);
-		exit(74);
+static void startScanner(SourceFile* source, Scanner* scanner, TokenBuffer* tokens, bool pretokenize, int jobs) {
+	initTokenBuffer(tokens, source->text);
+	if (pretokenize && source->text != NULL && tokenize(tokens, source->text, source->length, jobs)) {
+		initTokenScanner(scanner, tokens);
+	} else {
+		scanSource(source, scanner);
 	}
+}
 
-	fseek(file, 0L, SEEK_END);
-	size_t fileSize = ftell(file);
-	rewind(file);
+/* Runs a script, either source code or a bytecode file written by --compile-only
+ *      Source code is compiled as it is mapped or streamed in (see source.h), "-" reads it from standard input.
+ *
+ *  Returns:
+ *      The exit code of the script, 0 if it ran, 65 if it didn't compile or load, 70 if it failed at runtime, and 74
+ *      if it couldn't be read.
+ */
+static int runFile(VM* vm, const char* path, bool pretokenize, int jobs) {
+	InterpretResult result;
+	setScriptName(vm, path);
+
+	if (isBytecodeFile(path)) {
+		// Bytecode files only hold stack-based chunks
+		if (vm->backend != BACKEND_STACK) {
+			fprintf(stderr, "Bytecode file \"%s\" can't run on the register backend.\n", path);
+			return 64;
+		}
 
-	char* buffer = (char *)malloc(fileSize + 1);
+		BytecodeFile file;
+		if (!loadBytecode(path, &file)) return 65;
 
-	if (buffer == NULL) {
-		fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-		exit(74);
+		result = interpretChunk(vm, &file.chunk);
+		unloadBytecode(&file);
+	} else {
+		SourceFile source;
+		if (!openSource(&source, path)) return 74;
+
+		Scanner scanner;
+		TokenBuffer tokens;
+		startScanner(&source, &scanner, &tokens, pretokenize, jobs);
+		result = interpretSource(vm, &scanner);
+		freeTokenBuffer(&tokens);
+
+		bool failed = source.failed;
+		closeSource(&source);
+		if (failed) return 74;
 	}
 
-	size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+	if (result == INTERPRET_COMPILE_ERROR) return 65;
+	if (result == INTERPRET_RUNTIME_ERROR) return 70;
+	return 0;
+}
 
-	if (bytesRead < fileSize) {
-		fprintf(stderr, "Could not read file \"%s\".\n", path);
-		exit(74);
+/* Compiles a script and writes the chunk to a bytecode file or a C translation unit (see aot.c) instead of running it
+ *
+ *  Params:
+ *      path:       the script to compile
+ *      output:     the file to write, or NULL to replace the script's extension with ".cyb" or ".c"
+ *      emitC:      whether to write C rather than bytecode
+ */
+static void compileFile(VM* vm, const char* path, const char* output, bool emitC, bool pretokenize, int jobs) {
+	SourceFile source;
+	if (!openSource(&source, path)) exit(74);
+
+	Scanner scanner;
+	TokenBuffer tokens;
+	startScanner(&source, &scanner, &tokens, pretokenize, jobs);
+	Chunk chunk;
+	initChunk(&chunk);
+
+	bool compiled = compileChunk(vm, &scanner, &chunk);
+	freeTokenBuffer(&tokens);
+	bool failed = source.failed;
+	closeSource(&source);
+	if (failed) exit(74);
+	if (!compiled) exit(65);
+
+	char* defaultOutput = NULL;
+	if (output == NULL) {
+		const char* extension = strrchr(path, '.');
+		size_t stemLength = extension != NULL && strchr(extension, '/') == NULL ?
+		                    (size_t)(extension - path) : strlen(path);
+
+		defaultOutput = malloc(stemLength + sizeof(".cyb"));
+		if (defaultOutput == NULL) exit(74);
+		memcpy(defaultOutput, path, stemLength);
+		strcpy(defaultOutput + stemLength, emitC ? ".c" : ".cyb");
+		output = defaultOutput;
 	}
 
-	buffer[bytesRead] = '\0';
-
-	fclose(file);
-	return buffer;
+	bool written = emitC ? writeCSource(&chunk, path, output) : writeBytecode(&chunk, output);
+	freeChunk(&chunk);
+	free(defaultOutput);
+	if (!written) exit(74);
 }
 
-
-static void runFile(const char* path) {
-	char* source = readFile(path);
-	InterpretResult result = interpret(source);
-	free(source);
-
-	if (result == INTERPRET_COMPILE_ERROR) exit(65);
-	if (result == INTERPRET_RUNTIME_ERROR) exit (70);
+/* Prints how to use the program and exits
+ *
+ */
+static void usage() {
+	fprintf(stderr, "Usage: cynch [--register | --jit] [--no-optimize] [--opt-stats] [--mem-stats] [--mem-limit bytes]\n"
+	                "             [--pretokenize [--jobs n]] [--sample file [--sample-rate hz]] [path | -]\n"
+	                "       cynch --compile-only | --emit-c [-o output] [--pretokenize [--jobs n]] path\n"
+	                "       cynch --batch [--jobs n] [--manifest file] [--register | --jit] [--no-optimize] [--mem-limit bytes]\n"
+	                "             [--sample file [--sample-rate hz]] [path ...]\n");
+	exit(64);
 }
 
 int main(int argc, const char* argv[]) {
-	initVM();
+	VM vm;
+	if (!initVM(&vm)) exit(1);
+
+	const char* path = NULL;
+	const char* output = NULL;
+	bool optimize = true;
+	bool printOptimizeStats = false;
+	bool compileOnly = false;
+	bool emitC = false;
+	bool registerBackend = false;
+	bool jit = false;
+	bool batch = false;
+	bool printMemoryStats = false;
+	bool pretokenize = false;
+	size_t memoryLimit = 0;
+	int jobs = 0;
+	const char* samplePath = NULL;
+	int sampleRate = 0;
+	ScriptList scripts;
+	initScriptList(&scripts);
+	for (int arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "--register") == 0) {
+			registerBackend = true; // Compile to and run the register-based instruction set
+		} else if (strcmp(argv[arg], "--jit") == 0) {
+			jit = true; // Compile stack-based chunks to machine code before running them (see jit.c)
+		} else if (strcmp(argv[arg], "--no-optimize") == 0) {
+			optimize = false; // Run chunks exactly as the compiler emitted them
+		} else if (strcmp(argv[arg], "--opt-stats") == 0) {
+			printOptimizeStats = true; // Print instruction counts before and after the peephole optimizer
+		} else if (strcmp(argv[arg], "--mem-stats") == 0) {
+			printMemoryStats = true; // Print what the VM allocated once the script is done
+		} else if (strcmp(argv[arg], "--mem-limit") == 0 && arg + 1 < argc) {
+			char* end;
+			memoryLimit = strtoull(argv[++arg], &end, 10);
+			if (*end != '\0' || memoryLimit == 0) usage();
+		} else if (strcmp(argv[arg], "--compile-only") == 0) {
+			compileOnly = true; // Write the compiled chunk to a bytecode file instead of running it
+		} else if (strcmp(argv[arg], "--emit-c") == 0) {
+			compileOnly = true; // Write the compiled chunk as a C translation unit to build natively (see aot.c)
+			emitC = true;
+		} else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+			output = argv[++arg];
+		} else if (strcmp(argv[arg], "--pretokenize") == 0) {
+			pretokenize = true; // Scan the whole script on --jobs threads before compiling it (see tokens.c)
+		} else if (strcmp(argv[arg], "--batch") == 0) {
+			batch = true; // Run every script given on a pool of threads (see batch.c)
+		} else if (strcmp(argv[arg], "--jobs") == 0 && arg + 1 < argc) {
+			jobs = atoi(argv[++arg]);
+			if (jobs <= 0) usage();
+		} else if (strcmp(argv[arg], "--sample") == 0 && arg + 1 < argc) {
+			samplePath = argv[++arg]; // Sample where scripts spend their time and write it as collapsed stacks
+		} else if (strcmp(argv[arg], "--sample-rate") == 0 && arg + 1 < argc) {
+			sampleRate = atoi(argv[++arg]);
+			if (sampleRate <= 0) usage();
+		} else if (strcmp(argv[arg], "--manifest") == 0 && arg + 1 < argc) {
+			if (!readManifest(&scripts, argv[++arg])) exit(74);
+		} else if ((argv[arg][0] == '-' && argv[arg][1] != '\0') || (path != NULL && !batch)) {
+			usage();
+		} else {
+			path = argv[arg];
+			addScript(&scripts, path);
+		}
+	}
 
-	if (argc == 1) {
-		repl();
-	} else if (argc == 2) {
-		runFile(argv[1]);
+	// Bytecode files and generated C only hold stack-based chunks
+	if ((compileOnly && (path == NULL || registerBackend)) || (output != NULL && !compileOnly)) usage();
+	if (jit && (registerBackend || compileOnly)) usage(); // The JIT compiles stack-based chunks right before running them
+	if (compileOnly && output == NULL && strcmp(path, "-") == 0) usage(); // Nothing to name the output file after
+	if ((sampleRate != 0 && samplePath == NULL) || (samplePath != NULL && compileOnly)) usage();
+	if (batch ? compileOnly || printOptimizeStats || printMemoryStats || pretokenize :
+	            (jobs != 0 && !pretokenize) || scripts.count > (path != NULL)) usage();
+
+	if (registerBackend) setBackend(&vm, BACKEND_REGISTER);
+	setJit(&vm, jit);
+	setOptimizer(&vm, optimize, printOptimizeStats);
+	setMemoryLimit(&vm, memoryLimit);
+
+	if (samplePath != NULL && !startSampler(sampleRate)) {
+		fprintf(stderr, "Could not start the sampler.\n");
+		exit(70);
+	}
+
+	int exitCode = 0;
+	if (batch) {
+		BatchOptions options = {registerBackend ? BACKEND_REGISTER : BACKEND_STACK, optimize, jobs, memoryLimit, jit};
+		exitCode = runBatch(&scripts, &options);
+	} else if (compileOnly) {
+		compileFile(&vm, path, output, emitC, pretokenize, jobs);
+	} else if (path == NULL) {
+		repl(&vm);
 	} else {
-		fprintf(stderr, "Usage: cynch [path]\n");
-		exit(64);
+		exitCode = runFile(&vm, path, pretokenize, jobs);
 	}
 
-	freeVM();
-	return 0;
-}
\ No newline at end of file
+	if (samplePath != NULL && !stopSampler(samplePath) && exitCode == 0) exitCode = 74;
+
+	if (printMemoryStats) {
+		MemoryStats* stats = &vm.memory.stats;
+		fprintf(stderr, "[memory] live %zu bytes, peak %zu bytes, %llu allocations\n",
+		        stats->liveBytes, stats->peakBytes, (unsigned long long)stats->allocations);
+	}
+
+	freeScriptList(&scripts);
+	freeVM(&vm);
+	return exitCode;
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/memory.h"
 
@@ -15,4 +16,201 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 	void* result = realloc(pointer, newSize);
 	if (result == NULL) exit(1); // If realloc() fails, exit the program
 	return result;
-}
\ No newline at end of file
+}
+
+/* The heap allocator's function, reallocate() without exiting on failure
+ *
+ */
+static void* heapReallocate(void* state, void* pointer, size_t oldSize, size_t newSize) {
+	(void)state;
+	(void)oldSize;
+
+	if (newSize == 0) {
+		free(pointer);
+		return NULL;
+	}
+
+	return realloc(pointer, newSize);
+}
+
+const Allocator heapAllocator = {heapReallocate, NULL};
+
+/* Resizes memory with an allocator, or on the heap when there is none
+ *
+ *  Like reallocate(), the process exits if the memory can't be allocated (allocators that can recover, like a
+ *  MemoryTracker, unwind before returning).
+ */
+void* reallocateWith(const Allocator* allocator, void* pointer, size_t oldSize, size_t newSize) {
+	if (allocator == NULL) return reallocate(pointer, oldSize, newSize);
+
+	void* result = allocator->reallocate(allocator->state, pointer, oldSize, newSize);
+	if (result == NULL && newSize != 0) exit(1);
+	return result;
+}
+
+/* Rounds a size up to the arena's alignment
+ *
+ */
+static size_t alignSize(size_t size) {
+	return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+/* Moves the arena on to a block with room for an allocation, reusing blocks kept by resetArena() when they are big
+ *  enough and adding a new block after the current one otherwise
+ *
+ */
+static void nextBlock(Arena* arena, size_t size) {
+	ArenaBlock* next = arena->current == NULL ? arena->first : arena->current->next;
+
+	if (next == NULL || next->size < size) {
+		// Blocks start small so that arenas with little in them stay small, and double up to ARENA_BLOCK_SIZE
+		size_t blockSize = arena->current == NULL ? ARENA_MIN_BLOCK_SIZE : arena->current->size * 2;
+		if (blockSize > ARENA_BLOCK_SIZE) blockSize = ARENA_BLOCK_SIZE;
+		if (blockSize < size) blockSize = size;
+
+		ArenaBlock* block = reallocateWith(arena->parent, NULL, 0, sizeof(ArenaBlock) + blockSize);
+		block->size = blockSize;
+		block->next = next;
+		if (arena->current == NULL) {
+			arena->first = block;
+		} else {
+			arena->current->next = block;
+		}
+		next = block;
+	}
+
+	next->used = 0;
+	arena->current = next;
+}
+
+/* Allocates, grows, shrinks or frees memory in an arena, the function of the arena's allocator
+ *
+ *  Only the top allocation is resized or freed in place. Growing anything else copies it to a new allocation, and
+ *  freeing it does nothing: its memory comes back when the arena is reset.
+ *
+ *  Params:
+ *      state:      the arena the memory belongs to
+ *      pointer:    the memory to resize, NULL to allocate
+ *      oldSize:    the size the memory was allocated with
+ *      newSize:    the size wanted, 0 to free
+ *
+ *  Returns:
+ *      The resized memory, or NULL when freeing.
+ */
+static void* arenaReallocate(void* state, void* pointer, size_t oldSize, size_t newSize) {
+	Arena* arena = (Arena*)state;
+	ArenaBlock* block = arena->current;
+	bool isTop = pointer != NULL && pointer == arena->top;
+	size_t topOffset = isTop ? (size_t)((char*)pointer - block->data) : 0;
+
+	if (newSize == 0) {
+		if (isTop) {
+			block->used = topOffset;
+			arena->top = NULL;
+		}
+		return NULL;
+	}
+
+	size_t size = alignSize(newSize);
+	if (isTop && topOffset + size <= block->size) {
+		block->used = topOffset + size;
+		return pointer;
+	}
+
+	// The top is given back before moving on, so growing it in a fresh block doesn't waste the old space
+	if (isTop) block->used = topOffset;
+	if (block == NULL || block->used + size > block->size) nextBlock(arena, size);
+
+	block = arena->current;
+	void* result = block->data + block->used;
+	block->used += size;
+	arena->top = result;
+
+	if (pointer != NULL) memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+	return result;
+}
+
+/* Initializes an empty arena, blocks are only allocated once something is allocated from it
+ *
+ *  Params:
+ *      arena:      the arena to initialize
+ *      parent:     what allocates the arena's blocks, NULL for the heap
+ */
+void initArena(Arena* arena, const Allocator* parent) {
+	arena->allocator.reallocate = arenaReallocate;
+	arena->allocator.state = arena;
+	arena->parent = parent;
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->top = NULL;
+}
+
+/* Releases everything allocated from an arena at once, keeping its blocks for the allocations that follow
+ *
+ */
+void resetArena(Arena* arena) {
+	if (arena->first != NULL) arena->first->used = 0;
+	arena->current = arena->first;
+	arena->top = NULL;
+}
+
+/* Gives an arena's blocks back to its parent allocator
+ *
+ */
+void freeArena(Arena* arena) {
+	ArenaBlock* block = arena->first;
+	while (block != NULL) {
+		ArenaBlock* next = block->next;
+		reallocateWith(arena->parent, block, sizeof(ArenaBlock) + block->size, 0);
+		block = next;
+	}
+
+	initArena(arena, arena->parent);
+}
+
+/* Passes an allocation on to the tracker's parent allocator, counting it and enforcing the tracker's limit
+ *
+ */
+static void* trackedReallocate(void* state, void* pointer, size_t oldSize, size_t newSize) {
+	MemoryTracker* tracker = (MemoryTracker*)state;
+	MemoryStats* stats = &tracker->stats;
+
+	if (newSize == 0) {
+		stats->liveBytes -= oldSize;
+		return tracker->parent.reallocate(tracker->parent.state, pointer, oldSize, 0);
+	}
+
+	size_t liveBytes = stats->liveBytes - oldSize + newSize;
+	MemoryFailure failure = MEMORY_LIMIT_EXCEEDED;
+	void* result = NULL;
+	if (tracker->limit == 0 || liveBytes <= tracker->limit) {
+		failure = MEMORY_EXHAUSTED;
+		result = tracker->parent.reallocate(tracker->parent.state, pointer, oldSize, newSize);
+	}
+
+	if (result == NULL) {
+		if (tracker->recover != NULL) longjmp(*tracker->recover, failure);
+		exit(1); // Same as reallocate()
+	}
+
+	stats->liveBytes = liveBytes;
+	if (liveBytes > stats->peakBytes) stats->peakBytes = liveBytes;
+	stats->allocations++;
+	if (newSize > oldSize) stats->allocatedBytes += newSize - oldSize;
+	return result;
+}
+
+/* Initializes a tracker with no limit and no recovery point
+ *
+ *  Params:
+ *      tracker:    the tracker to initialize
+ *      parent:     the allocator to pass allocations on to, NULL for the heap
+ */
+void initMemoryTracker(MemoryTracker* tracker, const Allocator* parent) {
+	tracker->allocator.reallocate = trackedReallocate;
+	tracker->allocator.state = tracker;
+	tracker->parent = parent != NULL ? *parent : heapAllocator;
+	tracker->stats = (MemoryStats){0, 0, 0, 0};
+	tracker->limit = 0;
+	tracker->recover = NULL;
+}
@@ -0,0 +1,270 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "include/memory.h"
+#include "include/optimizer.h"
+
+// A decoded stack-based instruction
+typedef struct {
+	uint8_t op;
+	int constant;           // Constant table index of OP_CONSTANT and OP_CONSTANT_LONG, -1 for other instructions
+	SourcePosition position;
+} Instruction;
+
+// A growable list of decoded instructions
+typedef struct {
+	int count;
+	int capacity;
+	Instruction* instructions;
+	const Allocator* allocator; // The allocator of the chunk being optimized
+} InstructionList;
+
+/* Adds an instruction to the end of a list
+ *
+ */
+static void appendInstruction(InstructionList* list, Instruction instruction) {
+	if (list->capacity < list->count + 1) {
+		int oldCapacity = list->capacity;
+		list->capacity = GROW_CAPACITY(oldCapacity);
+		list->instructions = GROW_ARRAY(list->allocator, Instruction, list->instructions, oldCapacity, list->capacity);
+	}
+
+	list->instructions[list->count++] = instruction;
+}
+
+/* Gets an instruction counting back from the end of a list
+ *
+ *  Params:
+ *      list:       the list of instructions
+ *      distance:   0 for the last instruction, 1 for the one before it, ...
+ *
+ *  Returns:
+ *      A pointer to the instruction, or NULL if the list is not that long.
+ */
+static Instruction* peekInstruction(InstructionList* list, int distance) {
+	if (distance >= list->count) return NULL;
+	return &list->instructions[list->count - 1 - distance];
+}
+
+/* Checks if an instruction is a constant holding the given number
+ *
+ *  Numbers are compared bit for bit through their sign as well as their value, so 0 and -0 are told apart.
+ */
+static bool isNumberConstant(Chunk* chunk, Instruction* instruction, double number) {
+	if (instruction == NULL || instruction->constant < 0) return false;
+
+	Value value = chunk->constants.values[instruction->constant];
+	return IS_NUMBER(value) && AS_NUMBER(value) == number && signbit(AS_NUMBER(value)) == signbit(number);
+}
+
+/* Checks if the value an instruction leaves on top of the stack is guaranteed to be a number
+ *
+ *  Arithmetic instructions either produce a number or stop the VM with a runtime error, so removing an operation
+ *  applied to their result can never hide an error.
+ */
+static bool producesNumber(Chunk* chunk, Instruction* instruction) {
+	if (instruction == NULL) return false;
+
+	switch (instruction->op) {
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG:
+			return IS_NUMBER(chunk->constants.values[instruction->constant]);
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+		case OP_NEGATE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Rewrites the end of the optimized instruction list for as long as one of the peephole patterns matches it
+ *
+ *  Patterns (x is any instruction producing a number):
+ *      x NEGATE NEGATE         ->  x
+ *      CONSTANT(k) NEGATE      ->  CONSTANT(-k)
+ *      x CONSTANT(1) MULTIPLY  ->  x
+ *      x CONSTANT(1) DIVIDE    ->  x
+ *      x CONSTANT(0) SUBTRACT  ->  x
+ *      x CONSTANT(-0) ADD      ->  x
+ *
+ *  Only identities that hold for every double are used: x + 0 is not one of them, since -0 + 0 is 0.
+ */
+static void rewriteTail(Chunk* chunk, InstructionList* list) {
+	for (;;) {
+		Instruction* last = peekInstruction(list, 0);
+		Instruction* second = peekInstruction(list, 1);
+		Instruction* third = peekInstruction(list, 2);
+		if (last == NULL || second == NULL) return;
+
+		if (last->op == OP_NEGATE && second->op == OP_NEGATE && producesNumber(chunk, third)) {
+			list->count -= 2;
+			continue;
+		}
+
+		if (last->op == OP_NEGATE && second->constant >= 0 && producesNumber(chunk, second)) {
+			double negated = -AS_NUMBER(chunk->constants.values[second->constant]);
+			second->constant = addConstant(chunk, NUMBER_VAL(negated));
+			list->count -= 1;
+			continue;
+		}
+
+		if (producesNumber(chunk, third) &&
+		    ((last->op == OP_MULTIPLY && isNumberConstant(chunk, second, 1)) ||
+		     (last->op == OP_DIVIDE && isNumberConstant(chunk, second, 1)) ||
+		     (last->op == OP_SUBTRACT && isNumberConstant(chunk, second, 0)) ||
+		     (last->op == OP_ADD && isNumberConstant(chunk, second, -0.0)))) {
+			list->count -= 2;
+			continue;
+		}
+
+		return;
+	}
+}
+
+/* Finds the superinstruction doing the work of two instructions in a row
+ *
+ *  Returns:
+ *      The superinstruction's opcode, or -1 if the pair is not in SUPERINSTRUCTIONS (see chunk.h).
+ */
+static int fusedOpcode(uint8_t first, uint8_t second) {
+#define SUPERINSTRUCTION_FUSION(firstOp, secondOp) \
+	if (first == OP_##firstOp && second == OP_##secondOp) return OP_##firstOp##_##secondOp;
+	SUPERINSTRUCTIONS(SUPERINSTRUCTION_FUSION)
+#undef SUPERINSTRUCTION_FUSION
+
+	return -1;
+}
+
+/* Writes the operands of a decoded instruction
+ *
+ */
+static void writeOperands(Chunk* chunk, Instruction* instruction, SourcePosition position) {
+	int line = position.line;
+	int column = position.column;
+	if (instruction->op == OP_CONSTANT) {
+		writeChunk(chunk, (uint8_t)instruction->constant, line, column);
+	} else if (instruction->op == OP_CONSTANT_LONG) {
+		writeChunk(chunk, (uint8_t)(instruction->constant & 0xff), line, column);
+		writeChunk(chunk, (uint8_t)((instruction->constant >> 8) & 0xff), line, column);
+		writeChunk(chunk, (uint8_t)((instruction->constant >> 16) & 0xff), line, column);
+	}
+}
+
+/* Decodes an instruction and its operands
+ *
+ *  Params:
+ *      op:         the instruction's opcode, which may be one half of a superinstruction
+ *      operand:    where its operands start in the chunk's code
+ *      position:   the source position to give it
+ */
+static Instruction decodeInstruction(Chunk* chunk, uint8_t op, int operand, SourcePosition position) {
+	Instruction instruction = {op, -1, position};
+	if (op == OP_CONSTANT) {
+		instruction.constant = chunk->code[operand];
+	} else if (op == OP_CONSTANT_LONG) {
+		instruction.constant = chunk->code[operand] |
+		                       (chunk->code[operand + 1] << 8) |
+		                       (chunk->code[operand + 2] << 16);
+	}
+	return instruction;
+}
+
+/* Optimizes a chunk of stack-based instructions in place:
+ *      1. Decodes the instructions, applying the peephole patterns of rewriteTail() as each one is added. Quickened
+ *         instructions are decoded as their generic ones and superinstructions as their two instructions, so a chunk
+ *         that already ran or was already optimized can be optimized again
+ *      2. Compacts the constant table down to the constants that are still used, in order of first use, picking
+ *         OP_CONSTANT over OP_CONSTANT_LONG wherever the new index fits in a byte
+ *      3. Re-encodes the instructions, fusing pairs listed in SUPERINSTRUCTIONS into a single instruction, and
+ *         rebuilds the position table from the positions of the surviving instructions
+ *
+ *  Params:
+ *      chunk:      the chunk to optimize
+ *
+ *  Returns:
+ *      The number of instructions and bytes in the chunk before and after optimizing.
+ */
+OptimizeStats optimizeChunk(Chunk* chunk) {
+	OptimizeStats stats = {0, 0, chunk->count, 0, 0};
+	InstructionList list = {0, 0, NULL, chunk->allocator};
+	PositionCursor positions;
+	initPositionCursor(&positions, chunk);
+
+	for (int offset = 0; offset < chunk->count;) {
+		uint8_t op = genericOpcode(chunk->code[offset]);
+		SourcePosition position = seekPosition(&positions, offset);
+
+		switch (op) {
+// Both halves take the superinstruction's position, which is the one its second instruction had before fusing
+#define SUPERINSTRUCTION_DECODE(first, second) \
+			case OP_##first##_##second: \
+				appendInstruction(&list, decodeInstruction(chunk, OP_##first, offset + 1, position)); \
+				rewriteTail(chunk, &list); \
+				appendInstruction(&list, decodeInstruction(chunk, OP_##second, \
+				                                           offset + instructionSize(OP_##first), position)); \
+				rewriteTail(chunk, &list); \
+				stats.instructionsBefore += 2; \
+				break;
+			SUPERINSTRUCTIONS(SUPERINSTRUCTION_DECODE)
+#undef SUPERINSTRUCTION_DECODE
+
+			default:
+				appendInstruction(&list, decodeInstruction(chunk, op, offset + 1, position));
+				rewriteTail(chunk, &list);
+				stats.instructionsBefore++;
+				break;
+		}
+
+		offset += instructionSize(op);
+	}
+
+	Chunk optimized;
+	initChunkIn(&optimized, chunk->allocator);
+	optimized.quicken = chunk->quicken;
+
+	int remapCount = chunk->constants.count + 1;
+	int* remap = GROW_ARRAY(chunk->allocator, int, NULL, 0, remapCount);
+	for (int index = 0; index < chunk->constants.count; index++) remap[index] = -1;
+
+	for (int index = 0; index < list.count; index++) {
+		Instruction* instruction = &list.instructions[index];
+		if (instruction->constant < 0) continue;
+
+		if (remap[instruction->constant] < 0) {
+			remap[instruction->constant] = addConstant(&optimized, chunk->constants.values[instruction->constant]);
+		}
+		instruction->constant = remap[instruction->constant];
+		instruction->op = instruction->constant < 256 ? OP_CONSTANT : OP_CONSTANT_LONG;
+	}
+
+	for (int index = 0; index < list.count; index++) {
+		Instruction* instruction = &list.instructions[index];
+		Instruction* next = index + 1 < list.count ? &list.instructions[index + 1] : NULL;
+		int fused = next == NULL ? -1 : fusedOpcode(instruction->op, next->op);
+
+		if (fused >= 0) {
+			// Runtime errors come from the second instruction, so the superinstruction reports its position
+			SourcePosition position = next->position;
+			writeChunk(&optimized, (uint8_t)fused, position.line, position.column);
+			writeOperands(&optimized, instruction, position);
+			writeOperands(&optimized, next, position);
+			stats.superinstructions++;
+			index++;
+		} else {
+			writeChunk(&optimized, instruction->op, instruction->position.line, instruction->position.column);
+			writeOperands(&optimized, instruction, instruction->position);
+		}
+		stats.instructionsAfter++;
+	}
+
+	stats.bytesAfter = optimized.count;
+
+	FREE_ARRAY(chunk->allocator, int, remap, remapCount);
+	FREE_ARRAY(list.allocator, Instruction, list.instructions, list.capacity);
+	freeChunk(chunk);
+	*chunk = optimized;
+	return stats;
+}
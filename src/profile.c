@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "include/profile.h"
+
+#ifdef CYNCH_PROFILE
+
+#include <pthread.h>
+
+#include "include/debug.h"
+
+/* Every VM counts into profiles of its own, so running VMs never share a counter. Profiles are added to the totals
+ *  of their instruction set when their VM is freed, and profiles still in use at exit are added before the totals
+ *  are written out. The lock guards the totals and the list of live profiles.
+ */
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static OpcodeProfile profileTotals[2];
+static OpcodeProfile* liveProfiles = NULL;
+static bool dumpRegistered = false;
+
+// A pair of opcodes and how often the second directly followed the first
+typedef struct {
+	int first;
+	int second;
+	uint64_t count;
+} OpcodePair;
+
+/* Adds the counters of a profile to the totals of its instruction set, called with the lock held
+ *
+ */
+static void addToTotals(OpcodeProfile* profile) {
+	OpcodeProfile* totals = &profileTotals[profile->set];
+
+	for (int op = 0; op < 256; op++) {
+		totals->counts[op] += profile->counts[op];
+		totals->samples[op] += profile->samples[op];
+		totals->cycles[op] += profile->cycles[op];
+		for (int next = 0; next < 256; next++) totals->pairs[op][next] += profile->pairs[op][next];
+		for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+			totals->histogram[op][bucket] += profile->histogram[op][bucket];
+		}
+	}
+}
+
+/* Prepares a profile for a run of the VM, so that pairs are not counted across runs
+ *
+ */
+void beginProfileRun(OpcodeProfile* profile) {
+	profile->previous = -1;
+	profile->sampled = -1;
+}
+
+/* Finishes a run of the VM, timing the last instruction if it was being sampled
+ *
+ */
+void endProfileRun(OpcodeProfile* profile) {
+	if (profile->sampled >= 0) recordProfileSample(profile, readCycles());
+}
+
+/* Records the cycles taken by the instruction being sampled
+ *
+ *  Params:
+ *      profile:    the profile of the instruction set being executed
+ *      now:        the cycle counter at the end of the sampled instruction
+ */
+void recordProfileSample(OpcodeProfile* profile, uint64_t now) {
+	uint64_t cycles = now - profile->sampleStart;
+	int bucket = 0;
+	while (bucket < PROFILE_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0) bucket++;
+
+	profile->samples[profile->sampled]++;
+	profile->cycles[profile->sampled] += cycles;
+	profile->histogram[profile->sampled][bucket]++;
+	profile->sampled = -1;
+}
+
+/* Orders opcode pairs from most to least frequent
+ *
+ */
+static int comparePairs(const void* a, const void* b) {
+	uint64_t countA = ((const OpcodePair*)a)->count;
+	uint64_t countB = ((const OpcodePair*)b)->count;
+	return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+/* Writes the counters of one instruction set as a JSON object
+ *
+ *  Params:
+ *      file:       where to write the JSON
+ *      profile:    the counters to write
+ *      name:       converts an opcode into its name
+ */
+static void writeProfile(FILE* file, OpcodeProfile* profile, const char* (*name)(uint8_t)) {
+	uint64_t total = 0;
+	for (int op = 0; op < 256; op++) total += profile->counts[op];
+
+	fprintf(file, "{\n    \"instructions\": %llu,\n    \"opcodes\": [", (unsigned long long)total);
+	bool first = true;
+	for (int op = 0; op < 256; op++) {
+		if (profile->counts[op] == 0) continue;
+
+		fprintf(file, "%s\n      {\"opcode\": \"%s\", \"count\": %llu, \"samples\": %llu, \"cycles\": %llu, "
+		              "\"mean_cycles\": %.2f, \"histogram\": [",
+		        first ? "" : ",", name((uint8_t)op), (unsigned long long)profile->counts[op],
+		        (unsigned long long)profile->samples[op], (unsigned long long)profile->cycles[op],
+		        profile->samples[op] == 0 ? 0.0 : (double)profile->cycles[op] / (double)profile->samples[op]);
+		for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+			fprintf(file, "%s%llu", bucket == 0 ? "" : ", ", (unsigned long long)profile->histogram[op][bucket]);
+		}
+		fprintf(file, "]}");
+		first = false;
+	}
+	fprintf(file, "\n    ],\n    \"pairs\": [");
+
+	// Pairs are listed from most to least frequent, the candidates for superinstructions come first
+	int pairCount = 0;
+	OpcodePair* pairs = malloc(sizeof(OpcodePair) * 256 * 256);
+	if (pairs != NULL) {
+		for (int a = 0; a < 256; a++) {
+			for (int b = 0; b < 256; b++) {
+				if (profile->pairs[a][b] == 0) continue;
+				pairs[pairCount++] = (OpcodePair){a, b, profile->pairs[a][b]};
+			}
+		}
+		qsort(pairs, pairCount, sizeof(OpcodePair), comparePairs);
+	}
+
+	for (int index = 0; index < pairCount; index++) {
+		fprintf(file, "%s\n      {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}", index == 0 ? "" : ",",
+		        name((uint8_t)pairs[index].first), name((uint8_t)pairs[index].second),
+		        (unsigned long long)pairs[index].count);
+	}
+	free(pairs);
+	fprintf(file, "\n    ]\n  }");
+}
+
+static void dumpProfile();
+
+/* Creates the profile of one instruction set for a VM
+ *
+ *  The first profile created arranges for the totals to be written out when the program exits.
+ *
+ *  Returns:
+ *      The profile, with its counters cleared.
+ */
+OpcodeProfile* newProfile(ProfileSet set) {
+	OpcodeProfile* profile = calloc(1, sizeof(OpcodeProfile));
+	if (profile == NULL) {
+		fprintf(stderr, "Could not allocate a profile.\n");
+		exit(1);
+	}
+
+	profile->previous = -1;
+	profile->sampled = -1;
+	profile->countdown = PROFILE_SAMPLE_PERIOD;
+	profile->seed = 2463534242u;
+	profile->set = set;
+
+	pthread_mutex_lock(&profileLock);
+	profile->next = liveProfiles;
+	liveProfiles = profile;
+	if (!dumpRegistered) {
+		atexit(dumpProfile);
+		dumpRegistered = true;
+	}
+	pthread_mutex_unlock(&profileLock);
+
+	return profile;
+}
+
+/* Adds a VM's profile to the totals and frees it
+ *
+ */
+void releaseProfile(OpcodeProfile* profile) {
+	pthread_mutex_lock(&profileLock);
+	addToTotals(profile);
+	for (OpcodeProfile** link = &liveProfiles; *link != NULL; link = &(*link)->next) {
+		if (*link == profile) {
+			*link = profile->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&profileLock);
+
+	free(profile);
+}
+
+/* Writes the totals of every instruction set as JSON, registered with atexit() by newProfile()
+ *
+ *  The output goes to the file named by the CYNCH_PROFILE_OUT environment variable, or cynch-profile.json.
+ */
+static void dumpProfile() {
+	pthread_mutex_lock(&profileLock);
+	for (OpcodeProfile* profile = liveProfiles; profile != NULL; profile = profile->next) addToTotals(profile);
+	liveProfiles = NULL;
+	pthread_mutex_unlock(&profileLock);
+
+	const char* path = getenv("CYNCH_PROFILE_OUT");
+	if (path == NULL) path = "cynch-profile.json";
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not write profile \"%s\".\n", path);
+		return;
+	}
+
+	fprintf(file, "{\n  \"sample_period\": %d,\n  \"cycle_source\": \"%s\",\n  \"stack\": ",
+	        PROFILE_SAMPLE_PERIOD, PROFILE_CYCLE_SOURCE);
+	writeProfile(file, &profileTotals[PROFILE_STACK], opcodeName);
+	fprintf(file, ",\n  \"register\": ");
+	writeProfile(file, &profileTotals[PROFILE_REGISTER], registerOpcodeName);
+	fprintf(file, "\n}\n");
+	fclose(file);
+}
+
+#endif
@@ -0,0 +1,273 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "include/sampler.h"
+
+/* A sampling profiler for scripts, cheap enough to leave on for real workloads
+ *
+ *  An ITIMER_PROF timer raises SIGPROF every 1/frequency seconds of CPU time the process uses. The handler runs on
+ *  whichever thread was using the CPU and counts a sample at the offset that thread's VM is executing, or outside of
+ *  the VM when it isn't running a chunk. When a run ends, its samples are resolved to the source line of the code
+ *  they landed in, and added to the totals as stacks of the form "script;line N". The totals are written in the
+ *  collapsed stack format read by flamegraph.pl, inferno and speedscope.
+ *
+ *  The handler does a thread-local load, a load of the VM's instruction pointer and an increment or two, so the
+ *  overhead is that of the signal itself: a few microseconds per sample, well under 0.1% at the default frequency.
+ */
+
+// The samples of a stack, added up over every run
+typedef struct {
+	char* stack;
+	uint32_t hash;
+	uint64_t count;
+} StackCount;
+
+static _Thread_local SampledRun* currentRun = NULL;
+static bool running = false;
+static uint64_t outsideSamples = 0;         // Samples taken while no chunk was running, added to by the handler
+static struct sigaction previousAction;
+
+// The totals of every stack, an open addressing hash table guarded by the lock
+static pthread_mutex_t stackLock = PTHREAD_MUTEX_INITIALIZER;
+static StackCount* stacks = NULL;
+static int stackCount = 0;
+static int stackCapacity = 0;
+
+/* Counts a sample where the thread that took the SIGPROF is, which is the only thing done with the signal
+ *
+ */
+static void handleSample(int signal) {
+	(void)signal;
+	SampledRun* run = currentRun;
+	if (run == NULL) {
+		__atomic_fetch_add(&outsideSamples, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	// The instruction pointer is past the opcode being executed, or on the first one before anything ran
+	const uint8_t* ip = *(uint8_t* const volatile*)run->ip;
+	ptrdiff_t offset = ip - run->chunk->code - 1;
+	if (offset < 0) offset = 0;
+	if (offset < run->chunk->count && run->counts[offset]++ == 0) run->touched[run->touchedCount++] = (uint32_t)offset;
+}
+
+/* Hashes a stack with FNV-1a
+ *
+ */
+static uint32_t hashStack(const char* stack) {
+	uint32_t hash = 2166136261u;
+	for (const char* character = stack; *character != '\0'; character++) {
+		hash ^= (uint8_t)*character;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Adds samples to the total of a stack, called with the lock held
+ *
+ *  Samples of a stack that can't be stored for lack of memory are dropped.
+ */
+static void addStack(const char* stack, uint64_t count) {
+	if (stackCount + 1 > stackCapacity * 3 / 4) {
+		int capacity = stackCapacity < 64 ? 64 : stackCapacity * 2;
+		StackCount* grown = calloc(capacity, sizeof(StackCount));
+		if (grown == NULL) return;
+
+		for (int index = 0; index < stackCapacity; index++) {
+			if (stacks[index].stack == NULL) continue;
+			int slot = (int)(stacks[index].hash & (capacity - 1));
+			while (grown[slot].stack != NULL) slot = (slot + 1) & (capacity - 1);
+			grown[slot] = stacks[index];
+		}
+
+		free(stacks);
+		stacks = grown;
+		stackCapacity = capacity;
+	}
+
+	uint32_t hash = hashStack(stack);
+	int slot = (int)(hash & (stackCapacity - 1));
+	while (stacks[slot].stack != NULL) {
+		if (stacks[slot].hash == hash && strcmp(stacks[slot].stack, stack) == 0) {
+			stacks[slot].count += count;
+			return;
+		}
+		slot = (slot + 1) & (stackCapacity - 1);
+	}
+
+	char* copy = strdup(stack);
+	if (copy == NULL) return;
+	stacks[slot] = (StackCount){copy, hash, count};
+	stackCount++;
+}
+
+/* Starts sampling every thread's VM
+ *
+ *  Params:
+ *      frequency:  samples a second of CPU time, 0 for SAMPLER_DEFAULT_FREQUENCY
+ *
+ *  Returns:
+ *      True if the timer was started, false if the sampler was already running or the timer couldn't be set.
+ */
+bool startSampler(int frequency) {
+	if (running) return false;
+	if (frequency <= 0) frequency = SAMPLER_DEFAULT_FREQUENCY;
+
+	struct sigaction action;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;     // Reads interrupted by a sample carry on rather than fail
+	action.sa_handler = handleSample;
+	if (sigaction(SIGPROF, &action, &previousAction) != 0) return false;
+
+	__atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+	long interval = 1000000 / frequency;
+	if (interval < 1) interval = 1;
+	struct itimerval timer;
+	timer.it_interval.tv_sec = interval / 1000000;
+	timer.it_interval.tv_usec = interval % 1000000;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+		__atomic_store_n(&running, false, __ATOMIC_RELEASE);
+		sigaction(SIGPROF, &previousAction, NULL);
+		return false;
+	}
+
+	return true;
+}
+
+/* Stops the sampler and writes the samples in the collapsed stack format, one "stack count" line per stack
+ *      Samples taken outside of any run are listed under the single frame "[outside the VM]".
+ *
+ *  Params:
+ *      path:       the file to write the samples to
+ *
+ *  Returns:
+ *      True if the samples were written, false if the file couldn't be.
+ */
+bool stopSampler(const char* path) {
+	if (!running) return false;
+
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	sigaction(SIGPROF, &previousAction, NULL);
+	__atomic_store_n(&running, false, __ATOMIC_RELEASE);
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL) fprintf(stderr, "Could not write samples \"%s\".\n", path);
+
+	pthread_mutex_lock(&stackLock);
+	for (int index = 0; index < stackCapacity; index++) {
+		if (stacks[index].stack == NULL) continue;
+		if (file != NULL) fprintf(file, "%s %llu\n", stacks[index].stack, (unsigned long long)stacks[index].count);
+		free(stacks[index].stack);
+	}
+	free(stacks);
+	stacks = NULL;
+	stackCount = 0;
+	stackCapacity = 0;
+	pthread_mutex_unlock(&stackLock);
+
+	uint64_t outside = __atomic_exchange_n(&outsideSamples, 0, __ATOMIC_RELAXED);
+	if (file == NULL) return false;
+	if (outside != 0) fprintf(file, "[outside the VM] %llu\n", (unsigned long long)outside);
+	return fclose(file) == 0;
+}
+
+/* Checks whether the sampler is running, so that VMs only prepare for samples when they can be taken
+ *
+ */
+bool samplerRunning() {
+	return __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+}
+
+void initSampledRun(SampledRun* run) {
+	run->counts = NULL;
+	run->touched = NULL;
+	run->touchedCount = 0;
+	run->capacity = 0;
+	run->chunk = NULL;
+	run->ip = NULL;
+	run->script = NULL;
+	run->enclosing = NULL;
+}
+
+void freeSampledRun(SampledRun* run) {
+	free(run->counts);
+	free(run->touched);
+	initSampledRun(run);
+}
+
+/* Starts taking samples of a chunk on this thread, before the VM runs it
+ *      If there is no memory for the counts, the run is not sampled.
+ *
+ *  Params:
+ *      run:        the run's counts, reused from the previous run
+ *      chunk:      the chunk about to run
+ *      ip:         the VM's instruction pointer, which must stay valid until endSampledRun()
+ *      script:     the name of the script the chunk was compiled from, NULL for "script"
+ */
+void beginSampledRun(SampledRun* run, const Chunk* chunk, uint8_t* const* ip, const char* script) {
+	run->chunk = NULL;
+	if (chunk->count > run->capacity) {
+		uint32_t* counts = realloc(run->counts, sizeof(uint32_t) * chunk->count);
+		if (counts != NULL) {
+			memset(counts + run->capacity, 0, sizeof(uint32_t) * (chunk->count - run->capacity));
+			run->counts = counts;
+		}
+		uint32_t* touched = realloc(run->touched, sizeof(uint32_t) * chunk->count);
+		if (touched != NULL) run->touched = touched;
+		if (counts == NULL || touched == NULL) return;
+		run->capacity = chunk->count;
+	}
+
+	run->chunk = chunk;
+	run->ip = ip;
+	run->script = script != NULL ? script : "script";
+	run->touchedCount = 0;
+	run->enclosing = currentRun;
+
+	// The handler must not see the run before it is filled in
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	currentRun = run;
+}
+
+/* Stops taking samples of a chunk, and adds them to the totals by source line
+ *      Only the offsets that were sampled are looked up, and their counts cleared for the next run, so a run costs
+ *      nothing more than it did unless it was sampled, and then a position lookup for each offset.
+ *
+ */
+void endSampledRun(SampledRun* run) {
+	if (run->chunk == NULL) return;
+
+	currentRun = run->enclosing;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+	const Chunk* chunk = run->chunk;
+	run->chunk = NULL;
+	if (run->touchedCount == 0) return;
+
+	// Frames are split on ';' and the count on the last space, so neither may appear in the script's frame
+	char script[256];
+	size_t length = 0;
+	for (const char* character = run->script; *character != '\0' && length < sizeof(script) - 1; character++) {
+		script[length++] = *character == ';' || *character == ' ' || *character == '\n' ? '_' : *character;
+	}
+	script[length] = '\0';
+
+	pthread_mutex_lock(&stackLock);
+	for (uint32_t index = 0; index < run->touchedCount; index++) {
+		uint32_t offset = run->touched[index];
+		SourcePosition position = getPosition(chunk, (int)offset);
+
+		char stack[288];
+		snprintf(stack, sizeof(stack), "%s;line %d", script, position.line);
+		addStack(stack, run->counts[offset]);
+		run->counts[offset] = 0;
+	}
+	pthread_mutex_unlock(&stackLock);
+}
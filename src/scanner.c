@@ -1,55 +1,319 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "include/common.h"
 #include "include/scanner.h"
+#include "include/tokens.h"
 
-typedef struct {
-	const char* start;
-	const char* current;
-	int line;
-} Scanner;
+/* Initializes a scanner struct
+ *
+ *  Params:
+ *      scanner:     the scanner to initialize
+ *      source:      the source of the tokens to be scanned, which needs no terminator
+ *      length:      the number of characters in the source
+ */
+void initScanner(Scanner* scanner, const char* source, size_t length) {
+	scanner->start = source;
+	scanner->current = source;
+	scanner->end = source + length;
+	scanner->line = 1;
+	scanner->startLine = 1;
+	scanner->startColumn = 1;
+	scanner->lineStart = source;
+	scanner->lineColumns = 0;
+	scanner->stream = NULL;
+	scanner->pinned = NULL;
+	scanner->tokens = NULL;
+	scanner->nextToken = 0;
+}
 
-Scanner scanner;
+/* Initializes a scanner for a source that is read as it is scanned, starting with nothing
+ *
+ *  Params:
+ *      scanner:     the scanner to initialize
+ *      stream:      where the windows of the source come from
+ */
+void initStreamScanner(Scanner* scanner, SourceStream* stream) {
+	initScanner(scanner, "", 0);
+	scanner->stream = stream;
+}
 
-/* Initializes a scanner struct
+/* Initializes a scanner that hands out tokens scanned ahead of time, ending with their TOKEN_EOF
  *
  *  Params:
- *      source:      the source of the tokens to be scanned
+ *      scanner:     the scanner to initialize
+ *      tokens:      the tokens, which must outlive the scanner
  */
-void initScanner(const char* source) {
-	scanner.start = source;
-	scanner.current = source;
-	scanner.line = 1;
+void initTokenScanner(Scanner* scanner, const TokenBuffer* tokens) {
+	initScanner(scanner, tokens->source, 0);
+	scanner->tokens = tokens;
 }
 
+#define SCANNER_LOOKAHEAD 2       // The most characters past a token that decide it, the ".5" after the "1" of "1.5"
+
+/* Character tables
+ *
+ *  Every decision the scanner makes on a single character is a lookup in one of two tables indexed by the
+ *  character: charFlags holds the classes a character belongs to, and charRules what token a character starts.
+ */
+#define CHAR_SPACE 0x01         // ' ', '\t', '\r' and '\n'
+#define CHAR_DIGIT 0x02
+#define CHAR_ALPHA 0x04         // Letters and '_'
+
+#define _ 0
+#define S CHAR_SPACE
+#define D CHAR_DIGIT
+#define A CHAR_ALPHA
+static const uint8_t charFlags[256] = {
+	_, _, _, _, _, _, _, _, _, S, S, _, _, S, _, _,     // 0x00
+	_, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,     // 0x10
+	S, _, _, _, _, _, _, _, _, _, _, _, _, _, _, _,     // 0x20   !"#$%&'()*+,-./
+	D, D, D, D, D, D, D, D, D, D, _, _, _, _, _, _,     // 0x30  0123456789:;<=>?
+	_, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,     // 0x40  @ABCDEFGHIJKLMNO
+	A, A, A, A, A, A, A, A, A, A, A, _, _, _, _, A,     // 0x50  PQRSTUVWXYZ[\]^_
+	_, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,     // 0x60  `abcdefghijklmno
+	A, A, A, A, A, A, A, A, A, A, A, _, _, _, _, _,     // 0x70  pqrstuvwxyz{|}~
+	// Everything above 0x7f is in no class
+};
+#undef _
+#undef S
+#undef D
+#undef A
+
+// What scanToken() does with the first character of a token
+typedef enum {
+	RULE_ERROR,             // The character can't start a token
+	RULE_SINGLE,            // The character is a token of its own
+	RULE_EQUALS,            // The character is a token, or another one when followed by '='
+	RULE_NUMBER,
+	RULE_IDENTIFIER,
+	RULE_STRING,
+} RuleAction;
+
+typedef struct {
+	uint8_t action;         // A RuleAction
+	uint8_t type;           // The token of a RULE_SINGLE or RULE_EQUALS character
+	uint8_t equalType;      // The token of a RULE_EQUALS character followed by '='
+} CharRule;
+
+#define SINGLE(type)            {RULE_SINGLE, type, 0}
+#define EQUALS(type, equalType) {RULE_EQUALS, type, equalType}
+#define DIGIT                   {RULE_NUMBER, 0, 0}
+#define ALPHA                   {RULE_IDENTIFIER, 0, 0}
+static const CharRule charRules[256] = {
+	['('] = SINGLE(TOKEN_LEFT_PAREN),  [')'] = SINGLE(TOKEN_RIGHT_PAREN),
+	['{'] = SINGLE(TOKEN_LEFT_BRACE),  ['}'] = SINGLE(TOKEN_RIGHT_BRACE),
+	[';'] = SINGLE(TOKEN_SEMICOLON),   [','] = SINGLE(TOKEN_COMMA),
+	['.'] = SINGLE(TOKEN_DOT),         ['-'] = SINGLE(TOKEN_MINUS),
+	['+'] = SINGLE(TOKEN_PLUS),        ['/'] = SINGLE(TOKEN_SLASH),
+	['*'] = SINGLE(TOKEN_STAR),
+	['!'] = EQUALS(TOKEN_BANG, TOKEN_BANG_EQUAL),
+	['='] = EQUALS(TOKEN_EQUAL, TOKEN_EQUAL_EQUAL),
+	['<'] = EQUALS(TOKEN_LESS, TOKEN_LESS_EQUAL),
+	['>'] = EQUALS(TOKEN_GREATER, TOKEN_GREATER_EQUAL),
+	['"'] = {RULE_STRING, 0, 0},
+	['0'] = DIGIT, ['1'] = DIGIT, ['2'] = DIGIT, ['3'] = DIGIT, ['4'] = DIGIT,
+	['5'] = DIGIT, ['6'] = DIGIT, ['7'] = DIGIT, ['8'] = DIGIT, ['9'] = DIGIT,
+	['a'] = ALPHA, ['b'] = ALPHA, ['c'] = ALPHA, ['d'] = ALPHA, ['e'] = ALPHA, ['f'] = ALPHA, ['g'] = ALPHA,
+	['h'] = ALPHA, ['i'] = ALPHA, ['j'] = ALPHA, ['k'] = ALPHA, ['l'] = ALPHA, ['m'] = ALPHA, ['n'] = ALPHA,
+	['o'] = ALPHA, ['p'] = ALPHA, ['q'] = ALPHA, ['r'] = ALPHA, ['s'] = ALPHA, ['t'] = ALPHA, ['u'] = ALPHA,
+	['v'] = ALPHA, ['w'] = ALPHA, ['x'] = ALPHA, ['y'] = ALPHA, ['z'] = ALPHA,
+	['A'] = ALPHA, ['B'] = ALPHA, ['C'] = ALPHA, ['D'] = ALPHA, ['E'] = ALPHA, ['F'] = ALPHA, ['G'] = ALPHA,
+	['H'] = ALPHA, ['I'] = ALPHA, ['J'] = ALPHA, ['K'] = ALPHA, ['L'] = ALPHA, ['M'] = ALPHA, ['N'] = ALPHA,
+	['O'] = ALPHA, ['P'] = ALPHA, ['Q'] = ALPHA, ['R'] = ALPHA, ['S'] = ALPHA, ['T'] = ALPHA, ['U'] = ALPHA,
+	['V'] = ALPHA, ['W'] = ALPHA, ['X'] = ALPHA, ['Y'] = ALPHA, ['Z'] = ALPHA, ['_'] = ALPHA,
+	// Everything else is RULE_ERROR
+};
+#undef SINGLE
+#undef EQUALS
+#undef DIGIT
+#undef ALPHA
+
 /* Checks if the given character is a digit
  *
  *  Returns:
  *      True if the character is a digit, false otherwise.
  */
 static bool isDigit(char c) {
-	return c >= '0' && c <= '9';
+	return charFlags[(unsigned char)c] & CHAR_DIGIT;
+}
+
+/* Runs of characters
+ *
+ *  Whitespace, comment bodies, identifiers and numbers are runs of characters of one class, so the scanner finds
+ *  where they end a whole vector of characters at a time: it classifies LANE_WIDTH characters at once into a bit mask
+ *  and takes the first character outside the class from the mask's trailing zeros. Newlines are counted from the
+ *  same masks, so the line stays exact without looking at each character.
+ *
+ *  The vectors are loaded from addresses aligned to LANE_WIDTH, starting with the one holding the first character,
+ *  and only while that address is before the end of the source. An aligned load never crosses a page, so the
+ *  characters it reads past the end are on a page the source is on, and reading them can't fault. Characters before
+ *  the run's start are masked off, and characters from the end on are treated as outside every class.
+ */
+typedef enum {
+	CLASS_SPACE,            // ' ', '\t', '\r' and '\n'
+	CLASS_COMMENT,          // Anything but '\n'
+	CLASS_IDENTIFIER,       // Letters, digits and '_'
+	CLASS_DIGIT,
+} CharClass;
+
+/* Checks if a character belongs to a class, one character at a time
+ *
+ */
+static bool inClass(char c, CharClass charClass) {
+	switch (charClass) {
+		case CLASS_SPACE:      return charFlags[(unsigned char)c] & CHAR_SPACE;
+		case CLASS_COMMENT:    return c != '\n';
+		case CLASS_IDENTIFIER: return charFlags[(unsigned char)c] & (CHAR_ALPHA | CHAR_DIGIT);
+		case CLASS_DIGIT:      return charFlags[(unsigned char)c] & CHAR_DIGIT;
+	}
+
+	return false;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#ifdef __AVX2__
+#define LANE_WIDTH 32
+#define LANE_ALL 0xffffffffu
+typedef __m256i Lanes;
+#define loadLanes(pointer)       _mm256_load_si256((const __m256i*)(pointer))
+#define splatLanes(c)            _mm256_set1_epi8(c)
+#define equalLanes(a, b)         _mm256_cmpeq_epi8(a, b)
+#define greaterLanes(a, b)       _mm256_cmpgt_epi8(a, b)
+#define orLanes(a, b)            _mm256_or_si256(a, b)
+#define andLanes(a, b)           _mm256_and_si256(a, b)
+#define maskLanes(a)             ((uint32_t)_mm256_movemask_epi8(a))
+#else
+#define LANE_WIDTH 16
+#define LANE_ALL 0xffffu
+typedef __m128i Lanes;
+#define loadLanes(pointer)       _mm_load_si128((const __m128i*)(pointer))
+#define splatLanes(c)            _mm_set1_epi8(c)
+#define equalLanes(a, b)         _mm_cmpeq_epi8(a, b)
+#define greaterLanes(a, b)       _mm_cmpgt_epi8(a, b)
+#define orLanes(a, b)            _mm_or_si128(a, b)
+#define andLanes(a, b)           _mm_and_si128(a, b)
+#define maskLanes(a)             ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#define SCALAR_RUN 4             // Characters checked one at a time before switching to vectors
+
+// Lanes holding characters from low to high, compared signed: characters above 0x7f are negative and in no range
+#define rangeLanes(lanes, low, high) \
+	andLanes(greaterLanes(lanes, splatLanes((low) - 1)), greaterLanes(splatLanes((high) + 1), lanes))
+
+/* Classifies a vector of characters
+ *
+ *  Returns:
+ *      A mask with a bit set for each character in the class, the first character in the lowest bit.
+ */
+static inline uint32_t classifyLanes(Lanes lanes, CharClass charClass) {
+	switch (charClass) {
+		case CLASS_SPACE:
+			return maskLanes(orLanes(orLanes(equalLanes(lanes, splatLanes(' ')), equalLanes(lanes, splatLanes('\t'))),
+			                         orLanes(equalLanes(lanes, splatLanes('\r')), equalLanes(lanes, splatLanes('\n')))));
+		case CLASS_COMMENT:
+			return ~maskLanes(equalLanes(lanes, splatLanes('\n'))) & LANE_ALL;
+		case CLASS_IDENTIFIER: {
+			// Setting 0x20 folds upper case letters onto lower case ones without moving anything else into a-z
+			Lanes folded = orLanes(lanes, splatLanes(0x20));
+			return maskLanes(orLanes(orLanes(rangeLanes(folded, 'a', 'z'), rangeLanes(lanes, '0', '9')),
+			                         equalLanes(lanes, splatLanes('_'))));
+		}
+		case CLASS_DIGIT:
+			return maskLanes(rangeLanes(lanes, '0', '9'));
+	}
+
+	return 0;
+}
+
+/* Finds the end of a run of characters of a class
+ *
+ *  The loads read whole aligned vectors around the run, which AddressSanitizer would report past the end of the
+ *  source even though they can't fault (see above).
+ *
+ *  Params:
+ *      start:      the first character of the run
+ *      end:        the end of the source, which ends every run
+ *      charClass:  the class of the run's characters
+ *      line:       the line to add the run's newlines to
+ *
+ *  Returns:
+ *      The first character after the run.
+ */
+#ifdef __SANITIZE_ADDRESS__
+__attribute__((no_sanitize_address))
+#endif
+static inline const char* runEnd(const char* start, const char* end, CharClass charClass, int* line) {
+	// Most runs in real code are a few characters long, shorter than it takes to set up a vector
+	for (int scalar = 0; scalar < SCALAR_RUN; scalar++) {
+		if (start == end || !inClass(*start, charClass)) return start;
+		if (*start == '\n') (*line)++;
+		start++;
+	}
+
+	size_t offset = (uintptr_t)start % LANE_WIDTH;
+	const char* block = start - offset;
+	uint32_t inRun = (LANE_ALL << offset) & LANE_ALL;
+
+	for (;;) {
+		if (block >= end) return end;
+
+		Lanes lanes = loadLanes(block);
+		uint32_t ends = ~classifyLanes(lanes, charClass) & inRun;
+		if (end - block < LANE_WIDTH) ends |= 1u << (end - block);
+
+		uint32_t newlines = 0;
+		if (charClass == CLASS_SPACE) newlines = maskLanes(equalLanes(lanes, splatLanes('\n'))) & inRun;
+
+		if (ends != 0) {
+			int runLength = __builtin_ctz(ends);
+			*line += __builtin_popcount(newlines & ((1u << runLength) - 1));
+			return block + runLength;
+		}
+
+		*line += __builtin_popcount(newlines);
+		block += LANE_WIDTH;
+		inRun = LANE_ALL;
+	}
 }
 
-/* Checks if the given character is a letter or underscore
+#else
+
+/* Finds the end of a run of characters of a class, one character at a time
+ *
+ *  Params:
+ *      start:      the first character of the run
+ *      end:        the end of the source, which ends every run
+ *      charClass:  the class of the run's characters
+ *      line:       the line to add the run's newlines to
  *
  *  Returns:
- *      True if the character is a letter or underscore, false otherwise.
+ *      The first character after the run.
  */
-static bool isAlpha(char c) {
-	return (c >= 'a' && c <= 'z') ||
-			(c >= 'A' && c <= 'Z') ||
-			c == '_';
+static inline const char* runEnd(const char* start, const char* end, CharClass charClass, int* line) {
+	while (start < end && inClass(*start, charClass)) {
+		if (*start == '\n') (*line)++;
+		start++;
+	}
+
+	return start;
 }
 
-/* Checks if the scanner is at the end of the file (last token is NULL)
+#endif
+
+/* Checks if the scanner is at the end of the source it has
  *
  *  Returns:
- *      True if at the end of the file, false otherwise.
+ *      True if at the end of the source, false otherwise.
  */
-static bool isAtEnd() {
-	return *scanner.current == '\0';
+static bool isAtEnd(Scanner* scanner) {
+	return scanner->current >= scanner->end;
 }
 
 /* Advances to the next character in the source
@@ -57,9 +321,9 @@ static bool isAtEnd() {
  *  Returns:
  *      The next character in the source.
  */
-static char advance() {
-	scanner.current++;
-	return scanner.current[-1];
+static char advance(Scanner* scanner) {
+	scanner->current++;
+	return scanner->current[-1];
 }
 
 /* Returns the current character without consuming it
@@ -67,8 +331,9 @@ static char advance() {
  *  Returns:
  *      Returns the current character in the source
  */
-static char peek() {
-	return *scanner.current;
+static char peek(Scanner* scanner) {
+	if (isAtEnd(scanner)) return '\0';
+	return *scanner->current;
 }
 
 /* Checks the next character without consuming it
@@ -76,9 +341,9 @@ static char peek() {
  *  Returns:
  *      Returns the next character in the source
  */
-static char peekNext() {
-	if (isAtEnd()) return '\0';
-	return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+	if (scanner->current + 1 >= scanner->end) return '\0';
+	return scanner->current[1];
 }
 
 /* Checks if the next character in the source code matches what is expected
@@ -89,10 +354,10 @@ static char peekNext() {
  *  Returns:
  *      True of the next character is expected, false otherwise.
  */
-static bool match(char expected) {
-	if (isAtEnd()) return false;
-	if (*scanner.current != expected) return false;
-	scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+	if (isAtEnd(scanner)) return false;
+	if (*scanner->current != expected) return false;
+	scanner->current++;
 	return true;
 }
 
@@ -102,14 +367,15 @@ static bool match(char expected) {
  *      type:       the type of token to create
  *
  *  Returns:
- *      A token of the given type containing data from the scanner.
+ *      A token of the given type containing data from the scanner->
  */
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
 	Token token;
 	token.type = type;
-	token.start = scanner.start;
-	token.length = (int)(scanner.current - scanner.start);
-	token.line = scanner.line;
+	token.start = scanner->start;
+	token.length = (int)(scanner->current - scanner->start);
+	token.line = scanner->startLine;
+	token.column = scanner->startColumn;
 	return token;
 }
 
@@ -121,62 +387,121 @@ static Token makeToken(TokenType type) {
  *  Returns:
  *      An error token with information about the error.
  */
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
 	Token token;
 	token.type = TOKEN_ERROR;
 	token.start = message;
 	token.length = (int)strlen(message);
-	token.line =scanner.line;
+	token.line = scanner->startLine;
+	token.column = scanner->startColumn;
 	return token;
 }
 
+/* Moves a streamed scanner onto the next window of its source
+ *
+ *  Params:
+ *      kept:       the first character the scanner still needs, everything from it on is carried into the window
+ *
+ *  Returns:
+ *      True if the scanner has more source, false if the source is exhausted or isn't streamed.
+ */
+static bool refill(Scanner* scanner, const char* kept) {
+	if (scanner->stream == NULL) return false;
+
+	const char* window;
+	size_t windowLength;
+	size_t keptLength = (size_t)(scanner->end - kept);
+	if (!scanner->stream->refill(scanner->stream, kept, keptLength, scanner->pinned, &window, &windowLength)) {
+		return false;
+	}
+
+	scanner->current = window + (scanner->current - kept);
+	scanner->start = scanner->start >= kept ? window + (scanner->start - kept) : window;
+	scanner->end = window + windowLength;
+
+	// The part of the line that isn't carried over is only remembered as a number of columns
+	if (scanner->lineStart >= kept) {
+		scanner->lineStart = window + (scanner->lineStart - kept);
+	} else {
+		scanner->lineColumns += (int)(kept - scanner->lineStart);
+		scanner->lineStart = window;
+	}
+	return true;
+}
+
 /* Skips next whitespace characters in the source code
  *
  */
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
 	for (;;) {
-		char c = peek();
-
-		switch(c) {
-			case ' ':
-			case '\r':
-			case '\t':
-				advance();
-				break;
-			case '\n':
-				scanner.line++;
-				advance();
-				break;
-			case '/':
-				if (peekNext() == '/') {
-					// Comments go for the entire line
-					while (peek() != '\n' && !isAtEnd()) advance();
-				} else {
-					return;
-				}
-				break;
-			default:
-				return;
+		if (charFlags[(unsigned char)peek(scanner)] & CHAR_SPACE) {
+			int line = scanner->line;
+			scanner->current = runEnd(scanner->current, scanner->end, CLASS_SPACE, &scanner->line);
+
+			// The run is only whitespace, so the last newline in it is never far from its end
+			if (scanner->line != line) {
+				const char* lineStart = scanner->current;
+				while (lineStart[-1] != '\n') lineStart--;
+				scanner->lineStart = lineStart;
+				scanner->lineColumns = 0;
+			}
+		} else if (peek(scanner) == '/' && peekNext(scanner) == '/') {
+			// Comments go for the entire line, which may go on in the next window
+			do {
+				scanner->current = runEnd(scanner->current, scanner->end, CLASS_COMMENT, &scanner->line);
+			} while (isAtEnd(scanner) && refill(scanner, scanner->current));
+		} else if (!isAtEnd(scanner) || !refill(scanner, scanner->current)) {
+			// Whitespace that reaches the end of a window is dropped, and skipping goes on in the next one
+			return;
 		}
 	}
 }
 
-/* Checks a given number of characters to see if they match a reserved identifier
+/* Keywords
+ *
+ *  Each keyword is listed with its first and last character, which together with its length are all the hash looks
+ *  at. The hash is perfect for these keywords: no two of them share a value, so identifierType() finds the only
+ *  keyword an identifier can be with one switch and compares against just that one. The switch doubles as the check
+ *  that the hash is still perfect, since two keywords with the same hash would be duplicate case labels and not
+ *  compile. After adding a keyword that collides, search for a new multiplier for the last character.
+ */
+#define KEYWORDS(KEYWORD) \
+	KEYWORD("and",    'a', 'd', TOKEN_AND) \
+	KEYWORD("class",  'c', 's', TOKEN_CLASS) \
+	KEYWORD("else",   'e', 'e', TOKEN_ELSE) \
+	KEYWORD("false",  'f', 'e', TOKEN_FALSE) \
+	KEYWORD("for",    'f', 'r', TOKEN_FOR) \
+	KEYWORD("fun",    'f', 'n', TOKEN_FUN) \
+	KEYWORD("if",     'i', 'f', TOKEN_IF) \
+	KEYWORD("nil",    'n', 'l', TOKEN_NIL) \
+	KEYWORD("or",     'o', 'r', TOKEN_OR) \
+	KEYWORD("print",  'p', 't', TOKEN_PRINT) \
+	KEYWORD("return", 'r', 'n', TOKEN_RETURN) \
+	KEYWORD("super",  's', 'r', TOKEN_SUPER) \
+	KEYWORD("this",   't', 's', TOKEN_THIS) \
+	KEYWORD("true",   't', 'e', TOKEN_TRUE) \
+	KEYWORD("var",    'v', 'r', TOKEN_VAR) \
+	KEYWORD("while",  'w', 'e', TOKEN_WHILE)
+
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 6
+
+#define KEYWORD_HASH(first, last, length) (((first) + (last) * 5 + (length)) & 31)
+
+/* Checks if an identifier is a keyword
  *
  *  Params:
- *      start:          the first character of the token
- *      length:         how many more characters are in the reserved keyword
- *      rest:           the rest of the letters in the reserved keyword
- *      type:           the TokenType corresponding to the given information
+ *      text:           the identifier
+ *      length:         the identifier's length
+ *      keyword:        the keyword it may be
+ *      keywordLength:  the keyword's length
+ *      type:           the TokenType of the keyword
  *
  *  Returns:
- *      Returns the TokenType matching the given keyword information, or a TOKEN_IDENTIFIER.
+ *      The keyword's TokenType if the identifier is the keyword, TOKEN_IDENTIFIER otherwise.
  */
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type) {
-	if (scanner.current - scanner.start == start + length &&
-	    memcmp(scanner.start + start, rest, length) == 0) {
-		return type;
-	}
+static TokenType checkKeyword(const char* text, int length, const char* keyword, int keywordLength, TokenType type) {
+	if (length == keywordLength && memcmp(text, keyword, keywordLength) == 0) return type;
 
 	return TOKEN_IDENTIFIER;
 }
@@ -186,36 +511,17 @@ static TokenType checkKeyword(int start, int length, const char* rest, TokenType
  *  Returns:
  *      Returns the TokenType matching the identifier
  */
-static TokenType identifierType() {
-	switch (scanner.start[0]) {
-		case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-		case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-		case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-		case 'f':
-			if (scanner.current - scanner.start > 1) {
-				switch (scanner.start[1]) {
-					case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-					case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-					case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-				}
-			}
-			break;
-		case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-		case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-		case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-		case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-		case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-		case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-		case 't':
-			if (scanner.current - scanner.start > 1) {
-				switch (scanner.start[1]) {
-					case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-					case 'r': return checkKeyword(2, 2, "UE", TOKEN_TRUE);
-				}
-			}
-			break;
-		case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-		case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+static TokenType identifierType(Scanner* scanner) {
+	const char* text = scanner->start;
+	int length = (int)(scanner->current - scanner->start);
+	if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) return TOKEN_IDENTIFIER;
+
+	switch (KEYWORD_HASH((unsigned char)text[0], (unsigned char)text[length - 1], length)) {
+#define KEYWORD(keyword, first, last, type) \
+		case KEYWORD_HASH(first, last, (int)sizeof(keyword) - 1): \
+			return checkKeyword(text, length, keyword, (int)sizeof(keyword) - 1, type);
+		KEYWORDS(KEYWORD)
+#undef KEYWORD
 	}
 
 	return TOKEN_IDENTIFIER;
@@ -226,10 +532,10 @@ static TokenType identifierType() {
  *  Returns:
  *      A token matching the type of the scanned identifier
  */
-static Token identifier() {
-	while (isAlpha(peek()) || isDigit(peek())) advance();
+static Token identifier(Scanner* scanner) {
+	scanner->current = runEnd(scanner->current, scanner->end, CLASS_IDENTIFIER, &scanner->line);
 
-	return makeToken(identifierType());
+	return makeToken(scanner, identifierType(scanner));
 }
 
 /* Creates a number token
@@ -237,18 +543,18 @@ static Token identifier() {
  *  Returns:
  *      Returns a TOKEN_NUMBER
  */
-static Token number() {
-	while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+	scanner->current = runEnd(scanner->current, scanner->end, CLASS_DIGIT, &scanner->line);
 
 	// Checks for fractional numbers
-	if (peek() == '.' && isDigit(peekNext())) {
+	if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
 		// Consumes the '.'
-		advance();
+		advance(scanner);
 
-		while (isDigit(peek())) advance();
+		scanner->current = runEnd(scanner->current, scanner->end, CLASS_DIGIT, &scanner->line);
 	}
 
-	return makeToken(TOKEN_NUMBER);
+	return makeToken(scanner, TOKEN_NUMBER);
 }
 
 /* Creates a string token
@@ -256,55 +562,71 @@ static Token number() {
  *  Returns:
  *      Returns a TOKEN_STRING
  */
-static Token string() {
-	while (peek() != '"' && !isAtEnd()) {
-		if (peek() == '\n') scanner.line++;
-		advance();
+static Token string(Scanner* scanner) {
+	while (peek(scanner) != '"' && !isAtEnd(scanner)) {
+		if (advance(scanner) == '\n') {
+			scanner->line++;
+			scanner->lineStart = scanner->current;
+			scanner->lineColumns = 0;
+		}
 	}
 
-	if (isAtEnd()) return errorToken("Unterminated string.");
+	if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
 
 	// This consumes the closing quote
-	advance();
-	return makeToken(TOKEN_STRING);
+	advance(scanner);
+	return makeToken(scanner, TOKEN_STRING);
+}
+
+/* Scans the next token from the source the scanner has
+ *
+ */
+static Token scanWindowToken(Scanner* scanner) {
+	if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
+
+	const CharRule* rule = &charRules[(unsigned char)advance(scanner)];
+	switch (rule->action) {
+		case RULE_SINGLE:     return makeToken(scanner, (TokenType)rule->type);
+		case RULE_EQUALS:     return makeToken(scanner, (TokenType)(match(scanner, '=') ? rule->equalType : rule->type));
+		case RULE_NUMBER:     return number(scanner);
+		case RULE_IDENTIFIER: return identifier(scanner);
+		case RULE_STRING:     return string(scanner);
+	}
+
+	return errorToken(scanner, "Unexpected character.");
 }
 
 /* Scans the next token from the location of the scanner
+ *      A token is decided by its characters and at most SCANNER_LOOKAHEAD characters after them. When those run into
+ *      the end of a streamed scanner's window, the token may go on in the next one: it is carried over into the next
+ *      window and scanned again.
  *
  *  Returns:
  *      The next token or an error token if something is wrong.
  */
-Token scanToken() {
-	skipWhitespace();
-	scanner.start = scanner.current;
-
-	if (isAtEnd()) return makeToken(TOKEN_EOF);
-
-	char c = advance();
-	if (isDigit(c)) return number();
-
-	switch (c) {
-		case '(': return makeToken(TOKEN_LEFT_PAREN);
-		case ')': return makeToken(TOKEN_RIGHT_PAREN);
-		case '{': return makeToken(TOKEN_LEFT_BRACE);
-		case '}': return makeToken(TOKEN_RIGHT_BRACE);
-		case ';': return makeToken(TOKEN_SEMICOLON);
-		case ',': return makeToken(TOKEN_COMMA);
-		case '.': return makeToken(TOKEN_DOT);
-		case '-': return makeToken(TOKEN_MINUS);
-		case '+': return makeToken(TOKEN_PLUS);
-		case '/': return makeToken(TOKEN_SLASH);
-		case '*': return makeToken(TOKEN_STAR);
-		case '!':
-			return makeToken(match('=' ? TOKEN_BANG_EQUAL : TOKEN_BANG));
-		case '=':
-			return makeToken(match('=' ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL));
-		case '<':
-			return makeToken(match('=' ? TOKEN_LESS_EQUAL : TOKEN_LESS));
-		case '>':
-			return makeToken(match('=' ? TOKEN_GREATER_EQUAL : TOKEN_GREATER));
-		case '"': return string();
+Token scanToken(Scanner* scanner) {
+	if (scanner->tokens != NULL) {
+		Token token = readToken(scanner->tokens, scanner->nextToken);
+		if (token.type != TOKEN_EOF) scanner->nextToken++;
+		return token;
 	}
 
-	return errorToken("Unexpected character.");
+	for (;;) {
+		skipWhitespace(scanner);
+		scanner->start = scanner->current;
+		scanner->startLine = scanner->line;
+		scanner->startColumn = (int)(scanner->start - scanner->lineStart) + scanner->lineColumns + 1;
+
+		Token token = scanWindowToken(scanner);
+		if (scanner->end - scanner->current >= SCANNER_LOOKAHEAD || !refill(scanner, scanner->start)) {
+			// Error tokens point at their message, the last token from the source stays pinned
+			if (token.type != TOKEN_ERROR) scanner->pinned = token.start;
+			return token;
+		}
+
+		scanner->current = scanner->start;
+		scanner->line = scanner->startLine;
+		scanner->lineStart = scanner->start;
+		scanner->lineColumns = scanner->startColumn - 1;
+	}
 }
\ No newline at end of file
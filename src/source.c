@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/memory.h"
+#include "include/source.h"
+
+/* Checks if a pointer points into a window, or just past its end like an EOF token does
+ *
+ */
+static bool inWindow(const SourceWindow* window, const char* pointer) {
+	return window->data != NULL && pointer >= window->data && pointer <= window->data + window->capacity;
+}
+
+/* Reads the next window of a streamed source, the SourceStream function of a SourceFile
+ *
+ *  The window is read into whichever buffer doesn't hold the pinned token, which is usually the other one: the
+ *  token the compiler still holds stays where it is, and the window being scanned can be replaced. The characters
+ *  the scanner kept are copied to the start of the buffer, which grows to fit them with room to spare.
+ *
+ *  One read is enough, the scanner comes back for more as it needs it. A window can have nothing new in it once the
+ *  file ends, the call after that returns false.
+ */
+static bool refillStream(SourceStream* stream, const char* kept, size_t keptLength, const char* pinned,
+                         const char** window, size_t* windowLength) {
+	SourceFile* file = (SourceFile*)stream;
+	if (file->descriptor < 0) return false;
+
+	SourceWindow* current = &file->windows[file->window];
+	int next = inWindow(&file->windows[1 - file->window], pinned) ? file->window : 1 - file->window;
+	SourceWindow* target = &file->windows[next];
+
+	size_t capacity = target->capacity < SOURCE_WINDOW_SIZE ? SOURCE_WINDOW_SIZE : target->capacity;
+	while (capacity - keptLength < SOURCE_WINDOW_SIZE / 2) capacity *= 2;
+
+	if (target == current) {
+		// Nothing before the kept characters is still in use, they move to the start of the buffer
+		memmove(current->data, kept, keptLength);
+		current->data = reallocate(current->data, current->capacity, capacity);
+	} else {
+		target->data = reallocate(target->data, target->capacity, capacity);
+		memcpy(target->data, kept, keptLength);
+	}
+	target->capacity = capacity;
+	file->window = next;
+
+	size_t length = keptLength;
+	for (;;) {
+		ssize_t bytesRead = read(file->descriptor, target->data + length, capacity - length);
+		if (bytesRead > 0) {
+			length += (size_t)bytesRead;
+			break;
+		}
+		if (bytesRead < 0 && errno == EINTR) continue;
+
+		if (bytesRead < 0) {
+			fprintf(stderr, "Could not read file \"%s\".\n", file->path);
+			file->failed = true;
+		}
+		if (file->descriptor != STDIN_FILENO) close(file->descriptor);
+		file->descriptor = -1;
+		break;
+	}
+
+	*window = target->data;
+	*windowLength = length;
+	return true;
+}
+
+/* Opens a script's source code, mapping it if it is a regular file and streaming it otherwise
+ *
+ *  Params:
+ *      file:       the source to open
+ *      path:       the script, or "-" for standard input
+ *
+ *  Returns:
+ *      True if the source is open, false if the file can't be opened (an error is printed).
+ */
+bool openSource(SourceFile* file, const char* path) {
+	file->stream.refill = refillStream;
+	file->path = path;
+	file->descriptor = -1;
+	file->failed = false;
+	file->text = NULL;
+	file->length = 0;
+	file->windows[0] = (SourceWindow){NULL, 0};
+	file->windows[1] = (SourceWindow){NULL, 0};
+	file->window = 0;
+
+	int descriptor = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+	if (descriptor < 0) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		return false;
+	}
+
+	// Empty regular files are streamed too, as some (like those in /proc) only have contents when read
+	struct stat status;
+	if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+		size_t length = (size_t)status.st_size;
+		void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (mapping != MAP_FAILED) {
+			madvise(mapping, length, MADV_SEQUENTIAL);
+			if (descriptor != STDIN_FILENO) close(descriptor);
+			file->text = mapping;
+			file->length = length;
+			return true;
+		}
+	}
+
+	file->descriptor = descriptor;
+	return true;
+}
+
+/* Initializes a scanner on an open source
+ *
+ */
+void scanSource(SourceFile* file, Scanner* scanner) {
+	if (file->text != NULL) {
+		initScanner(scanner, file->text, file->length);
+	} else {
+		initStreamScanner(scanner, &file->stream);
+	}
+}
+
+/* Closes a source, which invalidates every token scanned from it
+ *
+ */
+void closeSource(SourceFile* file) {
+	if (file->text != NULL) munmap((void*)file->text, file->length);
+	if (file->descriptor >= 0 && file->descriptor != STDIN_FILENO) close(file->descriptor);
+
+	for (int window = 0; window < 2; window++) {
+		reallocate(file->windows[window].data, file->windows[window].capacity, 0);
+	}
+	file->text = NULL;
+	file->descriptor = -1;
+}
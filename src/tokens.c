@@ -0,0 +1,301 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/memory.h"
+#include "include/tokens.h"
+
+/* Parallel lexing
+ *
+ *  tokenize() splits the source into one piece per thread, each starting at the beginning of a line, and scans the
+ *  pieces at once. A piece is scanned as if nothing were open at its start. That is wrong when a string literal from
+ *  the piece before runs across the line break, so the pieces are checked as they are merged: the scanner of each
+ *  piece finishes the token it is in at the end of its piece, and stops at the first token that starts past it. The
+ *  next piece is right from the token that starts there on, since a scanner that starts a token at a given position
+ *  scans the same tokens from there whatever came before. Only when the next piece has no token there is it scanned
+ *  again, from that position, on the merging thread.
+ *
+ *  Lines are counted from the start of each piece and offset by the newlines of the pieces before it.
+ */
+typedef struct {
+	const char* source;
+	size_t length;              // The length of the whole source, which a piece's last token can run into
+	size_t begin;
+	size_t end;
+	TokenBuffer tokens;         // With lines counted from begin
+	int columns;                // The characters of begin's line before it, for a piece that starts within a line
+	size_t stop;                // The offset of the first token that starts past end, the next piece's first token
+	size_t newlines;            // The newlines from begin to end
+	pthread_t thread;
+} LexPiece;
+
+/* Initializes an empty token buffer
+ *
+ *  Params:
+ *      source:     the source the tokens will be scanned from
+ */
+void initTokenBuffer(TokenBuffer* tokens, const char* source) {
+	tokens->source = source;
+	tokens->count = 0;
+	tokens->capacity = 0;
+	tokens->types = NULL;
+	tokens->offsets = NULL;
+	tokens->lengths = NULL;
+	tokens->lines = NULL;
+	tokens->columns = NULL;
+	tokens->errors = NULL;
+	tokens->errorCount = 0;
+	tokens->errorCapacity = 0;
+}
+
+/* Frees a token buffer's arrays
+ *
+ */
+void freeTokenBuffer(TokenBuffer* tokens) {
+	FREE_ARRAY(NULL, uint8_t, tokens->types, tokens->capacity);
+	FREE_ARRAY(NULL, uint32_t, tokens->offsets, tokens->capacity);
+	FREE_ARRAY(NULL, uint32_t, tokens->lengths, tokens->capacity);
+	FREE_ARRAY(NULL, int32_t, tokens->lines, tokens->capacity);
+	FREE_ARRAY(NULL, int32_t, tokens->columns, tokens->capacity);
+	FREE_ARRAY(NULL, const char*, tokens->errors, tokens->errorCapacity);
+	initTokenBuffer(tokens, tokens->source);
+}
+
+/* Makes room for a number of tokens more
+ *
+ */
+static void reserveTokens(TokenBuffer* tokens, size_t more) {
+	if (tokens->count + more <= tokens->capacity) return;
+
+	size_t oldCapacity = tokens->capacity;
+	size_t capacity = GROW_CAPACITY(oldCapacity);
+	while (capacity < tokens->count + more) capacity *= 2;
+
+	tokens->types = GROW_ARRAY(NULL, uint8_t, tokens->types, oldCapacity, capacity);
+	tokens->offsets = GROW_ARRAY(NULL, uint32_t, tokens->offsets, oldCapacity, capacity);
+	tokens->lengths = GROW_ARRAY(NULL, uint32_t, tokens->lengths, oldCapacity, capacity);
+	tokens->lines = GROW_ARRAY(NULL, int32_t, tokens->lines, oldCapacity, capacity);
+	tokens->columns = GROW_ARRAY(NULL, int32_t, tokens->columns, oldCapacity, capacity);
+	tokens->capacity = capacity;
+}
+
+/* Adds a token scanned at a given offset of the source
+ *
+ */
+static void addToken(TokenBuffer* tokens, Token* token, size_t offset, int line) {
+	uint32_t length = (uint32_t)token->length;
+	if (token->type == TOKEN_ERROR) {
+		if (tokens->errorCount + 1 > tokens->errorCapacity) {
+			int oldCapacity = tokens->errorCapacity;
+			tokens->errorCapacity = GROW_CAPACITY(oldCapacity);
+			tokens->errors = GROW_ARRAY(NULL, const char*, tokens->errors, oldCapacity, tokens->errorCapacity);
+		}
+		tokens->errors[tokens->errorCount] = token->start;
+		length = (uint32_t)tokens->errorCount++;
+	}
+
+	reserveTokens(tokens, 1);
+	tokens->types[tokens->count] = (uint8_t)token->type;
+	tokens->offsets[tokens->count] = (uint32_t)offset;
+	tokens->lengths[tokens->count] = length;
+	tokens->lines[tokens->count] = line;
+	tokens->columns[tokens->count] = token->column;
+	tokens->count++;
+}
+
+/* Counts the newlines in part of the source
+ *
+ */
+static size_t countNewlines(const char* source, size_t from, size_t to) {
+	if (from >= to) return 0;
+
+	size_t newlines = 0;
+	const char* end = source + to;
+	for (const char* next = source + from; (next = memchr(next, '\n', (size_t)(end - next))) != NULL; next++) {
+		newlines++;
+	}
+	return newlines;
+}
+
+/* Scans a piece of the source, the body of a lexing thread
+ *      Every token that starts before the piece's end is kept, and the last piece keeps the EOF token too.
+ *
+ */
+static void* lexPiece(void* argument) {
+	LexPiece* piece = (LexPiece*)argument;
+	const char* begin = piece->source + piece->begin;
+
+	Scanner scanner;
+	initScanner(&scanner, begin, piece->length - piece->begin);
+	scanner.lineColumns = piece->columns;
+	initTokenBuffer(&piece->tokens, piece->source);
+
+	for (;;) {
+		Token token = scanToken(&scanner);
+		size_t offset = piece->begin + (size_t)(scanner.start - begin);
+		if (offset >= piece->end && piece->end < piece->length) {
+			piece->stop = offset;
+			break;
+		}
+
+		addToken(&piece->tokens, &token, offset, token.line);
+		if (token.type == TOKEN_EOF) {
+			piece->stop = piece->length;
+			break;
+		}
+	}
+
+	piece->newlines = countNewlines(piece->source, piece->begin, piece->end);
+	return NULL;
+}
+
+/* Finds the token of a piece that starts at a given offset
+ *
+ *  Returns:
+ *      The index of the token, or -1 if no token starts there.
+ */
+static long findToken(const TokenBuffer* tokens, size_t offset) {
+	size_t low = 0;
+	size_t high = tokens->count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (tokens->offsets[middle] < offset) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	if (low < tokens->count && tokens->offsets[low] == offset) return (long)low;
+	return -1;
+}
+
+/* Appends a piece's tokens from a given index on, moving their lines past the lines before the piece
+ *
+ */
+static void mergePiece(TokenBuffer* tokens, const LexPiece* piece, size_t from, int lineOffset) {
+	const TokenBuffer* pieceTokens = &piece->tokens;
+	size_t count = pieceTokens->count - from;
+	reserveTokens(tokens, count);
+
+	for (size_t index = from; index < pieceTokens->count; index++) {
+		if (pieceTokens->types[index] == TOKEN_ERROR) {
+			// The message moves into the merged buffer's errors
+			Token error = {TOKEN_ERROR, pieceTokens->errors[pieceTokens->lengths[index]], 0, 0,
+			               pieceTokens->columns[index]};
+			addToken(tokens, &error, pieceTokens->offsets[index], pieceTokens->lines[index] + lineOffset);
+			continue;
+		}
+
+		size_t next = tokens->count++;
+		tokens->types[next] = pieceTokens->types[index];
+		tokens->offsets[next] = pieceTokens->offsets[index];
+		tokens->lengths[next] = pieceTokens->lengths[index];
+		tokens->lines[next] = pieceTokens->lines[index] + lineOffset;
+		tokens->columns[next] = pieceTokens->columns[index];
+	}
+}
+
+/* Scans a whole source into a token buffer on several threads
+ *
+ *  Params:
+ *      tokens:     an initialized buffer to add the tokens to
+ *      source:     the source, which needs no terminator
+ *      length:     the number of characters in the source
+ *      threads:    the most threads to scan on, 0 for one per online core
+ *
+ *  Returns:
+ *      True if the source was scanned, false if it is too big for the buffer's offsets.
+ */
+bool tokenize(TokenBuffer* tokens, const char* source, size_t length, int threads) {
+	if (length >= UINT32_MAX) return false;
+
+	if (threads <= 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cores > 0 ? (int)cores : 1;
+	}
+	size_t pieceLimit = length / TOKENIZE_MIN_PIECE;
+	int pieceCount = pieceLimit < (size_t)threads ? (int)pieceLimit : threads;
+	if (pieceCount < 1) pieceCount = 1;
+
+	LexPiece* pieces = calloc((size_t)pieceCount, sizeof(LexPiece));
+	if (pieces == NULL) exit(1); // Same as reallocate()
+
+	// Each piece starts at the beginning of the line its share of the source starts in
+	size_t begin = 0;
+	int count = 0;
+	for (int index = 0; index < pieceCount && begin < length; index++) {
+		size_t end = length;
+		if (index + 1 < pieceCount) {
+			size_t split = (size_t)((uint64_t)length * (index + 1) / pieceCount);
+			if (split < begin) split = begin;
+			const char* newline = memchr(source + split, '\n', length - split);
+			if (newline != NULL) end = (size_t)(newline - source) + 1;
+		}
+
+		pieces[count] = (LexPiece){source, length, begin, end};
+		count++;
+		begin = end;
+	}
+	if (count == 0) pieces[count++] = (LexPiece){source, length, 0, 0};
+
+	// The first piece is scanned on this thread while the others are
+	for (int index = 1; index < count; index++) {
+		if (pthread_create(&pieces[index].thread, NULL, lexPiece, &pieces[index]) != 0) {
+			fprintf(stderr, "Could not start a lexing thread.\n");
+			exit(1);
+		}
+	}
+	lexPiece(&pieces[0]);
+	for (int index = 1; index < count; index++) pthread_join(pieces[index].thread, NULL);
+
+	size_t stop = 0;
+	size_t linesBefore = 0;
+	for (int index = 0; index < count; index++) {
+		LexPiece* piece = &pieces[index];
+		long first = findToken(&piece->tokens, stop);
+
+		if (first < 0) {
+			// The piece started inside a token of the one before, scan it again from where that token ended
+			LexPiece rescan = *piece;
+			rescan.begin = stop;
+			size_t lineStart = stop;
+			while (lineStart > piece->begin && source[lineStart - 1] != '\n') lineStart--;
+			rescan.columns = (int)(stop - lineStart);
+			lexPiece(&rescan);
+			mergePiece(tokens, &rescan, 0, (int)(linesBefore + countNewlines(source, piece->begin, stop)));
+			freeTokenBuffer(&rescan.tokens);
+			stop = rescan.stop;
+		} else {
+			mergePiece(tokens, piece, (size_t)first, (int)linesBefore);
+			stop = piece->stop;
+		}
+
+		linesBefore += piece->newlines;
+		freeTokenBuffer(&piece->tokens);
+	}
+
+	free(pieces);
+	return true;
+}
+
+/* Rebuilds the Token at an index of the buffer
+ *
+ */
+Token readToken(const TokenBuffer* tokens, size_t index) {
+	Token token;
+	token.type = (TokenType)tokens->types[index];
+	token.line = tokens->lines[index];
+	token.column = tokens->columns[index];
+
+	if (token.type == TOKEN_ERROR) {
+		token.start = tokens->errors[tokens->lengths[index]];
+		token.length = (int)strlen(token.start);
+	} else {
+		token.start = tokens->source + tokens->offsets[index];
+		token.length = (int)tokens->lengths[index];
+	}
+	return token;
+}
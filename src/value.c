@@ -12,6 +12,7 @@ void initValueArray(ValueArray* arr) {
 	arr->values = NULL;
 	arr->capacity = 0;
 	arr->count = 0;
+	arr->allocator = NULL;
 }
 
 /* Writes a value to a ValueArray
@@ -28,7 +29,7 @@ void writeValueArray(ValueArray* arr, Value value) {
 	if (arr->capacity < arr->count + 1) {
 		int oldCapacity = arr->capacity;
 		arr->capacity = GROW_CAPACITY(oldCapacity);
-		arr->values = GROW_ARRAY(Value, arr->values, oldCapacity, arr->capacity);
+		arr->values = GROW_ARRAY(arr->allocator, Value, arr->values, oldCapacity, arr->capacity);
 	}
 
 	// Writes the new value to the array and increments the count
@@ -42,8 +43,10 @@ void writeValueArray(ValueArray* arr, Value value) {
  *      arr:      the ValueArray to free and reinitialize
  */
 void freeValueArray(ValueArray* arr) {
-	FREE_ARRAY(Value, arr->values, arr->capacity);
+	const Allocator* allocator = arr->allocator;
+	FREE_ARRAY(allocator, Value, arr->values, arr->capacity);
 	initValueArray(arr);
+	arr->allocator = allocator;
 }
 
 /* Prints a value
@@ -52,5 +55,15 @@ void freeValueArray(ValueArray* arr) {
  *      value:      the value to be printed
  */
 void printValue(Value value) {
-	printf("%g", AS_NUMBER(value));
+	fprintValue(stdout, value);
+}
+
+/* Prints a value to the given file
+ *
+ *  Params:
+ *      file:       where to print the value
+ *      value:      the value to be printed
+ */
+void fprintValue(FILE* file, Value value) {
+	fprintf(file, "%g", AS_NUMBER(value));
 }
\ No newline at end of file
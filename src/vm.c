@@ -1,139 +1,733 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "include/common.h"
 #include "include/compiler.h"
 #include "include/debug.h"
-#include "include/memory.h"
+#include "include/jit.h"
+#include "include/optimizer.h"
+#include "include/profile.h"
+#include "include/sampler.h"
 #include "include/vm.h"
 
-VM vm;
+// The VM executing on this thread, for the stack fault handler (signals are delivered to the faulting thread)
+static _Thread_local VM* runningVM = NULL;
 
-static void resetStack() {
-	vm.stackCount = 0;
+// The fault handler is installed once for every VM, and what it replaced gets the faults that aren't ours
+static pthread_once_t faultHandlerOnce = PTHREAD_ONCE_INIT;
+static struct sigaction previousSegvAction;
+static struct sigaction previousBusAction;
+
+static void resetStack(VM* vm) {
+	vm->stackTop = vm->stack;
 }
 
-static void runtimeError(const char* format, ...) {
+static void runtimeError(VM* vm, const char* format, ...) {
+	// Keeps the message in one piece when several VMs report errors at once
+	flockfile(stderr);
+
 	va_list args;
 	va_start(args, format);
 	vfprintf(stderr, format, args);
 	va_end(args);
 	fputs("\n", stderr);
 
-	size_t instruction = vm.ip - vm.chunk->code - 1;
-	int line = getLine(vm.chunk, instruction);
-	fprintf(stderr, "[line %d] in script\n", line);
-	resetStack();
+	size_t instruction = vm->ip - vm->chunk->code - 1;
+	SourcePosition position = getPosition(vm->chunk, (int)instruction);
+	fprintf(stderr, "[line %d, column %d] in script\n", position.line, position.column);
+	funlockfile(stderr);
+	resetStack(vm);
 }
 
-void initVM() {
-	vm.stack = NULL;
-	vm.stackCapacity = 0;
-	resetStack();
-}
+/* Handles faults on the guard page of the stack of the VM running on this thread by unwinding to interpretChunk(),
+ *  which reports the overflow
+ *
+ *  Any other fault is not ours and goes to whatever handled it before the VM did, so that an embedding host's crash
+ *  reporter or sanitizer still sees it: a handler that was installed is called, and the default or ignore action is
+ *  re-installed, so that returning re-raises the fault the way it would have without the VM.
+ */
+static void handleStackFault(int signal, siginfo_t* info, void* context) {
+	char* address = (char*)info->si_addr;
+	VM* vm = runningVM;
+
+	if (vm != NULL && vm->guardPage != NULL && address >= vm->guardPage && address < vm->guardPage + vm->guardSize) {
+		siglongjmp(vm->stackOverflow, 1);
+	}
 
-void freeVM() {
+	const struct sigaction* previous = signal == SIGBUS ? &previousBusAction : &previousSegvAction;
+	if (previous->sa_flags & SA_SIGINFO) {
+		previous->sa_sigaction(signal, info, context);
+	} else if (previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN) {
+		previous->sa_handler(signal);
+	} else {
+		sigaction(signal, previous, NULL);
+	}
+}
 
+/* Installs handleStackFault() for SIGSEGV and SIGBUS, keeping the actions it replaces
+ *
+ */
+static void installFaultHandler(void) {
+	struct sigaction action;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_SIGINFO;
+	action.sa_sigaction = handleStackFault;
+	sigaction(SIGSEGV, &action, &previousSegvAction);
+	sigaction(SIGBUS, &action, &previousBusAction);
 }
 
-void push(Value value) {
-	if (vm.stackCapacity < vm.stackCount + 1) {
-		int oldCapacity = vm.stackCapacity;
-		vm.stackCapacity = GROW_CAPACITY(oldCapacity);
-		vm.stack = GROW_ARRAY(Value, vm.stack, oldCapacity, vm.stackCapacity);
+/* Initializes the VM:
+ *      The stack is a fixed region of STACK_MAX values, mapped so that it ends right at an inaccessible guard page.
+ *      push() never checks for room: the push that would overflow the stack faults on the guard page instead, and
+ *      the fault is turned into a runtime error.
+ *
+ *  Returns:
+ *      True if the VM was initialized, false if its stack couldn't be mapped (an error is printed, and the VM must
+ *      not be used or freed).
+ */
+bool initVM(VM* vm) {
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t stackSize = sizeof(Value) * STACK_MAX;
+	size_t mappedStackSize = (stackSize + pageSize - 1) / pageSize * pageSize;
+
+	char* mapping = mmap(NULL, mappedStackSize + pageSize, PROT_READ | PROT_WRITE,
+	                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Could not map the VM stack.\n");
+		return false;
 	}
+	if (mprotect(mapping + mappedStackSize, pageSize, PROT_NONE) != 0) {
+		fprintf(stderr, "Could not map the VM stack.\n");
+		munmap(mapping, mappedStackSize + pageSize);
+		return false;
+	}
+
+	vm->backend = BACKEND_STACK;
+	vm->optimize = true;
+	vm->printOptimizeStats = false;
+	vm->jit = false;
+	vm->output = stdout;
+	vm->result = NIL_VAL(0);
+	initMemoryTracker(&vm->memory, NULL);
+	initArena(&vm->arena, &vm->memory.allocator);
+	vm->scriptName = NULL;
+	initSampledRun(&vm->samples);
+
+	vm->stackMapping = mapping;
+	vm->stackMappingSize = mappedStackSize + pageSize;
+	vm->guardPage = mapping + mappedStackSize;
+	vm->guardSize = pageSize;
+	vm->stack = (Value*)(vm->guardPage - stackSize);
+	resetStack(vm);
+	pthread_once(&faultHandlerOnce, installFaultHandler);
+
+#ifdef CYNCH_PROFILE
+	vm->stackProfile = newProfile(PROFILE_STACK);
+	vm->registerProfile = newProfile(PROFILE_REGISTER);
+#endif
+	return true;
+}
+
+/* Releases the VM's stack and arena, and under CYNCH_PROFILE adds its counters to the ones written out at exit
+ *
+ */
+void freeVM(VM* vm) {
+#ifdef CYNCH_PROFILE
+	releaseProfile(vm->stackProfile);
+	releaseProfile(vm->registerProfile);
+	vm->stackProfile = NULL;
+	vm->registerProfile = NULL;
+#endif
+
+	freeSampledRun(&vm->samples);
+	freeArena(&vm->arena);
+	munmap(vm->stackMapping, vm->stackMappingSize);
+	vm->stackMapping = NULL;
+	vm->guardPage = NULL;
+	vm->stack = NULL;
+	vm->stackTop = NULL;
+}
+
+/* Selects the instruction set that interpret() compiles to and executes
+ *
+ *  Params:
+ *      backend:    BACKEND_STACK or BACKEND_REGISTER
+ */
+void setBackend(VM* vm, Backend backend) {
+	vm->backend = backend;
+}
+
+/* Configures the peephole optimizer that interpret() runs over stack-based chunks
+ *
+ *  Params:
+ *      enabled:        whether to optimize chunks at all
+ *      printStats:     whether to print the instruction and byte counts before and after optimizing
+ */
+void setOptimizer(VM* vm, bool enabled, bool printStats) {
+	vm->optimize = enabled;
+	vm->printOptimizeStats = printStats;
+}
+
+/* Makes interpretChunk() compile stack-based chunks to machine code and run that instead of interpreting them
+ *      Chunks the JIT can't compile, and every chunk on machines it doesn't support, are still interpreted.
+ *
+ */
+void setJit(VM* vm, bool enabled) {
+	vm->jit = enabled;
+}
+
+/* Redirects what scripts print (the results of their expressions), which goes to stdout by default
+ *      A NULL output prints nothing, the result is then only kept in the VM (see interpretChunk()).
+ *
+ */
+void setOutput(VM* vm, FILE* output) {
+	vm->output = output;
+}
+
+/* Replaces the allocator the VM's memory comes from, the heap by default
+ *
+ *  Params:
+ *      allocator:  the allocator, copied into the VM, or NULL for the heap
+ */
+void setAllocator(VM* vm, const Allocator* allocator) {
+	freeArena(&vm->arena);
+	vm->memory.parent = allocator != NULL ? *allocator : heapAllocator;
+}
+
+/* Caps the memory the VM may have allocated at once
+ *      Going over the cap is a runtime error of the script that needed the memory, not a process exit.
+ *
+ *  Params:
+ *      limit:      the most bytes the VM may hold, 0 for no limit
+ */
+void setMemoryLimit(VM* vm, size_t limit) {
+	vm->memory.limit = limit;
+}
+
+/* Names the script the VM runs next, which is the root frame of its samples (see sampler.c)
+ *
+ *  Params:
+ *      name:       the script's name, which must outlive the runs it names, or NULL for "script"
+ */
+void setScriptName(VM* vm, const char* name) {
+	vm->scriptName = name;
+}
 
-	vm.stack[vm.stackCount] = value;
-	vm.stackCount++;
+void push(VM* vm, Value value) {
+	*vm->stackTop++ = value;
 }
 
-Value pop() {
-	vm.stackCount--;
-	return vm.stack[vm.stackCount];
+Value pop(VM* vm) {
+	return *--vm->stackTop;
 }
 
-static Value peek(int distance) {
-	return vm.stack[vm.stackCount - distance - 1];
+/* Dispatch macros shared by run() and runRegisters()
+ *
+ *  Each loop defines its own TRACE_EXECUTION(), PROFILE_INSTRUCTION() and, when using computed goto, its own
+ *  dispatchTable. Instructions are
+ *  dispatched in one of two ways, chosen at build time (see common.h):
+ *      - computed goto:    every handler jumps straight to the next handler through a table of label addresses,
+ *                          which gives each opcode its own indirect branch for the branch predictor to learn
+ *      - switch:           the portable fallback, a single switch inside of a loop
+ */
+#ifdef CYNCH_COMPUTED_GOTO
+#define INTERPRET_LOOP      DISPATCH();
+#define CASE_CODE(name)     code_##name
+#define DEFAULT_CODE        code_UNKNOWN
+#define DISPATCH() \
+    do { \
+      TRACE_EXECUTION(); \
+      instruction = READ_BYTE(); \
+      PROFILE_INSTRUCTION(instruction); \
+      goto *dispatchTable[instruction]; \
+    } while (false)
+#else
+#define INTERPRET_LOOP \
+    loop: \
+      TRACE_EXECUTION(); \
+      instruction = READ_BYTE(); \
+      PROFILE_INSTRUCTION(instruction); \
+      switch (instruction)
+#define CASE_CODE(name)     case name
+#define DEFAULT_CODE        default
+#define DISPATCH()          goto loop
+#endif
+
+#define READ_BYTE() (*vm->ip++)
+
+#ifdef DEBUG_TRACE_EXECUTION
+/* Prints the contents of the stack and disassembles the next instruction
+ *
+ */
+static void traceExecution(VM* vm) {
+	printf("          ");
+	for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+		printf("[ ");
+		printValue(*slot);
+		printf(" ]");
+	}
+	printf("\n");
+	disassembleInstruction(vm->chunk, &vm->tracePositions, (int)(vm->ip - vm->chunk->code));
 }
+#endif
+
+/* Executes the stack-based instructions in the VM's chunk
+ *
+ *  The top of the stack is kept in a local so that it can live in a register, and is written back to the VM only
+ *  when something outside of run() needs to see the stack.
+ *
+ *  Arithmetic instructions quicken themselves (see QUICKENED_INSTRUCTIONS in chunk.h): a generic handler that finds
+ *  numbers on the stack overwrites its opcode with the quickened one, and a quickened handler that doesn't writes the
+ *  generic opcode back and jumps to the generic handler. Superinstructions are left as they are.
+ *
+ *  Returns:
+ *      INTERPRET_OK if the chunk ran to completion, INTERPRET_RUNTIME_ERROR otherwise.
+ */
+static InterpretResult run(VM* vm) {
+	Value* stackTop = vm->stackTop;
 
-static InterpretResult run() {
-#define READ_BYTE() (*vm.ip++)
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+#define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
+#define PUSH(value) (*stackTop++ = (value))
+#define POP() (*--stackTop)
+#define PEEK(distance) (stackTop[-1 - (distance)])
 #define BINARY_OP(valueType, op) \
     do { \
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-        runtimeError("Operands must be numbers."); \
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+        runtimeError(vm, "Operands must be numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      double b = AS_NUMBER(POP()); \
+      double a = AS_NUMBER(POP()); \
+      PUSH(valueType(a op b)); \
+    } while (false)
+
+// The work of each instruction, shared by its own handler and by the superinstructions it is a part of
+#define DO_CONSTANT() PUSH(READ_CONSTANT())
+#define DO_CONSTANT_LONG() \
+    do { \
+      uint32_t index = vm->ip[0] | (vm->ip[1] << 8) | (vm->ip[2] << 16); \
+      vm->ip += 3; \
+      PUSH(vm->chunk->constants.values[index]); \
+    } while (false)
+#define DO_ADD() BINARY_OP(NUMBER_VAL, +)
+#define DO_SUBTRACT() BINARY_OP(NUMBER_VAL, -)
+#define DO_MULTIPLY() BINARY_OP(NUMBER_VAL, *)
+#define DO_DIVIDE() BINARY_OP(NUMBER_VAL, /)
+#define DO_NEGATE() \
+    do { \
+      if (!IS_NUMBER(PEEK(0))) { \
+        runtimeError(vm, "Operand must be a number."); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
-      double b = AS_NUMBER(pop()); \
-      double a = AS_NUMBER(pop()); \
-      push(valueType(a op b)); \
+      PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0))); \
+    } while (false)
+
+// Rewrites the instruction being executed, when the chunk may be written to
+#define QUICKEN(opcode) \
+    do { \
+      if (vm->chunk->quicken) vm->ip[-1] = (opcode); \
+    } while (false)
+#define NUMBER_BINARY_OP(op) \
+    do { \
+      stackTop--; \
+      PEEK(0) = NUMBER_VAL(AS_NUMBER(PEEK(0)) op AS_NUMBER(stackTop[0])); \
     } while (false)
 
-	for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-		printf("          ");
-		for (int index = 0; index < vm.stackCount; index++) {
-			printf("[ ");
-			printValue(vm.stack[index]);
-			printf(" ]");
-		}
-		printf("\n");
-		disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+#define TRACE_EXECUTION() \
+    do { \
+      vm->stackTop = stackTop; \
+      traceExecution(vm); \
+    } while (false)
+#else
+#define TRACE_EXECUTION() do {} while (false)
 #endif
-		uint8_t instruction;
-		switch (instruction = READ_BYTE()) {
-			case OP_CONSTANT: {
-				Value constant = READ_CONSTANT();
-				push(constant);
-				break;
-			}
-			case OP_ADD:      BINARY_OP(NUMBER_VAL, +); break;
-			case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-			case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-			case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-			case OP_NEGATE:
-				if (!IS_NUMBER(peek(0))) {
-					runtimeError("Operand must be a number.");
-					return INTERPRET_RUNTIME_ERROR;
-				}
-				push(NUMBER_VAL(-AS_NUMBER(pop())));
-				break;
-			case OP_RETURN: {
-				printf("\n");
-				printValue(pop());
-				printf("\n");
-				return INTERPRET_OK;
+
+#ifdef CYNCH_PROFILE
+#define PROFILE_INSTRUCTION(instruction) profileInstruction(vm->stackProfile, instruction)
+	beginProfileRun(vm->stackProfile);
+#else
+#define PROFILE_INSTRUCTION(instruction) do {} while (false)
+#endif
+
+#ifdef CYNCH_COMPUTED_GOTO
+	// Every byte without a handler of its own lands on the DEFAULT_CODE handler
+	static void* dispatchTable[256] = {
+			[0 ... 255]         = &&code_UNKNOWN,
+			[OP_CONSTANT]       = &&code_OP_CONSTANT,
+			[OP_CONSTANT_LONG]  = &&code_OP_CONSTANT_LONG,
+			[OP_ADD]            = &&code_OP_ADD,
+			[OP_SUBTRACT]       = &&code_OP_SUBTRACT,
+			[OP_MULTIPLY]       = &&code_OP_MULTIPLY,
+			[OP_DIVIDE]         = &&code_OP_DIVIDE,
+			[OP_NEGATE]         = &&code_OP_NEGATE,
+			[OP_RETURN]         = &&code_OP_RETURN,
+#define SUPERINSTRUCTION_TARGET(first, second) [OP_##first##_##second] = &&code_OP_##first##_##second,
+			SUPERINSTRUCTIONS(SUPERINSTRUCTION_TARGET)
+#undef SUPERINSTRUCTION_TARGET
+#define QUICKENED_TARGET(op) [OP_##op##_NUMBERS] = &&code_OP_##op##_NUMBERS,
+			QUICKENED_INSTRUCTIONS(QUICKENED_TARGET)
+#undef QUICKENED_TARGET
+	};
+#endif
+
+	uint8_t instruction;
+	INTERPRET_LOOP
+	{
+		CASE_CODE(OP_CONSTANT):         DO_CONSTANT(); DISPATCH();
+		CASE_CODE(OP_CONSTANT_LONG):    DO_CONSTANT_LONG(); DISPATCH();
+
+// A generic arithmetic instruction, which quickens itself when its operands are numbers, and its quickened form
+#define QUICKENED_BINARY_CODE(name, op) \
+		CASE_CODE(OP_##name): generic_OP_##name: \
+			if (ARE_NUMBERS(PEEK(0), PEEK(1))) QUICKEN(OP_##name##_NUMBERS); \
+			DO_##name(); \
+			DISPATCH(); \
+		CASE_CODE(OP_##name##_NUMBERS): \
+			if (!ARE_NUMBERS(PEEK(0), PEEK(1))) { \
+				QUICKEN(OP_##name); \
+				goto generic_OP_##name; \
+			} \
+			NUMBER_BINARY_OP(op); \
+			DISPATCH();
+		QUICKENED_BINARY_CODE(ADD, +)
+		QUICKENED_BINARY_CODE(SUBTRACT, -)
+		QUICKENED_BINARY_CODE(MULTIPLY, *)
+		QUICKENED_BINARY_CODE(DIVIDE, /)
+#undef QUICKENED_BINARY_CODE
+
+		CASE_CODE(OP_NEGATE): generic_OP_NEGATE:
+			if (IS_NUMBER(PEEK(0))) QUICKEN(OP_NEGATE_NUMBERS);
+			DO_NEGATE();
+			DISPATCH();
+		CASE_CODE(OP_NEGATE_NUMBERS):
+			if (!IS_NUMBER(PEEK(0))) {
+				QUICKEN(OP_NEGATE);
+				goto generic_OP_NEGATE;
 			}
+			PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+			DISPATCH();
+
+#define SUPERINSTRUCTION_CODE(first, second) \
+		CASE_CODE(OP_##first##_##second): DO_##first(); DO_##second(); DISPATCH();
+		SUPERINSTRUCTIONS(SUPERINSTRUCTION_CODE)
+#undef SUPERINSTRUCTION_CODE
+
+		CASE_CODE(OP_RETURN): {
+			vm->result = POP();
+			vm->stackTop = stackTop;
+			return INTERPRET_OK;
 		}
+		DEFAULT_CODE:
+			runtimeError(vm, "Unknown opcode %d.", instruction);
+			return INTERPRET_RUNTIME_ERROR;
 	}
 
-#undef READ_BYTE
 #undef READ_CONSTANT
+#undef PUSH
+#undef POP
+#undef PEEK
 #undef BINARY_OP
+#undef DO_CONSTANT
+#undef DO_CONSTANT_LONG
+#undef DO_ADD
+#undef DO_SUBTRACT
+#undef DO_MULTIPLY
+#undef DO_DIVIDE
+#undef DO_NEGATE
+#undef QUICKEN
+#undef NUMBER_BINARY_OP
+#undef TRACE_EXECUTION
+#undef PROFILE_INSTRUCTION
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+/* Disassembles the next register-based instruction
+ *
+ */
+static void traceRegisterExecution(VM* vm) {
+	disassembleRegisterInstruction(vm->chunk, &vm->tracePositions, (int)(vm->ip - vm->chunk->code));
 }
+#endif
 
-/* Interprets source code from a file:
- *      Compiles the source code and fills a chunk with the corresponding bytecode. If there is a compilation error,
- *      compile() returns false and the chunk is discarded. Otherwise, the chunk is sent to the VM to be executed.
+/* Executes the register-based instructions in the VM's chunk
  *
  *  Returns:
- *      Returns if there was an error and if it is from compilation or runtime.
+ *      INTERPRET_OK if the chunk ran to completion, INTERPRET_RUNTIME_ERROR otherwise.
  */
-InterpretResult interpret(const char* source) {
-	Chunk chunk;
-	initChunk(&chunk);
+static InterpretResult runRegisters(VM* vm) {
+#define READ_OPERANDS() \
+    uint8_t a = vm->ip[0], b = vm->ip[1], c = vm->ip[2]; \
+    vm->ip += 3
+#define RK(operand) \
+    ((operand) < RK_CONSTANT ? vm->registers[operand] : vm->chunk->constants.values[(operand) - RK_CONSTANT])
+#define BINARY_OP(valueType, op) \
+    do { \
+      READ_OPERANDS(); \
+      Value left = RK(b); \
+      Value right = RK(c); \
+      if (!IS_NUMBER(left) || !IS_NUMBER(right)) { \
+        runtimeError(vm, "Operands must be numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      vm->registers[a] = valueType(AS_NUMBER(left) op AS_NUMBER(right)); \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_EXECUTION() traceRegisterExecution(vm)
+#else
+#define TRACE_EXECUTION() do {} while (false)
+#endif
+
+#ifdef CYNCH_PROFILE
+#define PROFILE_INSTRUCTION(instruction) profileInstruction(vm->registerProfile, instruction)
+	beginProfileRun(vm->registerProfile);
+#else
+#define PROFILE_INSTRUCTION(instruction) do {} while (false)
+#endif
+
+#ifdef CYNCH_COMPUTED_GOTO
+	static void* dispatchTable[256] = {
+			[0 ... 255]             = &&code_UNKNOWN,
+			[ROP_LOAD_CONSTANT]     = &&code_ROP_LOAD_CONSTANT,
+			[ROP_ADD]               = &&code_ROP_ADD,
+			[ROP_SUBTRACT]          = &&code_ROP_SUBTRACT,
+			[ROP_MULTIPLY]          = &&code_ROP_MULTIPLY,
+			[ROP_DIVIDE]            = &&code_ROP_DIVIDE,
+			[ROP_NEGATE]            = &&code_ROP_NEGATE,
+			[ROP_RETURN]            = &&code_ROP_RETURN,
+	};
+#endif
+
+	uint8_t instruction;
+	INTERPRET_LOOP
+	{
+		CASE_CODE(ROP_LOAD_CONSTANT): {
+			READ_OPERANDS();
+			vm->registers[a] = vm->chunk->constants.values[b | (c << 8)];
+			DISPATCH();
+		}
+		CASE_CODE(ROP_ADD):      BINARY_OP(NUMBER_VAL, +); DISPATCH();
+		CASE_CODE(ROP_SUBTRACT): BINARY_OP(NUMBER_VAL, -); DISPATCH();
+		CASE_CODE(ROP_MULTIPLY): BINARY_OP(NUMBER_VAL, *); DISPATCH();
+		CASE_CODE(ROP_DIVIDE):   BINARY_OP(NUMBER_VAL, /); DISPATCH();
+		CASE_CODE(ROP_NEGATE): {
+			READ_OPERANDS();
+			(void)c;
+			Value operand = RK(b);
+			if (!IS_NUMBER(operand)) {
+				runtimeError(vm, "Operand must be a number.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			vm->registers[a] = NUMBER_VAL(-AS_NUMBER(operand));
+			DISPATCH();
+		}
+		CASE_CODE(ROP_RETURN): {
+			READ_OPERANDS();
+			(void)a;
+			(void)c;
+			vm->result = RK(b);
+			return INTERPRET_OK;
+		}
+		DEFAULT_CODE:
+			runtimeError(vm, "Unknown opcode %d.", instruction);
+			return INTERPRET_RUNTIME_ERROR;
+	}
+
+#undef READ_OPERANDS
+#undef RK
+#undef BINARY_OP
+#undef TRACE_EXECUTION
+#undef PROFILE_INSTRUCTION
+}
+
+#undef INTERPRET_LOOP
+#undef CASE_CODE
+#undef DEFAULT_CODE
+#undef DISPATCH
+#undef READ_BYTE
+
+/* Runs the VM's chunk as machine code compiled from it, and reports the runtime error it bailed out with, if any
+ *      The code leaves the instruction pointer where the interpreter would have, so errors carry the same position.
+ *
+ *  Returns:
+ *      INTERPRET_OK if the chunk ran to completion, INTERPRET_RUNTIME_ERROR otherwise.
+ */
+static InterpretResult runJit(VM* vm, const JitCode* jit) {
+	switch (jit->entry(vm->stack, &vm->ip, &vm->result)) {
+		case JIT_OK:
+			return INTERPRET_OK;
+		case JIT_OPERANDS_NOT_NUMBERS:
+			runtimeError(vm, "Operands must be numbers.");
+			return INTERPRET_RUNTIME_ERROR;
+		default:
+			runtimeError(vm, "Operand must be a number.");
+			return INTERPRET_RUNTIME_ERROR;
+	}
+}
+
+/* Compiles source code into a chunk without a VM:
+ *      If there is a compilation error, compile() returns false and the chunk is discarded. Otherwise, stack-based
+ *      chunks are optimized when asked to.
+ *
+ *  Params:
+ *      scanner:        a scanner initialized on the source code to compile
+ *      chunk:          an initialized chunk to fill with the bytecode
+ *      backend:        the instruction set to compile to
+ *      optimize:       whether to run the peephole optimizer over the chunk
+ *      printStats:     whether to print the optimizer's before/after counts to stderr
+ *
+ *  Returns:
+ *      True if the source compiled, false otherwise (the chunk is freed).
+ */
+bool buildChunk(Scanner* scanner, Chunk* chunk, Backend backend, bool optimize, bool printStats) {
+	if (!compile(scanner, chunk, backend)) {
+		freeChunk(chunk);
+		return false;
+	}
+
+	if (optimize && backend == BACKEND_STACK) {
+		OptimizeStats stats = optimizeChunk(chunk);
+		if (printStats) {
+			fprintf(stderr, "[optimizer] %d -> %d instructions (%d superinstructions), %d -> %d bytes\n",
+			        stats.instructionsBefore, stats.instructionsAfter, stats.superinstructions,
+			        stats.bytesBefore, stats.bytesAfter);
+		}
+#ifdef DEBUG_PRINT_CODE
+		disassembleChunk(chunk, "optimized");
+#endif
+	}
+
+	return true;
+}
+
+/* Compiles source code into a chunk for the VM's backend, the way interpret() does before running it
+ *
+ *  Returns:
+ *      True if the source compiled, false otherwise (the chunk is freed).
+ */
+bool compileChunk(VM* vm, Scanner* scanner, Chunk* chunk) {
+	return buildChunk(scanner, chunk, vm->backend, vm->optimize, vm->printOptimizeStats);
+}
+
+/* Runs a compiled chunk on the VM's backend, or as machine code when given some
+ *      If the stack overflows during execution, the guard page fault unwinds back here and is reported as a runtime
+ *      error. Interpreting quickens the chunk's arithmetic in place (see run()) unless its quicken flag is off, as it
+ *      is for chunks that live in read-only memory (see bytecode.c) or are run by several VMs at once (see cynch.c).
+ *      The value the chunk returns is kept in the VM's result, and printed to its output unless that is NULL.
+ *
+ *  Params:
+ *      jit:        the chunk compiled by compileJit(), or NULL to interpret it
+ *
+ *  Returns:
+ *      INTERPRET_OK or INTERPRET_RUNTIME_ERROR.
+ */
+InterpretResult interpretJitChunk(VM* vm, Chunk* chunk, const JitCode* jit) {
+	vm->chunk = chunk;
+	vm->ip = vm->chunk->code;
+	resetStack(vm);
+#ifdef DEBUG_TRACE_EXECUTION
+	initPositionCursor(&vm->tracePositions, chunk);
+#endif
+
+	VM* enclosingVM = runningVM;
+	runningVM = vm;
+
+	bool sampled = samplerRunning();
+	if (sampled) beginSampledRun(&vm->samples, chunk, &vm->ip, vm->scriptName);
+
+	InterpretResult result;
+	if (sigsetjmp(vm->stackOverflow, 1) == 0) {
+		result = jit != NULL ? runJit(vm, jit) : vm->backend == BACKEND_REGISTER ? runRegisters(vm) : run(vm);
+	} else {
+		runtimeError(vm, "Stack overflow.");
+		result = INTERPRET_RUNTIME_ERROR;
+	}
+
+	if (sampled) endSampledRun(&vm->samples);
+	runningVM = enclosingVM;
+
+#ifdef CYNCH_PROFILE
+	endProfileRun(vm->backend == BACKEND_REGISTER ? vm->registerProfile : vm->stackProfile);
+#endif
+
+	if (result == INTERPRET_OK && vm->output != NULL) {
+		fprintf(vm->output, "\n");
+		fprintValue(vm->output, vm->result);
+		fprintf(vm->output, "\n");
+	}
+
+	return result;
+}
 
-	if (!compile(source, &chunk)) {
-		freeChunk(&chunk);
-		return INTERPRET_COMPILE_ERROR;
+/* Runs a compiled chunk on the VM's backend, with interpretJitChunk()
+ *      With the JIT enabled (see setJit()), a stack-based chunk is compiled to machine code for this run only. Code
+ *      compiled while the sampler is running keeps the instruction pointer up to date for it.
+ *
+ *  Returns:
+ *      INTERPRET_OK or INTERPRET_RUNTIME_ERROR.
+ */
+InterpretResult interpretChunk(VM* vm, Chunk* chunk) {
+	JitCode jit;
+	if (!vm->jit || vm->backend != BACKEND_STACK || !compileJit(chunk, samplerRunning(), &jit)) {
+		return interpretJitChunk(vm, chunk, NULL);
 	}
 
-	vm.chunk = &chunk;
-	vm.ip = vm.chunk->code;
+	InterpretResult result = interpretJitChunk(vm, chunk, &jit);
+	freeJit(&jit);
+	return result;
+}
+
+/* Interprets source code from a scanner, which may be reading a mapped or streamed file (see source.h):
+ *      Compiles the source code into a chunk with compileChunk(), runs it with interpretChunk() and frees it.
+ *      Everything the compiler and the chunk allocate comes from the VM's arena, which is reset in one go at the end
+ *      instead of freeing each array. That is also what makes running out of memory recoverable: the VM's tracker
+ *      unwinds back here, and the arena takes whatever was allocated along with it.
+ *
+ *  Returns:
+ *      Returns if there was an error and if it is from compilation or runtime.
+ */
+InterpretResult interpretSource(VM* vm, Scanner* scanner) {
+	Chunk chunk;
+	initChunkIn(&chunk, &vm->arena.allocator);
+
+	jmp_buf recover;
+	vm->memory.recover = &recover;
 
-	InterpretResult result = run();
+	InterpretResult result = INTERPRET_COMPILE_ERROR;
+	switch (setjmp(recover)) {
+		case 0:
+			if (compileChunk(vm, scanner, &chunk)) result = interpretChunk(vm, &chunk);
+			break;
+		case MEMORY_LIMIT_EXCEEDED:
+			fprintf(stderr, "Memory limit exceeded.\n");
+			result = INTERPRET_RUNTIME_ERROR;
+			break;
+		default:
+			fprintf(stderr, "Out of memory.\n");
+			result = INTERPRET_RUNTIME_ERROR;
+			break;
+	}
 
-	freeChunk(&chunk);
+	vm->memory.recover = NULL;
+	resetArena(&vm->arena);
 	return result;
-}
\ No newline at end of file
+}
+
+/* Interprets source code held in a string, with interpretSource()
+ *
+ *  Returns:
+ *      Returns if there was an error and if it is from compilation or runtime.
+ */
+InterpretResult interpret(VM* vm, const char* source) {
+	Scanner scanner;
+	initScanner(&scanner, source, strlen(source));
+	return interpretSource(vm, &scanner);
+}